@@ -20,6 +20,7 @@ Item{
             , isGroup: panelParent.curSeesionType == 2
             , msgSenderRole: "成员"
             , msgSender: bSend ?  "我" : msg[7]
+            , msgId: msg[0]
             , msgSenderUuid: msg[1]
             , isSend: bSend
             , msgType: msg[3]
@@ -63,6 +64,16 @@ Item{
             appendMsg(recvMsg)
             chatMsgControlerContentListView.positionViewAtEnd()
         }
+
+        onSessionMsgDataUpdate: {
+            var msgModel = chatMsgControlerContentListView.model
+            for (var index = msgModel.count - 1; index >= 0; --index){
+                if (msgModel.get(index).msgId == mid){
+                    msgModel.setProperty(index, "msgRealData", mdata)
+                    return
+                }
+            }
+        }
     }
 
     FileDialog{
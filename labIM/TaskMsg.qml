@@ -44,10 +44,22 @@ DialogFrame{
             taskId: task[0],
             taskType: task[1],
             taskData: task[3],
-            taskState: task[4]
+            taskState: task[4],
+            taskQueuePos: TaskManager.getTaskQueuePos(task[0]),
+            taskProgressValue: TaskManager.getTaskProgress(task[0]),
+            taskSpeed: 0,
+            taskEta: -1
         })
     }
 
+    function getTaskSpeedStr(speed, eta){
+        var speedStr = taskMsgRoot.panelParent.getFileSizeStr(speed) + "/s"
+        if (eta < 0) return speedStr
+        if (eta < 60) return speedStr + " 剩余" + eta + "秒"
+        if (eta < 3600) return speedStr + " 剩余" + Math.floor(eta / 60) + "分" + eta % 60 + "秒"
+        return speedStr + " 剩余" + Math.floor(eta / 3600) + "时" + Math.floor(eta % 3600 / 60) + "分"
+    }
+
     function getTaskNameStr(tdata, ttype){
         if (ttype == 0){
             return tdata["fileName"]
@@ -70,6 +82,26 @@ DialogFrame{
         }
     }
 
+    Connections{
+        target: TaskManager
+        onTaskProgressUpdated: {
+            //update: tid, progress, speed, eta
+            var taskIndexMap = {}
+            for (var index = 0; index < runningTaskModel.count; ++index)
+                taskIndexMap[runningTaskModel.get(index).taskId] = index
+
+            for (var begin = 0; begin < updates.length; ++begin){
+                var update = updates[begin]
+                if (taskIndexMap[update[0]] === undefined) continue
+
+                var taskIndex = taskIndexMap[update[0]]
+                runningTaskModel.setProperty(taskIndex, "taskProgressValue", update[1])
+                runningTaskModel.setProperty(taskIndex, "taskSpeed", update[2])
+                runningTaskModel.setProperty(taskIndex, "taskEta", update[3])
+            }
+        }
+    }
+
     ListModel{
         id: runningTaskModel
     }
@@ -204,21 +236,18 @@ DialogFrame{
                             target: taskItemControlPopupMenu
                             onPauseTask:{
                                 if (selectIndex == index) {
-                                    taskProgressTimer.stop()
                                     TaskManager.pauseTask(taskId)
                                 }
                             }
 
                             onRestoreTask:{
                                 if (selectIndex == index) {
-                                    taskProgressTimer.restart()
                                     TaskManager.restoreTask(taskId)
                                 }
                             }
 
                             onStopTask:{
                                 if (selectIndex == index) {
-                                    taskProgressTimer.stop()
                                     TaskManager.stopTask(taskId)
                                 }
                             }
@@ -228,7 +257,6 @@ DialogFrame{
                             target: DBOP
                             onTaskHandleFinished: {
                                 if (taskId == tid){
-                                    taskProgressTimer.stop()
                                     runningTaskModel.remove(index)
                                 }
                             }
@@ -240,6 +268,15 @@ DialogFrame{
                             }
                         }
 
+                        Connections{
+                            target: TaskManager
+                            onTaskQueuePosChanged: {
+                                if (taskId == tid){
+                                    taskQueuePos = pos
+                                }
+                            }
+                        }
+
                         Image {
                             id: taskTypeImg
                             width: 26
@@ -287,16 +324,28 @@ DialogFrame{
                             text: getTaskTotalStr(taskListItem.taskDetail, taskType)
                         }
 
-                        Timer{
-                            id: taskProgressTimer
-                            interval: 1000
-                            running: taskState == 0 ? true : false
-                            repeat: true
-                            triggeredOnStart: true
-                            onTriggered: {
-                                var taskExeRate = TaskManager.getTaskProgress(taskId)
-                                taskProgress.value = taskExeRate
-                            }
+                        Label{
+                            anchors.right: taskTotalTextArea.left
+                            anchors.rightMargin: 10
+                            anchors.verticalCenter: taskNameArea.verticalCenter
+                            font.family: "宋体"
+                            color: "#69F"
+                            font.pixelSize: 11
+                            renderType: Text.NativeRendering
+                            visible: taskQueuePos >= 0
+                            text: "排队中 " + (taskQueuePos + 1)
+                        }
+
+                        Label{
+                            anchors.right: taskTotalTextArea.left
+                            anchors.rightMargin: 10
+                            anchors.verticalCenter: taskNameArea.verticalCenter
+                            font.family: "宋体"
+                            color: "#69F"
+                            font.pixelSize: 11
+                            renderType: Text.NativeRendering
+                            visible: taskQueuePos < 0 && taskState == 0 && taskSpeed > 0
+                            text: getTaskSpeedStr(taskSpeed, taskEta)
                         }
 
                         ProgressBar {
@@ -306,6 +355,7 @@ DialogFrame{
                              anchors.leftMargin: 10
                              anchors.bottom: taskTypeImg.bottom
                              to: 100
+                             value: taskProgressValue
 
                              background: Rectangle {
                                  implicitWidth: taskListItem.width - taskTypeImg.width - 10
@@ -4,10 +4,14 @@
 
 #include <QThread>
 #include <QDir>
+#include <QCommandLineParser>
+
+#include <future>
 
 #include "src/DBop.h"
 #include "src/IOContextManager.h"
 #include "src/MessageManager.h"
+#include "src/MulticastManager.h"
 #include "src/UserManager.h"
 #include "src/NetStructureManager.h"
 #include "src/AdminManager.h"
@@ -15,32 +19,80 @@
 #include "src/UserReuqestManager.h"
 #include "src/TaskManager.h"
 #include "src/HomeworkManager.h"
+#include "src/NetSimulator.h"
+#include "src/HostProbe.h"
+#include "src/StartupTimer.h"
 
 #include <QQuickWindow>
 
 int main(int argc, char *argv[])
 {
+    StartupTimer::getInstance();
     QCoreApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
     QGuiApplication app(argc, argv);
     QQmlApplicationEngine engine;
 
-    DBOP::getInstance();
-    auto networkThread = QThread::create([](){
+    //模拟多节点时每个实例使用不同的回环地址和数据目录, 不加载界面
+    QCommandLineParser parser;
+    QCommandLineOption headlessOption("headless", "Run without the main window.");
+    QCommandLineOption ipOption("ip", "Bind to this local address.", "ip");
+    QCommandLineOption udpPortOption("udp-port", "UDP port.", "port");
+    QCommandLineOption tcpPortOption("tcp-port", "TCP port.", "port");
+    QCommandLineOption mcastPortOption("mcast-port", "Multicast file transfer port.", "port");
+    QCommandLineOption dataDirOption("data-dir", "Working directory for database and files.", "dir");
+    QCommandLineOption simulateOption("simulate", "Enable network simulation and stats.");
+    QCommandLineOption simDelayOption("sim-delay", "Simulated one-way delay in ms.", "ms", "0");
+    QCommandLineOption simJitterOption("sim-jitter", "Simulated UDP delay jitter in ms.", "ms", "0");
+    QCommandLineOption simLossOption("sim-loss", "Simulated UDP loss rate (0-1).", "rate", "0");
+    parser.addOptions({ headlessOption, ipOption, udpPortOption, tcpPortOption, mcastPortOption, dataDirOption,
+        simulateOption, simDelayOption, simJitterOption, simLossOption });
+    parser.process(app);
+
+    if (parser.isSet(dataDirOption)) {
+        QDir().mkpath(parser.value(dataDirOption));
+        QDir::setCurrent(parser.value(dataDirOption));
+    }
+    if (parser.isSet(ipOption)) setLocalIp(parser.value(ipOption).toStdString());
+    if (parser.isSet(udpPortOption)) HostDescription::setUdpPort(parser.value(udpPortOption).toUShort());
+    if (parser.isSet(tcpPortOption)) HostDescription::setTcpPort(parser.value(tcpPortOption).toUShort());
+    if (parser.isSet(mcastPortOption)) HostDescription::setMcastPort(parser.value(mcastPortOption).toUShort());
+    if (parser.isSet(simulateOption))
+        NetSimulator::getInstance()->enable(parser.value(simDelayOption).toInt(), parser.value(simJitterOption).toInt(), parser.value(simLossOption).toDouble());
+
+    //网络线程先启动, 本机探测, 端口绑定与数据库初始化, 界面加载同时进行; 收到的消息会读写数据库, 等数据库就绪后再运行事件循环
+    std::promise<void> dbReady;
+    std::shared_future<void> dbReadyFuture = dbReady.get_future().share();
+    auto networkThread = QThread::create([dbReadyFuture](){
 		QDir().mkdir(tmpDir.c_str());
 		QDir().mkdir(groupDir.c_str());
+        bool isProbeCached = HostProbe::loadCache();
+        auto hostProbed = std::async(std::launch::async, []() {
+            HostProbe::probe();
+            StartupTimer::getInstance()->mark("hostProbed");
+        });
+
         auto msgm = MessageManager::getInstance();
         msgm->run();
+        MulticastManager::getInstance()->run();
+        StartupTimer::getInstance()->mark("socketsBound");
+        hostProbed.wait();
+        dbReadyFuture.wait();
 
         auto iom = IOContextManager::getInstance();
         iom->init();
         iom->run();
 
-        NetStructureManager::getInstance()->buildNetStructure(1);
+        NetStructureManager::getInstance()->warmStart();
+        if (isProbeCached) boost::asio::post(iom->getWorkLoop(), []() { HostProbe::refreshCache(); });
         iom->wait();
         qDebug() << "thread stop";
     });
 	networkThread->start();
 
+    DBOP::getInstance();
+    StartupTimer::getInstance()->mark("dbReady");
+    dbReady.set_value();
+
     engine.rootContext()->setContextProperty("UserManager", UserManager::getInstance());
     engine.rootContext()->setContextProperty("AdminManager", AdminManager::getInstance());
     engine.rootContext()->setContextProperty("SessionManager", SessionManager::getInstance());
@@ -58,13 +110,23 @@ int main(int argc, char *argv[])
 		app.quit();
     });
 
-    engine.addImportPath(":/imports");
-    engine.load(QUrl(QStringLiteral("qrc:/MainWindow.qml")));
-	QObject *topLevel = engine.rootObjects().value(0);
-	QQuickWindow *window = qobject_cast<QQuickWindow *>(topLevel);
-	window->setColor(QColor(Qt::transparent));
+    if (!parser.isSet(headlessOption)) {
+        engine.addImportPath(":/imports");
+        engine.load(QUrl(QStringLiteral("qrc:/MainWindow.qml")));
+        QObject *topLevel = engine.rootObjects().value(0);
+        QQuickWindow *window = qobject_cast<QQuickWindow *>(topLevel);
+        window->setColor(QColor(Qt::transparent));
+        StartupTimer::getInstance()->mark("qmlLoaded");
+
+        auto firstFrame = std::make_shared<QMetaObject::Connection>();
+        *firstFrame = QObject::connect(window, &QQuickWindow::frameSwapped, [firstFrame]() {
+            StartupTimer::getInstance()->mark("windowShown");
+            QObject::disconnect(*firstFrame);
+        });
+    }
 
 	app.exec();
+    DBOP::getInstance()->flushWrites();
     abort();
 
     return 0;
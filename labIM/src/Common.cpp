@@ -3,6 +3,8 @@
 #include <windows.h>
 #include <iphlpapi.h>
 
+#include <vector>
+
 #pragma comment(lib,"iphlpapi.lib")
 
 ConnImplType ConnType::CONN_TEMP = 0;
@@ -30,53 +32,60 @@ ConnImplType ConnType::getConnType(HostRole source, HostRole dest) {
 
 ushort HostDescription::udpPort = 8888;
 ushort HostDescription::tcpPort = 8889;
+ushort HostDescription::mcastPort = 8890;
 
-void HostDescription::setTcpPort(ushort newPort) {
+static StringType localIpOverride;
 
+//端口和本机地址要在MessageManager等单例创建之前设置
+void HostDescription::setTcpPort(ushort newPort) {
+	tcpPort = newPort;
 }
 
 void HostDescription::setUdpPort(ushort newPort) {
-
+	udpPort = newPort;
 }
 
-ulonglong getAvailMemory() {
-	MEMORYSTATUS ms;
-	::GlobalMemoryStatus(&ms);
-	return (ulonglong)ms.dwAvailPhys + (ulonglong)ms.dwAvailVirtual;
+void HostDescription::setMcastPort(ushort newPort) {
+	mcastPort = newPort;
 }
 
-uint getCpuFrequency() {
-	DWORD low1 = 0, high1 = 0, low2 = 0, high2 = 0;
-	LARGE_INTEGER fq, st, ed;
+void setLocalIp(const StringType& ip) {
+	localIpOverride = ip;
+}
 
-	::QueryPerformanceFrequency(&fq);
-	::QueryPerformanceCounter(&st);
+ulonglong getAvailMemory() {
+	//只计可用物理内存, 虚拟地址空间对所有64位节点都一样大, 会掩盖内存差别
+	MEMORYSTATUSEX ms;
+	ms.dwLength = sizeof(ms);
+	if (!::GlobalMemoryStatusEx(&ms)) return 0;
+	return (ulonglong)ms.ullAvailPhys;
+}
 
-	__asm {
-		rdtsc
-		mov low1, eax
-		mov high1, edx
+ulonglong getLinkSpeed(const StringType& ip)
+{
+	ULONG buffLen = 16 * 1024;
+	std::vector<char> buff(buffLen);
+	ULONG flags = GAA_FLAG_SKIP_ANYCAST | GAA_FLAG_SKIP_MULTICAST | GAA_FLAG_SKIP_DNS_SERVER;
+	DWORD hr = GetAdaptersAddresses(AF_INET, flags, NULL, (PIP_ADAPTER_ADDRESSES)buff.data(), &buffLen);
+	if (hr == ERROR_BUFFER_OVERFLOW) {
+		buff.resize(buffLen);
+		hr = GetAdaptersAddresses(AF_INET, flags, NULL, (PIP_ADAPTER_ADDRESSES)buff.data(), &buffLen);
 	}
-
-	::Sleep(15);
-	::QueryPerformanceCounter(&ed);
-
-	__asm {
-		rdtsc
-		mov low2, eax
-		mov high2, edx
+	if (hr != NO_ERROR) return 0;
+
+	for (auto adapter = (PIP_ADAPTER_ADDRESSES)buff.data(); adapter != NULL; adapter = adapter->Next) {
+		for (auto unicast = adapter->FirstUnicastAddress; unicast != NULL; unicast = unicast->Next) {
+			char addr[INET_ADDRSTRLEN]{ '\0' };
+			inet_ntop(AF_INET, &((sockaddr_in*)unicast->Address.lpSockaddr)->sin_addr, addr, sizeof(addr));
+			if (ip == addr)
+				return adapter->TransmitLinkSpeed;
+		}
 	}
 
-	LONGLONG begin = (LONGLONG)high1 << 32 | low1;
-	LONGLONG end = (LONGLONG)high2 << 32 | low2;
-
-	SYSTEM_INFO si;
-	GetSystemInfo(&si);
-
-	return uint(((end - begin)*fq.QuadPart / (ed.QuadPart - st.QuadPart) * si.dwNumberOfProcessors) >> 15);
+	return 0;
 }
 
-StringType getLocalIp()
+static StringType resolveLocalIp()
 {
 	boost::asio::io_service io_service;
 	udp::resolver resolver(io_service);
@@ -91,6 +100,15 @@ StringType getLocalIp()
 	return StringType();
 }
 
+StringType getLocalIp()
+{
+	//解析主机名较慢, 各模块启动时都会调用, 只解析一次
+	if (!localIpOverride.empty()) return localIpOverride;
+
+	static const StringType resolvedIp = resolveLocalIp();
+	return resolvedIp;
+}
+
 ulong getIpUlong(const StringType& ip){
 	struct in_addr in;
 	inet_pton(AF_INET, ip.c_str(), (void *)&in);
@@ -85,8 +85,14 @@ const StringType groupDir = ".\\group\\";
 
 const StringType homeworkDir = ".\\homework\\";
 
+const StringType topologyFile = ".\\topology.json";
+
 const StringType UDP_BROADCAST_ADDR = "255.255.255.255";
 
+const StringType UDP_MULTICAST_ADDR = "239.255.43.21";
+
+const StringType UDP_DISCOVERY_ADDR = "239.255.43.20";
+
 const StringType INVALID_ID = "";
 
 const QString timeFormat("yyyy.MM.dd hh:mm:ss");
@@ -134,12 +140,14 @@ struct  HostDescription
 
 	static ushort udpPort;
 	static ushort tcpPort;
+	static ushort mcastPort;
 	
 	static void setUdpPort(ushort newPort);
 	static void setTcpPort(ushort newPort);
+	static void setMcastPort(ushort newPort);
 };
 
-uint getCpuFrequency();
+ulonglong getLinkSpeed(const StringType& ip);
 
 ulonglong getAvailMemory();
 
@@ -147,6 +155,8 @@ ulong getIpUlong(const StringType& ip);
 
 StringType getLocalIp();
 
+void setLocalIp(const StringType& ip);
+
 StringType getMac(const StringType& ip);
 
 StringType getMac();
@@ -3,16 +3,25 @@
 #include "NetStructureManager.h"
 #include "MessageManager.h"
 #include "DBop.h"
+#include "NetSimulator.h"
+
+#include "QtCore\qdatetime.h"
+
+#include <algorithm>
 
 const StringType connManagefamilyStr("ConnManage");
 const StringType sendSingleActionStr("SendSingle");
 const StringType sendGroupActionStr("SendGroup");
 const StringType sendBroadcastActionStr("SendBroadcast");
 const StringType sendRandomActionStr("SendRandom");
+const StringType groupSummaryActionStr("GroupSummary");
 
-const int maxRouteCount = 1;
+const int maxRouteHops = 8;
+const int dedupMaxEntries = 20000;
+const qint64 dedupWindowMs = 60000;
 
 ConnectionManager::ConnectionManager()
+	: isSummaryDirty(true), msgSeq(QDateTime::currentMSecsSinceEpoch()), messageDedup(dedupMaxEntries, dedupWindowMs)
 {
 	validConn[ConnType::CONN_PARENT] = ConnMap();
 	validConn[ConnType::CONN_BROTHER] = ConnMap();
@@ -24,6 +33,13 @@ ConnectionManager::ConnectionManager()
 	registerActionHandler(sendSingleActionStr, std::bind(&ConnectionManager::handleMsgSingle, this, _1, _2));
 	registerActionHandler(sendGroupActionStr, std::bind(&ConnectionManager::handleMsgGroup, this, _1, _2));
 	registerActionHandler(sendBroadcastActionStr, std::bind(&ConnectionManager::handleMsgBroadcast, this, _1, _2));
+	registerActionHandler(groupSummaryActionStr, std::bind(&ConnectionManager::handleGroupSummary, this, _1, _2));
+
+	//组成员变化后在下一次心跳时重新计算子树摘要
+	auto dbop = DBOP::getInstance();
+	QObject::connect(dbop, &DBOP::groupMembersAdded, [this](const QString&, const QStringList&) { isSummaryDirty = true; });
+	QObject::connect(dbop, &DBOP::groupMemberRemoved, [this](const QString&, const QString&) { isSummaryDirty = true; });
+	QObject::connect(dbop, &DBOP::userGroupDeleted, [this](const QString&) { isSummaryDirty = true; });
 }
 
 ConnectionManager::~ConnectionManager()
@@ -47,8 +63,26 @@ void ConnectionManager::registerObj(StringType id, ConnImplType type, ConnPtr co
 
 	conn->setID(id);
 	conn->start();
-	if (validConn.find(type) != validConn.end()) {
-		validConn[type][id] = conn;
+	{
+		QMutexLocker locker(&connMutex);
+		if (validConn.find(type) != validConn.end()) {
+			validConn[type][id] = conn;
+		}
+
+		//结构连接记入连接位图, 组消息转发时与组成员位图求交
+		if (type != ConnType::CONN_TEMP) {
+			int index = GroupIndex::getInstance()->getUserIndex(id.c_str());
+			auto& bits = linkBits[type];
+			if (bits.size() <= index) bits.resize(index + 1);
+			bits.setBit(index);
+		}
+	}
+
+	if (type != ConnType::CONN_TEMP) {
+		//新的上级或兄弟需要收到一份完整的摘要
+		QMutexLocker locker(&summaryMutex);
+		if (type != ConnType::CONN_CHILD) localSummary = GroupSummary();
+		isSummaryDirty = true;
 	}
 
 	//这最好记录日志
@@ -56,26 +90,140 @@ void ConnectionManager::registerObj(StringType id, ConnImplType type, ConnPtr co
 
 void ConnectionManager::unregisterObj(const StringType& id)
 {
-	for (auto& conns : validConn) {
-		if (conns.second.erase(id))
-			return;
+	bool isLink = false;
+	{
+		QMutexLocker locker(&connMutex);
+		for (auto& conns : validConn) {
+			if (conns.second.erase(id)) {
+				if (conns.first != ConnType::CONN_TEMP) {
+					int index = GroupIndex::getInstance()->getUserIndex(id.c_str());
+					auto& bits = linkBits[conns.first];
+					if (index < bits.size()) bits.clearBit(index);
+					isLink = true;
+				}
+				break;
+			}
+		}
 	}
+	if (!isLink) return;
+
+	QMutexLocker locker(&summaryMutex);
+	groupSummaries.erase(id);
+	isSummaryDirty = true;
 }
 
-const QHash<QString, QStringList>& ConnectionManager::getUserGroupMap()
+ConnectionManager::ConnMap ConnectionManager::getConns(ConnImplType type)
 {
-	static bool isInit = false;
+	QMutexLocker locker(&connMutex);
+	return validConn[type];
+}
+
+ConnPtr ConnectionManager::firstConn(ConnImplType type)
+{
+	QMutexLocker locker(&connMutex);
+	auto& conns = validConn[type];
+	return conns.empty() ? ConnPtr() : conns.begin()->second;
+}
 
-	if (!isInit) {
-		userGroupMap = getUsersJoinGroups();
-		isInit = true;
+std::vector<ConnPtr> ConnectionManager::getGroupRoutes(ConnImplType type, const QString & groupId)
+{
+	//连接对端本身是成员, 或者它上报的子树摘要中可能有成员
+	auto links = getGroupLinks(type, groupId);
+	std::vector<StringType> candidates;
+	{
+		QMutexLocker locker(&summaryMutex);
+		for (auto& summary : groupSummaries) {
+			if (summary.second.mightContain(groupId)) candidates.push_back(summary.first);
+		}
 	}
 
-	return userGroupMap;
+	auto conns = getConns(type);
+	for (auto& id : candidates) {
+		auto it = conns.find(id);
+		if (it != conns.end() && std::find(links.begin(), links.end(), it->second) == links.end())
+			links.push_back(it->second);
+	}
+	return links;
+}
+
+void ConnectionManager::refreshGroupSummary()
+{
+	if (!isSummaryDirty.exchange(false)) return;
+
+	//本节点与直连子节点所在的组, 再并上各下级路由节点上报的摘要
+	QBitArray hosts;
+	{
+		QMutexLocker locker(&connMutex);
+		hosts = linkBits[ConnType::CONN_CHILD];
+	}
+	auto children = getConns(ConnType::CONN_CHILD);
+	int localIndex = GroupIndex::getInstance()->getUserIndex(NetStructureManager::getInstance()->getLocalUuid().c_str());
+	if (hosts.size() <= localIndex) hosts.resize(localIndex + 1);
+	hosts.setBit(localIndex);
+
+	GroupSummary summary;
+	for (auto& groupId : GroupIndex::getInstance()->getGroupsOf(hosts))
+		summary.add(groupId);
+
+	{
+		QMutexLocker locker(&summaryMutex);
+		for (auto& childSummary : groupSummaries) {
+			if (children.count(childSummary.first))
+				summary.merge(childSummary.second);
+		}
+
+		if (summary == localSummary) return;
+		localSummary = summary;
+	}
+
+	JsonObjType datas;
+	datas["summary"] = summary.toBase64();
+
+	JsonObjType msg;
+	msg["family"] = connManagefamilyStr.c_str();
+	msg["action"] = groupSummaryActionStr.c_str();
+	msg["data"] = datas;
+	sendtoParent(msg);
+	for (auto& brother : getConns(ConnType::CONN_BROTHER))
+		brother.second->send(msg);
+}
+
+void ConnectionManager::handleGroupSummary(JsonObjType & msg, ConnPtr conn)
+{
+	if (conn.get() == nullptr) return;
+
+	auto summary = GroupSummary::fromBase64(msg["data"].toObject()["summary"].toString());
+	QMutexLocker locker(&summaryMutex);
+	groupSummaries[conn->getID()] = summary;
+	if (getConnType(conn->getID()) == ConnType::CONN_CHILD) isSummaryDirty = true;
+}
+
+std::vector<ConnPtr> ConnectionManager::getGroupLinks(ConnImplType type, const QString & groupId)
+{
+	QBitArray bits;
+	ConnMap conns;
+	{
+		QMutexLocker locker(&connMutex);
+		bits = linkBits[type];
+		conns = validConn[type];
+	}
+
+	std::vector<ConnPtr> links;
+	auto groupIndex = GroupIndex::getInstance();
+	auto targets = groupIndex->intersect(groupId, bits);
+	for (int index = 0; index < targets.size(); ++index) {
+		if (!targets.testBit(index)) continue;
+
+		auto it = conns.find(groupIndex->getUser(index).toStdString());
+		if (it != conns.end())
+			links.push_back(it->second);
+	}
+	return links;
 }
 
 ConnPtr ConnectionManager::findConn(const StringType & id)
 {
+	QMutexLocker locker(&connMutex);
 	for (auto& conns : validConn) {
 		auto it = conns.second.find(id);
 		if (it != conns.second.end()) {
@@ -86,6 +234,58 @@ ConnPtr ConnectionManager::findConn(const StringType & id)
 	return ConnPtr();
 }
 
+ConnImplType ConnectionManager::getConnType(const StringType & id)
+{
+	QMutexLocker locker(&connMutex);
+	for (auto& conns : validConn) {
+		if (conns.second.find(id) != conns.second.end())
+			return conns.first;
+	}
+
+	return ConnType::CONN_TEMP;
+}
+
+bool ConnectionManager::hasParent()
+{
+	QMutexLocker locker(&connMutex);
+	return !validConn[ConnType::CONN_PARENT].empty();
+}
+
+std::vector<StringType> ConnectionManager::getConnIds(ConnImplType type)
+{
+	QMutexLocker locker(&connMutex);
+	std::vector<StringType> ids;
+	for (auto& conn : validConn[type])
+		ids.push_back(conn.first);
+	return ids;
+}
+
+StringType ConnectionManager::getNextHop(const StringType & dest)
+{
+	QMutexLocker locker(&connMutex);
+
+	//直连节点直接发送
+	for (auto type : { ConnType::CONN_CHILD, ConnType::CONN_PARENT, ConnType::CONN_BROTHER }) {
+		if (validConn[type].find(dest) != validConn[type].end())
+			return dest;
+	}
+
+	//从目标所属的路由节点沿上级链向上, 第一个直连的子节点或兄弟节点就是下一跳; 否则交给父节点, 主节点没有父节点时无路可走
+	auto localId = NetStructureManager::getInstance()->getLocalUuid();
+	auto hop = routingTable.getOwner(dest);
+	for (int level = 0; !hop.empty() && hop != localId && level < maxRouteHops; ++level) {
+		for (auto type : { ConnType::CONN_CHILD, ConnType::CONN_BROTHER }) {
+			if (validConn[type].find(hop) != validConn[type].end())
+				return hop;
+		}
+		hop = routingTable.getParent(hop);
+	}
+
+	if (!validConn[ConnType::CONN_PARENT].empty())
+		return validConn[ConnType::CONN_PARENT].begin()->first;
+	return INVALID_ID;
+}
+
 ConnPtr ConnectionManager::connnectHost(ConnImplType type, const StringType& id, JsonObjType& addr, ServicePtr servicePtr, ConnectHandler&& handler)
 {
 	HostDescription hd;
@@ -108,20 +308,19 @@ void ConnectionManager::sendtoConn(const StringType& id, JsonObjType msg)
 	}
 }
 
-QHash<QString, QStringList> ConnectionManager::getUsersJoinGroups()
+void ConnectionManager::sendtoChildRouters(JsonObjType msg)
 {
-	QHash<QString, QStringList> result;
-	auto dbop = DBOP::getInstance();
-	for (auto& conns : validConn) {
-		for (auto& conn : conns.second) {
-			result[conn.first.c_str()] = dbop->listJoinGroup(conn.first.c_str());
-		}
+	//路由表中记录为自身所属的子节点是下级路由节点
+	for (auto& child : getConns(ConnType::CONN_CHILD)) {
+		if (routingTable.getOwner(child.first) == child.first)
+			child.second->send(msg);
 	}
+}
 
-	QString localUuid = NetStructureManager::getInstance()->getLocalUuid().c_str();
-	result[localUuid] = dbop->listJoinGroup(localUuid);
-
-	return result;
+void ConnectionManager::sendtoParent(JsonObjType msg)
+{
+	for (auto& parent : getConns(ConnType::CONN_PARENT))
+		parent.second->send(msg);
 }
 
 void ConnectionManager::sendSingleMsg(JsonObjType& msg, bool isRepackage)
@@ -131,6 +330,7 @@ void ConnectionManager::sendSingleMsg(JsonObjType& msg, bool isRepackage)
 	auto data = isRepackage ? msg["data"].toObject() : msg["data"].toObject()["data"].toObject();
 	auto dest = data["dest"].toString().toStdString();
 	if (dest == NetStructureManager::getInstance()->getLocalUuid()) {
+		NetSimulator::getInstance()->recordHops(isRepackage ? 0 : msg["hops"].toInt());
 		familyParse(isRepackage ? msg : msg["data"].toObject(), nullptr);
 		return;
 	}
@@ -142,122 +342,59 @@ void ConnectionManager::sendSingleMsg(JsonObjType& msg, bool isRepackage)
 		sendMsg["data"] = msg;
 	}
 
-	auto role = NetStructureManager::getInstance()->getLocalRole();
-	switch (role)
-	{
-	case ROLE_MASTER:
-		if (isRepackage){
-			auto result = validConn[ConnType::CONN_CHILD].end();
-			result = validConn[ConnType::CONN_CHILD].find(dest);
-			if (result != validConn[ConnType::CONN_CHILD].end()) {
-				result->second->send(sendMsg);
-			}
-			else {
-				if (!validConn[ConnType::CONN_CHILD].empty())
-					validConn[ConnType::CONN_CHILD].begin()->second->send(sendMsg);
-			}
-		}
-		break;
-	case ROLE_ROUTER:
-		{
-			auto result = validConn[ConnType::CONN_CHILD].end();
-			result = validConn[ConnType::CONN_CHILD].find(dest);
-			if (result != validConn[ConnType::CONN_CHILD].end()) {
-				result->second->send(isRepackage ? sendMsg : msg);
-			}
-			else {
-				if (!(isRepackage ? sendMsg.contains("routeCount") : msg.contains("routeCount"))) {
-					(isRepackage ? sendMsg["routeCount"] : msg["routeCount"]) = 1;
-					auto result = validConn[ConnType::CONN_PARENT].end();
-					result = validConn[ConnType::CONN_PARENT].find(dest);
-					if (result != validConn[ConnType::CONN_PARENT].end()) {
-						result->second->send(isRepackage ? sendMsg : msg);
-						return;
-					}
-				}
-
-				int routeCount = isRepackage ? sendMsg["routeCount"].toInt() : msg["routeCount"].toInt();
-				(isRepackage ? sendMsg["routeCount"] : msg["routeCount"]) = routeCount + 1;
-				if (routeCount >= maxRouteCount) return;
+	//路由表可能短暂过期, 用跳数上限防止消息在节点间来回转发
+	auto& forwardMsg = isRepackage ? sendMsg : msg;
+	int hops = forwardMsg["hops"].toInt();
+	if (hops >= maxRouteHops) {
+		qDebug() << "single msg exceed max hops! dest: " << dest.c_str();
+		return;
+	}
+	forwardMsg["hops"] = hops + 1;
 
-				if (!validConn[ConnType::CONN_BROTHER].empty())
-					validConn[ConnType::CONN_BROTHER].begin()->second->send(isRepackage ? sendMsg : msg);
-			}
-		}
-		break;
-	case ROLE_MEMBER:
-		if (isRepackage) {
-			if (!validConn[ConnType::CONN_PARENT].empty())
-				validConn[ConnType::CONN_PARENT].begin()->second->send(sendMsg);
-		}
-		break;
-	default:
-		break;
+	auto nextHop = findConn(getNextHop(dest));
+	if (nextHop.get() == nullptr) {
+		qDebug() << "single msg no route! dest: " << dest.c_str();
+		return;
 	}
+	nextHop->send(forwardMsg);
 }
 
-void ConnectionManager::sendGroupMsg(JsonObjType& msg, bool isRepackage)
+void ConnectionManager::sendGroupMsg(JsonObjType& msg, bool isRepackage, const StringType& from)
 {
 	qDebug() << "group msg! isSend: " << isRepackage << " package: " << msg;
 
-	getUserGroupMap();
-
 	JsonObjType sendMsg;
 	if (isRepackage) {
 		sendMsg["family"] = connManagefamilyStr.c_str();
 		sendMsg["action"] = sendGroupActionStr.c_str();
+		sendMsg["msgId"] = newMessageId();
 		sendMsg["data"] = msg;
 	}
 
-	JsonObjType msgData = isRepackage ? msg["data"].toObject() : msg["data"].toObject()["data"].toObject();
+	auto& forwardMsg = isRepackage ? sendMsg : msg;
+	if (!messageDedup.isFirstSeen(forwardMsg["msgId"].toString())) return;
+
+	JsonObjType msgData = forwardMsg["data"].toObject()["data"].toObject();
 	QString groupId = msgData["dest"].toString();
 	QString localUuid = NetStructureManager::getInstance()->getLocalUuid().c_str();
-	if (userGroupMap[localUuid].contains(groupId))
-		familyParse(isRepackage ? msg : msg["data"].toObject(), nullptr);
-
-	auto role = NetStructureManager::getInstance()->getLocalRole();
-	switch (role)
-	{
-	case ROLE_MASTER:
-		if (isRepackage) {
-			if (!validConn[ConnType::CONN_CHILD].empty())
-				validConn[ConnType::CONN_CHILD].begin()->second->send(sendMsg);
-		}
-		break;
-	case ROLE_ROUTER:
-		{
-			if (!(isRepackage ? sendMsg.contains("routeCount") : msg.contains("routeCount"))) {
-				(isRepackage ? sendMsg["routeCount"] : msg["routeCount"]) = 1;
-				for (auto& parent : validConn[ConnType::CONN_PARENT]) {
-					if (userGroupMap[parent.first.c_str()].contains(groupId))
-						parent.second->send(isRepackage ? sendMsg : msg);
-				}
-			}
-
-			for (auto& child : validConn[ConnType::CONN_CHILD]) {
-				if (userGroupMap[child.first.c_str()].contains(groupId))
-					child.second->send(isRepackage ? sendMsg : msg);
-			}
-
-			int routeCount = isRepackage ? sendMsg["routeCount"].toInt() : msg["routeCount"].toInt();
-			(isRepackage ? sendMsg["routeCount"] : msg["routeCount"]) = routeCount + 1;
-			if (routeCount >= maxRouteCount) return;
+	if (GroupIndex::getInstance()->isMember(groupId, localUuid))
+		familyParse(forwardMsg["data"].toObject(), nullptr);
+
+	//向上总是转发, 向下和兄弟只转发给可能有成员的子树, 不回发给来源
+	std::vector<ConnPtr> links;
+	for (auto& parent : getConns(ConnType::CONN_PARENT))
+		links.push_back(parent.second);
+	for (auto type : { ConnType::CONN_CHILD, ConnType::CONN_BROTHER }) {
+		auto routes = getGroupRoutes(type, groupId);
+		links.insert(links.end(), routes.begin(), routes.end());
+	}
 
-			if (!validConn[ConnType::CONN_BROTHER].empty())
-				validConn[ConnType::CONN_BROTHER].begin()->second->send(isRepackage ? sendMsg : msg);
-		}
-		break;
-	case ROLE_MEMBER:
-		if (isRepackage)
-			if (!validConn[ConnType::CONN_PARENT].empty())
-				validConn[ConnType::CONN_PARENT].begin()->second->send(sendMsg);
-		break;
-	default:
-		break;
+	for (auto& link : links) {
+		if (link->getID() != from) link->send(forwardMsg);
 	}
 }
 
-void ConnectionManager::sendBroadcastMsg(JsonObjType& msg, bool isRepackage)
+void ConnectionManager::sendBroadcastMsg(JsonObjType& msg, bool isRepackage, const StringType& from)
 {
 	qDebug() << "broadcast msg! isSend: " << isRepackage << " package: " << msg;
 
@@ -265,99 +402,70 @@ void ConnectionManager::sendBroadcastMsg(JsonObjType& msg, bool isRepackage)
 	if (isRepackage) {
 		sendMsg["family"] = connManagefamilyStr.c_str();
 		sendMsg["action"] = sendBroadcastActionStr.c_str();
+		sendMsg["msgId"] = newMessageId();
 		sendMsg["data"] = msg;
 	}
 
-	familyParse(isRepackage ? msg : msg["data"].toObject(), nullptr);
-
-	auto role = NetStructureManager::getInstance()->getLocalRole();
-	switch (role)
-	{
-	case ROLE_MASTER:
-		if (isRepackage) {
-			if (!validConn[ConnType::CONN_CHILD].empty())
-				validConn[ConnType::CONN_CHILD].begin()->second->send(sendMsg);
-		}
-		break;
-	case ROLE_ROUTER:
-		{
-			if (!(isRepackage ? sendMsg.contains("routeCount") : msg.contains("routeCount"))) {
-				(isRepackage ? sendMsg["routeCount"] : msg["routeCount"]) = 1;
-				for (auto& parent : validConn[ConnType::CONN_PARENT]) {
-					parent.second->send(isRepackage ? sendMsg : msg);
-				}
-			}
-
-			for (auto& child : validConn[ConnType::CONN_CHILD])
-				child.second->send(isRepackage ? sendMsg : msg);
+	auto& forwardMsg = isRepackage ? sendMsg : msg;
+	if (!messageDedup.isFirstSeen(forwardMsg["msgId"].toString())) return;
 
-			int routeCount = isRepackage ? sendMsg["routeCount"].toInt() : msg["routeCount"].toInt();
-			(isRepackage ? sendMsg["routeCount"] : msg["routeCount"]) = routeCount + 1;
-			if (routeCount >= maxRouteCount) return;
+	familyParse(forwardMsg["data"].toObject(), nullptr);
 
-			if (!validConn[ConnType::CONN_BROTHER].empty())
-				validConn[ConnType::CONN_BROTHER].begin()->second->send(isRepackage ? sendMsg : msg);
+	//沿树和兄弟连接泛洪, 从多条路径到达的副本由消息ID去重
+	for (auto type : { ConnType::CONN_PARENT, ConnType::CONN_CHILD, ConnType::CONN_BROTHER }) {
+		for (auto& link : getConns(type)) {
+			if (link.first != from) link.second->send(forwardMsg);
 		}
-		break;
-	case ROLE_MEMBER:
-		if (isRepackage)
-			if (!validConn[ConnType::CONN_PARENT].empty())
-				validConn[ConnType::CONN_PARENT].begin()->second->send(sendMsg);
-		break;
-	default:
-		break;
 	}
 }
 
-QString ConnectionManager::getRandomServiceDest()
+QString ConnectionManager::newMessageId()
 {
-	getUserGroupMap();
+	//序号从启动时刻的毫秒数开始, 节点重启后不会与之前发出的消息ID重复
+	return QString("%1-%2").arg(NetStructureManager::getInstance()->getLocalUuid().c_str()).arg(++msgSeq);
+}
 
-	QString destNode;
+QString ConnectionManager::getRandomServiceDest()
+{
+	ConnPtr conn;
 	auto role = NetStructureManager::getInstance()->getLocalRole();
 	switch (role)
 	{
 	case ROLE_MASTER:
-		if (!validConn[ConnType::CONN_CHILD].empty())
-			destNode = validConn[ConnType::CONN_CHILD].begin()->first.c_str();
+		conn = firstConn(ConnType::CONN_CHILD);
 		break;
 	case ROLE_ROUTER:
-		destNode = NetStructureManager::getInstance()->getLocalUuid().c_str();
-		break;
+		return NetStructureManager::getInstance()->getLocalUuid().c_str();
 	case ROLE_MEMBER:
-		if (!validConn[ConnType::CONN_PARENT].empty())
-			destNode = validConn[ConnType::CONN_PARENT].begin()->first.c_str();
+		conn = firstConn(ConnType::CONN_PARENT);
 		break;
 	default:
 		break;
 	}
-	return destNode;
+	return conn.get() != nullptr ? QString(conn->getID().c_str()) : QString();
 }
 
 void ConnectionManager::sendRandomMsg(JsonObjType& msg, bool isRepackage)
 {
 	qDebug() << "random msg! isSend: " << isRepackage << " package: " << msg;
 
-	getUserGroupMap();
-
+	ConnPtr conn;
 	auto role = NetStructureManager::getInstance()->getLocalRole();
 	switch (role)
 	{
 	case ROLE_MASTER:
-		if (!validConn[ConnType::CONN_CHILD].empty())
-			validConn[ConnType::CONN_CHILD].begin()->second->send(msg);
+		conn = firstConn(ConnType::CONN_CHILD);
 		break;
 	case ROLE_ROUTER:
-		if (!validConn[ConnType::CONN_BROTHER].empty())
-			validConn[ConnType::CONN_BROTHER].begin()->second->send(msg);
+		conn = firstConn(ConnType::CONN_BROTHER);
 		break;
 	case ROLE_MEMBER:
-		if (!validConn[ConnType::CONN_PARENT].empty())
-			validConn[ConnType::CONN_PARENT].begin()->second->send(msg);
+		conn = firstConn(ConnType::CONN_PARENT);
 		break;
 	default:
 		break;
 	}
+	if (conn.get() != nullptr) conn->send(msg);
 }
 
 void ConnectionManager::handleMsgSingle(JsonObjType & msg, ConnPtr conn)
@@ -367,12 +475,12 @@ void ConnectionManager::handleMsgSingle(JsonObjType & msg, ConnPtr conn)
 
 void ConnectionManager::handleMsgBroadcast(JsonObjType & msg, ConnPtr conn)
 {
-	sendBroadcastMsg(msg, false);
+	sendBroadcastMsg(msg, false, conn.get() != nullptr ? conn->getID() : INVALID_ID);
 }
 
 void ConnectionManager::handleMsgGroup(JsonObjType & msg, ConnPtr conn)
 {
-	sendGroupMsg(msg, false);
+	sendGroupMsg(msg, false, conn.get() != nullptr ? conn->getID() : INVALID_ID);
 }
 
 void ConnectionManager::sendActionMsg(TransferMode mode, const StringType & family, const StringType & action, JsonObjType& datas)
@@ -391,54 +499,33 @@ void ConnectionManager::sendActionMsg(TransferMode mode, const StringType & fami
 	}
 }
 
-void ConnectionManager::uploadPicMsgToCommonSpace(const QString & groupId, QVariantHash & data, bool isRoute)
+void ConnectionManager::uploadPicMsgToCommonSpace(const QString & groupId, QVariantHash & data, bool isRoute, RelayFeedPtr relayFeed)
 {
-	getUserGroupMap();
-
-	QStringList destNodes;
-	auto role = NetStructureManager::getInstance()->getLocalRole();
-	switch (role)
-	{
-	case ROLE_MASTER:
-		if (!isRoute && !validConn[ConnType::CONN_CHILD].empty())
-			destNodes.append(validConn[ConnType::CONN_CHILD].begin()->first.c_str());
-		break;
-	case ROLE_ROUTER: 
-		{
-			if (!data.contains("routeCount")) {
-				data["routeCount"] = 1;
-				for (auto& parent : validConn[ConnType::CONN_PARENT]) {
-					if (userGroupMap[parent.first.c_str()].contains(groupId))
-						destNodes.append(parent.first.c_str());
-				}
-			}
+	QString localUuid = NetStructureManager::getInstance()->getLocalUuid().c_str();
+	//msgId是聊天消息ID, 接收方按它入库; 转发去重用单独的ID
+	if (!isRoute) data["relayMsgId"] = newMessageId();
+	if (!messageDedup.isFirstSeen(data["relayMsgId"].toString())) return;
 
-			for (auto& child : validConn[ConnType::CONN_CHILD]) {
-				if (userGroupMap[child.first.c_str()].contains(groupId))
-					destNodes.append(child.first.c_str());
-			}
+	//图片只沿树转发: 向上总是转发, 向下只转发给可能有成员的子树. 兄弟连接会让同一张图片重复传输, 不走兄弟
+	StringType from = isRoute ? data["via"].toString().toStdString() : INVALID_ID;
+	data["via"] = localUuid;
 
-			int routeCount = data["routeCount"].toInt();
-			data["routeCount"] = routeCount + 1;
-			if (routeCount < maxRouteCount && !validConn[ConnType::CONN_BROTHER].empty()) {
-				destNodes.append(validConn[ConnType::CONN_BROTHER].begin()->first.c_str());
-			}
-		}
-		break;
-	case ROLE_MEMBER:
-		if (!isRoute && !validConn[ConnType::CONN_PARENT].empty())
-			destNodes.append(validConn[ConnType::CONN_PARENT].begin()->first.c_str());
-		break;
-	default:
-		break;
+	QStringList destNodes;
+	for (auto& parent : getConns(ConnType::CONN_PARENT)) {
+		if (parent.first != from) destNodes.append(parent.first.c_str());
+	}
+	for (auto& child : getGroupRoutes(ConnType::CONN_CHILD, groupId)) {
+		if (child->getID() != from) destNodes.append(child->getID().c_str());
 	}
 
 	for (auto& node : destNodes) {
 		auto addr = JsonObjType::fromVariantHash(DBOP::getInstance()->getUser(node));
 		auto servicePtr = std::make_shared<PicTransferService>(data["picRealName"].toString(), JsonDocType::fromVariant(QVariant(data)).object());
-		ConnectionManager::getInstance()->connnectHost(ConnType::CONN_TEMP, INVALID_ID, addr, servicePtr, [](const boost::system::error_code& err) {
+		if (relayFeed.get() != nullptr) servicePtr->setRelay(relayFeed);
+		ConnectionManager::getInstance()->connnectHost(ConnType::CONN_TEMP, INVALID_ID, addr, servicePtr, [servicePtr](const boost::system::error_code& err) {
 			if (err != 0) {
 				qDebug() << "send picture group msg connnection connect failed!";
+				servicePtr->stop();
 				return;
 			}
 
@@ -447,58 +534,62 @@ void ConnectionManager::uploadPicMsgToCommonSpace(const QString & groupId, QVari
 	}
 }
 
-void ConnectionManager::uploadFileToGroupSpace(JsonObjType& sharedFileInfo, bool isRoute)
+void ConnectionManager::uploadFileToGroupSpace(JsonObjType& sharedFileInfo, bool isRoute, RelayFeedPtr relayFeed)
 {
-	getUserGroupMap();
+	QStringList destNodes;
+	if (!isRoute) {
+		auto destNode = getRandomServiceDest();
+		if (!destNode.isEmpty()) destNodes.append(destNode);
+	}
+	else {
+		//组空间文件在路由树上逐级复制: 上级和各下级路由节点, 不回发给转发来源, 兄弟之间经上级到达
+		if (!messageDedup.isFirstSeen(sharedFileInfo["msgId"].toString())) return;
 
-	QString destNode;
-	auto role = NetStructureManager::getInstance()->getLocalRole();
-	switch (role)
-	{
-	case ROLE_MASTER:
-		if (!isRoute && !validConn[ConnType::CONN_CHILD].empty())
-			destNode = validConn[ConnType::CONN_CHILD].begin()->first.c_str();
-		break;
-	case ROLE_ROUTER:
-	{
-		if (!isRoute) {
-			destNode = NetStructureManager::getInstance()->getLocalUuid().c_str();
-		}
-		else {
-			if (!sharedFileInfo.contains("routeCount")) {
-				sharedFileInfo["routeCount"] = 1;
-			}
+		auto role = NetStructureManager::getInstance()->getLocalRole();
+		if (role != ROLE_MASTER && role != ROLE_ROUTER) return;
 
-			int routeCount = sharedFileInfo["routeCount"].toInt();
-			sharedFileInfo["routeCount"] = routeCount + 1;
-			if (routeCount < maxRouteCount && !validConn[ConnType::CONN_BROTHER].empty()) {
-				destNode = validConn[ConnType::CONN_BROTHER].begin()->first.c_str();
-			}
+		StringType from = sharedFileInfo["via"].toString().toStdString();
+		for (auto& parent : getConns(ConnType::CONN_PARENT)) {
+			if (parent.first != from) destNodes.append(parent.first.c_str());
 		}
-	}
-	break;
-	case ROLE_MEMBER:
-		if (!isRoute && !validConn[ConnType::CONN_PARENT].empty())
-			destNode = validConn[ConnType::CONN_PARENT].begin()->first.c_str();
-		break;
-	default:
-		break;
+		for (auto& child : getConns(ConnType::CONN_CHILD)) {
+			if (child.first != from && routingTable.getOwner(child.first) == child.first)
+				destNodes.append(child.first.c_str());
+		}
+		sharedFileInfo["via"] = NetStructureManager::getInstance()->getLocalUuid().c_str();
 	}
 
-	if (destNode.isEmpty()) return;
+	for (auto& node : destNodes) {
+		if (!isRoute) {
+			uploadFileToNode(node, sharedFileInfo);
+			continue;
+		}
 
-	ServicePtr servicePtr;
-	if (isRoute) {
-		servicePtr = std::make_shared<GroupFileUploadService>(sharedFileInfo, true);
-	}
-	else {
-		servicePtr = std::make_shared<GroupFileUploadService>(sharedFileInfo["fileName"].toString(), sharedFileInfo["fileGroup"].toString());
+		ServicePtr servicePtr = std::make_shared<GroupFileUploadService>(sharedFileInfo, true);
+		if (relayFeed.get() != nullptr) servicePtr->setRelay(relayFeed);
+
+		auto addr = JsonObjType::fromVariantHash(DBOP::getInstance()->getUser(node));
+		ConnectionManager::getInstance()->connnectHost(ConnType::CONN_TEMP, INVALID_ID, addr, servicePtr, [servicePtr](const boost::system::error_code& err) {
+			if (err != 0) {
+				qDebug() << "upload group file connnection connect failed!";
+				servicePtr->stop();
+				return;
+			}
+
+			qDebug() << "upload group file connnection connect success!";
+		});
 	}
+}
 
-	auto addr = JsonObjType::fromVariantHash(DBOP::getInstance()->getUser(destNode));
-	ConnectionManager::getInstance()->connnectHost(ConnType::CONN_TEMP, INVALID_ID, addr, servicePtr, [](const boost::system::error_code& err) {
+void ConnectionManager::uploadFileToNode(const QString & node, JsonObjType & sharedFileInfo)
+{
+	//上传方直接发给指定节点, 接收方是路由节点时会继续在路由树上复制
+	ServicePtr servicePtr = std::make_shared<GroupFileUploadService>(sharedFileInfo["fileName"].toString(), sharedFileInfo["fileGroup"].toString());
+	auto addr = JsonObjType::fromVariantHash(DBOP::getInstance()->getUser(node));
+	connnectHost(ConnType::CONN_TEMP, INVALID_ID, addr, servicePtr, [servicePtr](const boost::system::error_code& err) {
 		if (err != 0) {
 			qDebug() << "upload group file connnection connect failed!";
+			servicePtr->stop();
 			return;
 		}
 
@@ -506,7 +597,6 @@ void ConnectionManager::uploadFileToGroupSpace(JsonObjType& sharedFileInfo, bool
 	});
 }
 
-
 Connection::Connection(tcp::socket s, const HostDescription& dest, ConnectionManager* cm, ServicePtr servicePtr)
 	:sock(std::move(s)), dest(dest), parent(cm), id(INVALID_ID), servicePtr(servicePtr)
 {	
@@ -554,7 +644,20 @@ void Connection::dataHandle()
 
 void Connection::send(JsonObjType rawData)
 {
-	servicePtr->sendData(rawData);
+	//结构维护等线程也会发送, 写操作统一放到连接所在的IO线程执行
+	auto self = shared_from_this();
+	auto simulator = NetSimulator::getInstance();
+	if (!simulator->isEnabled()) {
+		boost::asio::dispatch(sock.get_executor(), [self, rawData]() mutable {
+			self->servicePtr->sendData(rawData);
+		});
+		return;
+	}
+
+	simulator->countSend(rawData["action"].toString());
+	simulator->transmit(sock.get_executor(), [self, rawData]() mutable {
+		self->servicePtr->sendData(rawData);
+	});
 }
 
 void Connection::execute()
@@ -579,7 +682,7 @@ void Connection::stop()
     parent->unregisterObj(id);
 }
 
-int Connection::getProgress()
+QVariantHash Connection::getTransferInfo()
 {
-	return servicePtr->getProgress();
+	return servicePtr->getTransferInfo();
 }
@@ -4,7 +4,16 @@
 #include "Common.h"
 #include "MsgParser.h"
 #include "Services.h"
+#include "RoutingTable.h"
+#include "GroupIndex.h"
+#include "GroupSummary.h"
+#include "MessageDedup.h"
+
+#include "QtCore\qmutex.h"
+
+#include <atomic>
 #include <unordered_map>
+#include <vector>
 
 class ConnectionManager;
 class Connection : public std::enable_shared_from_this<Connection>, public boost::noncopyable {
@@ -20,7 +29,7 @@ public:
 	void restore();
 	void pause();
 	void stop();
-	int getProgress();
+	QVariantHash getTransferInfo();
 
 	void setID(const StringType& newId) { this->id = newId; }
 	StringType getID()const { return id; }
@@ -52,34 +61,60 @@ public:
 	void unregisterObj(const StringType& id);
 	
 	QString getRandomServiceDest();
-	const QHash<QString, QStringList>& getUserGroupMap();
 	ConnPtr findConn(const StringType& id);
+	ConnImplType getConnType(const StringType& id);
+	bool hasParent();
+	std::vector<StringType> getConnIds(ConnImplType type);
+	RoutingTable& getRoutingTable() { return routingTable; }
+	StringType getNextHop(const StringType& dest);
 
 	ConnPtr connnectHost(ConnImplType type, const StringType& id, JsonObjType& addr, ServicePtr servicePtr, ConnectHandler&& handler);
 	void sendtoConn(const StringType &id, JsonObjType msg);
+	void sendtoParent(JsonObjType msg);
+	void sendtoChildRouters(JsonObjType msg);
+	void refreshGroupSummary();
 	void sendActionMsg(TransferMode mode, const StringType& family, const StringType& action, JsonObjType& datas);
+	QString newMessageId();
 
-	void uploadPicMsgToCommonSpace(const QString& groupId, QVariantHash& data, bool isRoute);
-	void uploadFileToGroupSpace(JsonObjType& sharedFileInfo, bool isRoute);
+	void uploadPicMsgToCommonSpace(const QString& groupId, QVariantHash& data, bool isRoute, RelayFeedPtr relayFeed = RelayFeedPtr());
+	void uploadFileToGroupSpace(JsonObjType& sharedFileInfo, bool isRoute, RelayFeedPtr relayFeed = RelayFeedPtr());
+	void uploadFileToNode(const QString& node, JsonObjType& sharedFileInfo);
 
 private:
 	ConnectionManager();
 
 	enum TransferState{TSRouting, TSAvailable};
 
-	QHash<QString, QStringList> getUsersJoinGroups();
+	ConnMap getConns(ConnImplType type);
+	ConnPtr firstConn(ConnImplType type);
+	std::vector<ConnPtr> getGroupLinks(ConnImplType type, const QString& groupId);
+	std::vector<ConnPtr> getGroupRoutes(ConnImplType type, const QString& groupId);
 
 	void sendSingleMsg(JsonObjType& msg, bool isRepackage=true);
-	void sendGroupMsg(JsonObjType& msg, bool isRepackage = true);
-	void sendBroadcastMsg(JsonObjType& msg, bool isRepackage = true);
+	void sendGroupMsg(JsonObjType& msg, bool isRepackage = true, const StringType& from = INVALID_ID);
+	void sendBroadcastMsg(JsonObjType& msg, bool isRepackage = true, const StringType& from = INVALID_ID);
 	void sendRandomMsg(JsonObjType& msg, bool isRepackage = true);
 
 	void handleMsgSingle(JsonObjType& msg, ConnPtr conn);
 	void handleMsgGroup(JsonObjType& msg, ConnPtr conn);
 	void handleMsgBroadcast(JsonObjType& msg, ConnPtr conn);
+	void handleGroupSummary(JsonObjType& msg, ConnPtr conn);
 	
+	//连接在IO线程注册注销, 结构维护线程也会查询和发送; 加锁时只复制连接, 发送放到锁外, 不与summaryMutex嵌套
+	QMutex connMutex;
 	std::unordered_map<ConnImplType, ConnMap> validConn;
-	QHash<QString, QStringList> userGroupMap;
+	std::unordered_map<ConnImplType, QBitArray> linkBits;
+
+	//本节点子树的组摘要与各下级路由节点, 兄弟节点上报的摘要
+	QMutex summaryMutex;
+	std::atomic<bool> isSummaryDirty;
+	GroupSummary localSummary;
+	std::unordered_map<StringType, GroupSummary> groupSummaries;
+
+	//组消息与广播的消息ID序号, 以及转发时的重复检查
+	std::atomic<qint64> msgSeq;
+	MessageDedup messageDedup;
+	RoutingTable routingTable;
 };
 
 #endif
@@ -0,0 +1,94 @@
+﻿#include "DBConnection.h"
+
+#include "QtSql\qsqlerror.h"
+#include "QtCore\qhash.h"
+#include "QtCore\qthread.h"
+
+//WAL下读写互不阻塞, synchronous=NORMAL只在检查点时刷盘, 掉电最多丢失最后几个事务
+const QStringList tunePragmas = {
+	"pragma journal_mode=WAL",
+	"pragma synchronous=NORMAL",
+	"pragma cache_size=-16000",
+	"pragma mmap_size=268435456",
+	"pragma temp_store=MEMORY"
+};
+
+const QString readerConnPrefix("dbReader_");
+
+//QSqlQuery不能跨线程共享, 每个线程持有自己的缓存和读连接
+struct ThreadDBState {
+	QHash<QString, QSqlQuery> cache;
+	QString readerConnName;
+
+	~ThreadDBState() {
+		//语句必须先于连接释放
+		cache.clear();
+		if (readerConnName.isEmpty()) return;
+		QSqlDatabase::database(readerConnName, false).close();
+		QSqlDatabase::removeDatabase(readerConnName);
+	}
+};
+
+static ThreadDBState& threadState()
+{
+	thread_local ThreadDBState state;
+	return state;
+}
+
+int DBConnection::tune(QSqlDatabase & db)
+{
+	QSqlQuery query(db);
+	for (auto& pragma : tunePragmas) {
+		if (!query.exec(pragma)) {
+			qDebug() << "database tune failed! pragma: " << pragma << " reason: " << query.lastError().text();
+			return -1;
+		}
+	}
+	return 0;
+}
+
+QSqlDatabase DBConnection::threadDatabase(const QString & dbName)
+{
+	auto& state = threadState();
+	if (!state.readerConnName.isEmpty())
+		return QSqlDatabase::database(state.readerConnName, false);
+
+	//首次使用时为当前线程创建独立的命名连接, 线程退出时移除
+	state.readerConnName = readerConnPrefix + QString::number((quintptr)QThread::currentThreadId());
+	QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", state.readerConnName);
+	db.setDatabaseName(dbName);
+	if (!db.open()) {
+		qDebug() << "thread database open failed! connName: " << state.readerConnName << " reason: " << db.lastError().text();
+		return db;
+	}
+	tune(db);
+	return db;
+}
+
+QSqlQuery & DBConnection::prepared(QSqlDatabase & db, const QString & sql)
+{
+	auto& cache = threadState().cache;
+	QString key = db.connectionName() + '\n' + sql;
+	auto it = cache.find(key);
+	if (it != cache.end()) {
+		//复用前释放上一次的结果集, 语句本身保持prepare状态
+		it->finish();
+		return *it;
+	}
+
+	QSqlQuery query(db);
+	query.setForwardOnly(true);
+	if (!query.prepare(sql)) {
+		qDebug() << "statement prepare failed! sql: " << sql << " reason: " << query.lastError().text();
+	}
+	return *cache.insert(key, query);
+}
+
+void DBConnection::releaseCache(const QString & connName)
+{
+	auto& cache = threadState().cache;
+	for (auto it = cache.begin(); it != cache.end();) {
+		if (it.key().startsWith(connName + '\n')) it = cache.erase(it);
+		else ++it;
+	}
+}
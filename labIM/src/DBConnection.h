@@ -0,0 +1,20 @@
+﻿#ifndef DBCONNECTION_H
+#define DBCONNECTION_H
+
+#include "Common.h"
+
+#include "QtSql\qsqldatabase.h"
+#include "QtSql\qsqlquery.h"
+
+//连接调优与预编译语句缓存: 每个线程按连接名和SQL缓存已prepare的语句, 热点路径不再重复解析SQL
+//Qt的连接只能在创建它的线程中使用, 传给prepared的连接必须属于调用线程
+class DBConnection
+{
+public:
+	static int tune(QSqlDatabase& db);
+	static QSqlDatabase threadDatabase(const QString& dbName);
+	static QSqlQuery& prepared(QSqlDatabase& db, const QString& sql);
+	static void releaseCache(const QString& connName);
+};
+
+#endif // !DBCONNECTION_H
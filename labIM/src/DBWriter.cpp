@@ -0,0 +1,112 @@
+﻿#include "DBWriter.h"
+#include "DBConnection.h"
+
+#include "QtSql\qsqlerror.h"
+
+const QString writerConnName("dbWriter");
+const int maxBatchRows = 256;
+const int commitWindowMs = 5;
+
+DBWriter::DBWriter(const QString & dbName)
+	: dbName(dbName), isRunning(false)
+{
+}
+
+DBWriter::~DBWriter()
+{
+	stop();
+}
+
+void DBWriter::start()
+{
+	if (isRunning.exchange(true)) return;
+	writeThread = std::thread([this]() { writeLoop(); });
+}
+
+void DBWriter::stop()
+{
+	{
+		//与submit互斥, 停止之后不会再有写入进入队列而无人处理
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		if (!isRunning.exchange(false)) return;
+	}
+	wakeCond.notify_one();
+	if (writeThread.joinable()) writeThread.join();
+}
+
+bool DBWriter::submit(WriteHandler && write, DBWriteHandler && done)
+{
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		if (!isRunning) {
+			qDebug() << "db writer submit failed! writer stopped";
+			return false;
+		}
+		jobs.push_back(WriteJob{ std::move(write), std::move(done) });
+	}
+	wakeCond.notify_one();
+	return true;
+}
+
+void DBWriter::writeLoop()
+{
+	{
+		//连接只能在创建它的线程中使用
+		QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", writerConnName);
+		db.setDatabaseName(dbName);
+		if (!db.open()) {
+			qDebug() << "db writer open database failed: " << db.lastError().text();
+		}
+		DBConnection::tune(db);
+
+		std::vector<WriteJob> batch;
+		batch.reserve(maxBatchRows);
+		while (true) {
+			{
+				//停止后把队列中剩下的写入提交完再退出
+				std::unique_lock<std::mutex> lock(wakeMutex);
+				wakeCond.wait(lock, [this]() { return !jobs.empty() || !isRunning; });
+				if (jobs.empty()) break;
+
+				//第一条写入到达后再等一个提交窗口, 把突发的写入合并到同一个事务
+				auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(commitWindowMs);
+				wakeCond.wait_until(lock, deadline, [this]() { return (int)jobs.size() >= maxBatchRows || !isRunning; });
+				while (!jobs.empty() && (int)batch.size() < maxBatchRows) {
+					batch.push_back(std::move(jobs.front()));
+					jobs.pop_front();
+				}
+			}
+
+			commitBatch(db, batch);
+		}
+		DBConnection::releaseCache(writerConnName);
+		db.close();
+	}
+	QSqlDatabase::removeDatabase(writerConnName);
+}
+
+int DBWriter::commitBatch(QSqlDatabase & db, std::vector<WriteJob>& batch)
+{
+	bool isTrans = db.transaction();
+	if (!isTrans) qDebug() << "db writer begin transaction failed! reason: " << db.lastError().text();
+
+	std::vector<int> results;
+	results.reserve(batch.size());
+	for (auto& job : batch) {
+		results.push_back(job.write(db));
+	}
+
+	int result = 0;
+	if (isTrans && !db.commit()) {
+		qDebug() << "db writer commit failed! rows: " << batch.size() << " reason: " << db.lastError().text();
+		db.rollback();
+		result = -1;
+	}
+
+	//提交之后再通知调用方, 回调里看到的数据一定已经落盘
+	for (size_t i = 0; i < batch.size(); ++i) {
+		if (batch[i].done) batch[i].done(result == 0 ? results[i] : -1);
+	}
+	batch.clear();
+	return result;
+}
@@ -0,0 +1,47 @@
+﻿#ifndef DBWRITER_H
+#define DBWRITER_H
+
+#include "Common.h"
+
+#include "QtSql\qsqldatabase.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+typedef std::function<void(int)> DBWriteHandler;
+
+//数据库写线程: 写操作通过队列交给独立的连接, 每隔几毫秒或攒够一批后在同一个事务中提交,
+//调用方不再阻塞在磁盘上, 提交结果通过完成回调返回
+class DBWriter : public boost::noncopyable
+{
+public:
+	typedef std::function<int(QSqlDatabase&)> WriteHandler;
+
+	DBWriter(const QString& dbName);
+	~DBWriter();
+
+	void start();
+	void stop();
+	bool submit(WriteHandler&& write, DBWriteHandler&& done = DBWriteHandler());
+
+private:
+	struct WriteJob {
+		WriteHandler write;
+		DBWriteHandler done;
+	};
+
+	void writeLoop();
+	int commitBatch(QSqlDatabase& db, std::vector<WriteJob>& batch);
+
+	QString dbName;
+	std::deque<WriteJob> jobs;
+	std::atomic<bool> isRunning;
+	std::mutex wakeMutex;
+	std::condition_variable wakeCond;
+	std::thread writeThread;
+};
+
+#endif // !DBWRITER_H
@@ -8,15 +8,37 @@
 #include "QtCore\qcryptographichash.h"
 
 #include "NetStructureManager.h"
+#include "DBConnection.h"
+
+const QString dbFileName("system.db");
+
+//schema迁移: 第i个迁移执行后user_version为i+1, 已发布的迁移只能追加不能修改
+//mdate等字符串日期只用于显示和传输, 排序和过滤使用毫秒时间戳, 旧数据按本地时间换算
+const std::vector<QStringList> schemaMigrations = {
+	{
+		"alter table Message add column mts INTEGER NOT NULL DEFAULT 0",
+		"alter table Task add column tts INTEGER NOT NULL DEFAULT 0",
+		"alter table Request add column rts INTEGER NOT NULL DEFAULT 0",
+		"update Message set mts=coalesce(cast(strftime('%s', replace(substr(mdate,1,10),'.','-')||substr(mdate,11), 'utc') as integer)*1000, 0)",
+		"update Task set tts=coalesce(cast(strftime('%s', replace(substr(tdate,1,10),'.','-')||substr(tdate,11), 'utc') as integer)*1000, 0)",
+		"update Request set rts=coalesce(cast(strftime('%s', replace(substr(rdate,1,10),'.','-')||substr(rdate,11), 'utc') as integer)*1000, 0)",
+		"create index if not exists MessageDestIdx on Message(mduuid,mmode,mts)",
+		"create index if not exists MessageSourceIdx on Message(msource,mts)",
+		"create index if not exists TaskStateIdx on Task(tstate,tts)",
+		"create index if not exists RequestStateIdx on Request(rstate,rts)"
+	}
+};
 
 DBOP::DBOP(QObject* parent) 
-	:QObject(parent)
+	:QObject(parent), writer(dbFileName)
 {
 	createTables();
+	writer.start();
 }
 
 DBOP::~DBOP()
 {
+	writer.stop();
 }
 
 DBOP * DBOP::getInstance()
@@ -28,19 +50,24 @@ DBOP * DBOP::getInstance()
 //DDL
 int DBOP::createDBConn()
 {
-	QString dbName("system.db");
-
 	QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE");
-	db.setDatabaseName(dbName);
+	db.setDatabaseName(dbFileName);
 	if (!db.open()) {
 		qDebug() << "open database failed: " << db.lastError().text();
 		return -1;
 	}
 
+	DBConnection::tune(db);
 	qDebug() << "open database success";
 	return 0;
 }
 
+void DBOP::flushWrites()
+{
+	//退出前等待写线程把队列中剩余的写入提交完
+	writer.stop();
+}
+
 int DBOP::createTables()
 {
 	if (createDBConn() != 0) return -2;
@@ -127,7 +154,41 @@ int DBOP::createTables()
 
 	qDebug() << "create tables sql execute";
 
-	return bUser && bGroup && bAdmin && bMember && bSession && bMessage && bReuqest && bTask && bHomework && bSharedFile ? 0 : -1;
+	bool bMigrate = migrateSchema() == 0;
+	return bUser && bGroup && bAdmin && bMember && bSession && bMessage && bReuqest && bTask && bHomework && bSharedFile && bMigrate ? 0 : -1;
+}
+
+int DBOP::migrateSchema()
+{
+	QSqlDatabase db = QSqlDatabase::database();
+	QSqlQuery query(db);
+	if (!query.exec("pragma user_version") || !query.next()) {
+		qDebug() << "schema version read failed! reason: " << query.lastError().text();
+		return -1;
+	}
+	int version = query.value(0).toInt();
+	query.finish();
+
+	for (int i = version; i < (int)schemaMigrations.size(); ++i) {
+		//每个迁移连同版本号在一个事务中完成, 失败则整体回滚, 下次启动重试
+		db.transaction();
+		bool isOk = true;
+		for (auto& sql : schemaMigrations[i]) {
+			if (!query.exec(sql)) {
+				qDebug() << "schema migrate failed! version: " << i + 1 << " sql: " << sql << " reason: " << query.lastError().text();
+				isOk = false;
+				break;
+			}
+		}
+		if (isOk && !query.exec(QString("pragma user_version=%1").arg(i + 1))) isOk = false;
+
+		if (!isOk || !db.commit()) {
+			db.rollback();
+			return -1;
+		}
+		qDebug() << "schema migrate success! version: " << i + 1;
+	}
+	return 0;
 }
 
 //User operation
@@ -207,10 +268,10 @@ QVariantHash DBOP::getUser(const ModelStringType & userId)
 {
 	static const QString USER_GET("select * from User where uid=?");
 
-	QSqlQuery query;
+	QSqlDatabase db = DBConnection::threadDatabase(dbFileName);
+	QSqlQuery& query = DBConnection::prepared(db, USER_GET);
 	QVariantHash result;
 
-	query.prepare(USER_GET);
 	query.addBindValue(userId);
 	if (!query.exec() || !query.next()) {
 		qDebug() << "user select failed! uid" << userId << " reason: " << query.lastError().text();
@@ -223,6 +284,7 @@ QVariantHash DBOP::getUser(const ModelStringType & userId)
 	result["umac"] = query.value("umac");
 	result["urole"] = query.value("urole");
 	result["upic"] = query.value("upic");
+	query.finish();
 
 	qDebug() << "user select success! uid: " << userId;
 	return result;
@@ -317,6 +379,7 @@ int DBOP::deleteUserGroup(const ModelStringType & groupId, QString& sql)
 	if (query.exec()) {
 		sql = GROUP_REMOVE;
 		qDebug() << "group delete success! ugid: " << groupId;
+		userGroupDeleted(groupId);
 		return 0;
 	}
 	
@@ -418,6 +481,7 @@ int DBOP::addMember(const GroupMemberInfo& member, QString& sql)
 	if (query.exec()) {
 		sql = ADD_GROUP_MEMBER;
 		qDebug() << "group memeber insert success! ugid: " << member.ugid << " uid: " << member.uid << " role: " << member.mrole;
+		groupMembersAdded(member.ugid, QStringList(member.uid));
 		return 0;
 	}
 
@@ -446,6 +510,9 @@ int DBOP::addMembers(std::shared_ptr<std::vector<UserInfo>> userList, const User
 
 	if (query.execBatch()) {
 		qDebug() << "members insert success! count: " << userList->size();
+		QStringList uidList;
+		for (auto& uid : uids) uidList.append(uid.toString());
+		groupMembersAdded(group.ugid, uidList);
 		return 0;
 	}
 
@@ -465,6 +532,7 @@ int DBOP::removeMember(const ModelStringType & groupId, const ModelStringType &
 	if (query.exec()) {
 		sql = REMOVE_GROUP_MEMBER;
 		qDebug() << "group member delete success! ugid: " << groupId << " uid: " << userId;
+		groupMemberRemoved(groupId, userId);
 		return 0;
 	}
 
@@ -546,6 +614,31 @@ QStringList DBOP::listJoinGroup(const ModelStringType & userId)
 	return result;
 }
 
+QVariantList DBOP::listGroupMemberships()
+{
+	static const QString GET_ALL_MEMBERSHIP("select ugid, uid from GroupMember");
+
+	QSqlQuery query;
+	QVariantList result;
+
+	query.prepare(GET_ALL_MEMBERSHIP);
+	if (!query.exec()) {
+		qDebug() << "group membership select all failed! reason: " << query.lastError().text();
+		return result;
+	}
+
+	while (query.next())
+	{
+		QVariantList item;
+		item.append(query.value("ugid"));
+		item.append(query.value("uid"));
+		result.append(QVariant(item));
+	}
+
+	qDebug() << "group membership select all success! count: " << result.size();
+	return result;
+}
+
 //Admin operation
 int DBOP::createAdmin(const AdminInfo & admin, QString& sql)
 {
@@ -676,13 +769,8 @@ int DBOP::deleteSession(const ModelStringType& duuid)
 	return -1;
 }
 
-int DBOP::updateSessionLastmsg(const MessageInfo& message, bool isSend)
+static SessionInfo lastmsgSession(const MessageInfo& message, bool isSend)
 {
-	//SessionInfo(message.mmode, message.mduuid, message.msource, );
-	static const QString UPDATE_SESSION_LASTMSG("replace into Session(duuid,stype,suid,lastmsg) values(?,?,?,?)");
-	
-	QSqlQuery query;
-	query.prepare(UPDATE_SESSION_LASTMSG);
 	ModelStringType lastmsg;
 	switch (message.mtype)
 	{
@@ -698,13 +786,19 @@ int DBOP::updateSessionLastmsg(const MessageInfo& message, bool isSend)
 		session.suid = NetStructureManager::getInstance()->getLocalUuid().c_str();
 		session.duuid = message.mduuid;
 	}
+	return session;
+}
 
+static int writeSessionLastmsg(QSqlDatabase& db, const SessionInfo& session, const MessageInfo& message)
+{
+	static const QString UPDATE_SESSION_LASTMSG("replace into Session(duuid,stype,suid,lastmsg) values(?,?,?,?)");
+
+	QSqlQuery& query = DBConnection::prepared(db, UPDATE_SESSION_LASTMSG);
 	query.addBindValue(session.duuid);
 	query.addBindValue(session.stype);
 	query.addBindValue(session.suid);
 	query.addBindValue(session.lastmsg);
 	if (query.exec()) {
-		notifySeesionUpdateLastmsg(session);
 		qDebug() << "message insert update to session success! source: " << message.msource << " dest: " << message.mduuid << " data: " << message.mdata;
 		return 0;
 	}
@@ -713,6 +807,18 @@ int DBOP::updateSessionLastmsg(const MessageInfo& message, bool isSend)
 	return -1;
 }
 
+int DBOP::updateSessionLastmsg(const MessageInfo& message, bool isSend, DBWriteHandler&& handler)
+{
+	SessionInfo session = lastmsgSession(message, isSend);
+	bool isQueued = writer.submit([session, message](QSqlDatabase& db) {
+		return writeSessionLastmsg(db, session, message);
+	}, [this, session, handler](int result) {
+		if (result == 0) notifySeesionUpdateLastmsg(session);
+		if (handler) handler(result);
+	});
+	return isQueued ? 0 : -1;
+}
+
 QVariantHash DBOP::getSession(int stype, const ModelStringType & uuid)
 {
 	static const QString SESSION_GET_BY_DUUID("select * from Session where stype=? and duuid=?");
@@ -786,31 +892,63 @@ QVariantList DBOP::listSessions()
 }
 
 //Message operation
-int DBOP::createMessage(const MessageInfo & message,bool isSend)
+int DBOP::createMessage(const MessageInfo & message, bool isSend, DBWriteHandler&& handler)
 {
-	static const QString ADD_MESSAGE("insert into Message(mid,msource,mduuid,mtype,mdata,mdate,mmode) values(?,?,?,?,?,?,?)");
+	static const QString ADD_MESSAGE("insert into Message(mid,msource,mduuid,mtype,mdata,mdate,mmode,mts) values(?,?,?,?,?,?,?,?)");
+
+	//消息和会话的最后一条消息在同一批次中写入, 提交后再通知界面
+	SessionInfo session = lastmsgSession(message, isSend);
+	bool isQueued = writer.submit([message, isSend, session](QSqlDatabase& db) {
+		QSqlQuery& query = DBConnection::prepared(db, ADD_MESSAGE);
+		query.addBindValue(message.mid);
+		query.addBindValue(message.msource);
+		query.addBindValue(message.mduuid);
+		query.addBindValue(message.mtype);
+		query.addBindValue(message.mdata);
+		query.addBindValue(message.mdate);
+		query.addBindValue(message.mmode);
+		query.addBindValue(message.mts);
+
+		if (!query.exec()) {
+			qDebug() << "message insert failed! source: " << message.msource << " dest: " << message.mduuid << " data: " << message.mdata << " reason: " << query.lastError().text();
+			return -1;
+		}
 
-	QSqlQuery query;
-	query.prepare(ADD_MESSAGE);
-	query.addBindValue(message.mid);
-	query.addBindValue(message.msource);
-	query.addBindValue(message.mduuid);
-	query.addBindValue(message.mtype);
-	query.addBindValue(message.mdata);
-	query.addBindValue(message.mdate);
-	query.addBindValue(message.mmode);
-
-	if (query.exec()) {
-		notifyModelAppendMsg(message, isSend);
 		qDebug() << "message insert success! source: " << message.msource << " dest: " << message.mduuid << " data: " << message.mdata;
-		if (isSend) return 0;
-
-		updateSessionLastmsg(message, isSend);
+		if (!isSend) writeSessionLastmsg(db, session, message);
 		return 0;
-	}
+	}, [this, message, isSend, session, handler](int result) {
+		if (result == 0) {
+			notifyModelAppendMsg(message, isSend);
+			if (!isSend) notifySeesionUpdateLastmsg(session);
+		}
+		if (handler) handler(result);
+	});
+	return isQueued ? 0 : -1;
+}
 
-	qDebug() << "message insert failed! source: " << message.msource << " dest: " << message.mduuid << " data: " << message.mdata << " reason: " << query.lastError().text();
-	return -1;
+int DBOP::updateMessageData(const ModelStringType & messageId, const ModelStringType & data, DBWriteHandler&& handler)
+{
+	static const QString UPDATE_MESSAGE_DATA("update Message set mdata=? where mid=?");
+
+	//与createMessage走同一个队列, 保证缩略图消息先插入再更新
+	bool isQueued = writer.submit([messageId, data](QSqlDatabase& db) {
+		QSqlQuery& query = DBConnection::prepared(db, UPDATE_MESSAGE_DATA);
+		query.addBindValue(data);
+		query.addBindValue(messageId);
+
+		if (query.exec()) {
+			qDebug() << "message data update success! mid: " << messageId << " data: " << data;
+			return 0;
+		}
+
+		qDebug() << "message data update failed! mid: " << messageId << " data: " << data << " reason: " << query.lastError().text();
+		return -1;
+	}, [this, messageId, data, handler](int result) {
+		if (result == 0) sessionMsgDataUpdate(messageId, data);
+		if (handler) handler(result);
+	});
+	return isQueued ? 0 : -1;
 }
 
 int DBOP::deleteMessage(const ModelStringType& messageId)
@@ -832,20 +970,22 @@ int DBOP::deleteMessage(const ModelStringType& messageId)
 
 QVariantList DBOP::listSessionMessages(const ModelStringType& sessionDest, bool isGroup)
 {
-	static const QString SESSION_MESSAGE_GET_ALL_USER("select mid,msource,mduuid,mtype,mdata,mdate,mmode,uname from \
-	(select * from Message where msource=? or mduuid=? order by datetime(mdate) asc),User where mmode=1 and msource=uid");
+	//or条件拆成两个分别走索引的分支, 各自按mts有序, 合并时不需要再排序
+	static const QString SESSION_MESSAGE_GET_ALL_USER("select mid,msource,mduuid,mtype,mdata,mdate,mmode,mts,uname from Message,User \
+	where mduuid=? and mmode=1 and msource=uid union all select mid,msource,mduuid,mtype,mdata,mdate,mmode,mts,uname from Message,User \
+	where msource=? and mduuid<>? and mmode=1 and msource=uid order by mts asc");
 	static const QString SESSION_MESSAGE_GET_ALL_GROUP("select mid,msource,mduuid,mtype,mdata,mdate,mmode,uname from Message,User \
-	where mduuid=? and mmode=2 and msource=uid order by datetime(mdate) asc");
+	where mduuid=? and mmode=2 and msource=uid order by mts asc");
 
-	QSqlQuery query;
+	QSqlDatabase db = DBConnection::threadDatabase(dbFileName);
+	QSqlQuery& query = DBConnection::prepared(db, isGroup ? SESSION_MESSAGE_GET_ALL_GROUP : SESSION_MESSAGE_GET_ALL_USER);
 	QVariantList result;
 
 	if (isGroup) {
-		query.prepare(SESSION_MESSAGE_GET_ALL_GROUP);
 		query.addBindValue(sessionDest);
 	}
 	else {
-		query.prepare(SESSION_MESSAGE_GET_ALL_USER);
+		query.addBindValue(sessionDest);
 		query.addBindValue(sessionDest);
 		query.addBindValue(sessionDest);
 	}
@@ -868,35 +1008,40 @@ QVariantList DBOP::listSessionMessages(const ModelStringType& sessionDest, bool
 		item.append(query.value("uname"));
 		result.append(QVariant(item));
 	}
+	query.finish();
 
 	qDebug() << "session message select all success!" << " dest: " << sessionDest << " group: " << isGroup;
 	return result;
 }
 
 //Request operation
-int DBOP::createRequest(const RequestInfo & request, bool isSend)
+int DBOP::createRequest(const RequestInfo & request, bool isSend, DBWriteHandler&& handler)
 {
-	static const QString ADD_REQUEST("insert into Request(rid,rtype,rdata,rstate,rdate,rsource,rdest) values(?,?,?,?,?,?,?)");
-
-	QSqlQuery query;
-	query.prepare(ADD_REQUEST);
-	query.addBindValue(request.rid);
-	query.addBindValue(request.rtype);
-	query.addBindValue(request.rdata);
-	query.addBindValue(request.rstate);
-	query.addBindValue(request.rdate);
-	query.addBindValue(request.rsource);
-	query.addBindValue(request.rdest);
-
-	if (query.exec()) {
-		notifyNewRequestCreate(request, isSend);
-		qDebug() << "request insert success! rid: " << request.rid << " type: " << request.rtype << " data: " << request.rdata;
-		return 0;
-	}
-
-    qDebug() << "request insert failed! rid: " << request.rid << " type: " << request.rtype << " data: " << request.rdata << " reason: " << query.lastError().text();
-	
-	return  -1;
+	static const QString ADD_REQUEST("insert into Request(rid,rtype,rdata,rstate,rdate,rsource,rdest,rts) values(?,?,?,?,?,?,?,?)");
+
+	bool isQueued = writer.submit([request](QSqlDatabase& db) {
+		QSqlQuery& query = DBConnection::prepared(db, ADD_REQUEST);
+		query.addBindValue(request.rid);
+		query.addBindValue(request.rtype);
+		query.addBindValue(request.rdata);
+		query.addBindValue(request.rstate);
+		query.addBindValue(request.rdate);
+		query.addBindValue(request.rsource);
+		query.addBindValue(request.rdest);
+		query.addBindValue(request.rts);
+
+		if (query.exec()) {
+			qDebug() << "request insert success! rid: " << request.rid << " type: " << request.rtype << " data: " << request.rdata;
+			return 0;
+		}
+
+		qDebug() << "request insert failed! rid: " << request.rid << " type: " << request.rtype << " data: " << request.rdata << " reason: " << query.lastError().text();
+		return -1;
+	}, [this, request, isSend, handler](int result) {
+		if (result == 0) notifyNewRequestCreate(request, isSend);
+		if (handler) handler(result);
+	});
+	return isQueued ? 0 : -1;
 }
 
 QVariantHash DBOP::getRequestTaskNeedingInfo(const ModelStringType & requestId)
@@ -923,8 +1068,8 @@ QVariantHash DBOP::getRequestTaskNeedingInfo(const ModelStringType & requestId)
 
 QVariantList DBOP::listRequests(bool isFinished)
 {
-    static const QString REQUEST_GET_NOT_FINISHED("select rid,rtype,rdata,rstate,rdate,rsource,rdest,uname from Request,User where rsource=uid and rstate<=0 order by datetime(rdate) asc");
-    static const QString REQUEST_GET_FINISHED("select rid,rtype,rdata,rstate,rdate,rsource,rdest,uname from Request,User where rsource=uid and rstate>0 order by datetime(rdate) asc");
+    static const QString REQUEST_GET_NOT_FINISHED("select rid,rtype,rdata,rstate,rdate,rsource,rdest,uname from Request,User where rsource=uid and rstate<=0 order by rts asc");
+    static const QString REQUEST_GET_FINISHED("select rid,rtype,rdata,rstate,rdate,rsource,rdest,uname from Request,User where rsource=uid and rstate>0 order by rts asc");
 	
 	QSqlQuery query;
 	QVariantList result;
@@ -956,58 +1101,65 @@ int DBOP::setRequestState(const ModelStringType& requestId, int state)
 {
 	static const QString SET_REQUEST_STATE("update Request set rstate=? where rid=?");
 
-	QSqlQuery query;
-	query.prepare(SET_REQUEST_STATE);
-	query.addBindValue(state);
-	query.addBindValue(requestId);
+	//与createRequest走同一个写队列, 请求刚到就被处理时状态更新也排在插入之后
+	bool isQueued = writer.submit([requestId, state](QSqlDatabase& db) {
+		QSqlQuery& query = DBConnection::prepared(db, SET_REQUEST_STATE);
+		query.addBindValue(state);
+		query.addBindValue(requestId);
 
-	if (query.exec()) {
-		requestStateChanged(requestId, state);
-		qDebug() << "request set state success! rid: " << requestId << " rstate" << state;
-		return 0;
-	}
+		if (query.exec()) {
+			qDebug() << "request set state success! rid: " << requestId << " rstate" << state;
+			return 0;
+		}
 
-	qDebug() << "request set state failed! rid: " << requestId << " rstate" << state << " reason: " << query.lastError().text();
-	return -1;
+		qDebug() << "request set state failed! rid: " << requestId << " rstate" << state << " reason: " << query.lastError().text();
+		return -1;
+	}, [this, requestId, state](int result) {
+		if (result == 0) requestStateChanged(requestId, state);
+	});
+	return isQueued ? 0 : -1;
 }
 
 //Task operation
 int DBOP::createTask(TaskInfo task)
 {
-	static QMutex taskCreateMutex;
-	static const QString ADD_TASK("insert into Task(tid,ttype,tmode,tdata,tstate,tdate,tsource,tdest) values(?,?,?,?,?,?,?,?)");
-
-	QSqlQuery query;
-	query.prepare(ADD_TASK);
-	query.addBindValue(task.tid);
-	query.addBindValue(task.ttype);
-	query.addBindValue(task.tmode);
-	query.addBindValue(task.tdata);
-	query.addBindValue(task.tstate);
-	query.addBindValue(task.tdate);
-	query.addBindValue(task.tsource);
-	query.addBindValue(task.tdest);
-
-	QMutexLocker lock(&taskCreateMutex);
-	if (query.exec()) {
-		notifyNewTaskCreate(task);
-		qDebug() << "task insert success! tdest: " << task.tdest << " type: " << task.ttype << " tdata: " << task.tdata;
-		return 0;
-	}
-
-	qDebug() << "task insert failed! tdest: " << task.tdest << " type: " << task.ttype << " tdata: " << task.tdata << " reason: " << query.lastError().text();
-	return -1;
+	static const QString ADD_TASK("insert into Task(tid,ttype,tmode,tdata,tstate,tdate,tsource,tdest,tts) values(?,?,?,?,?,?,?,?,?)");
+
+	//与setTaskState走同一个写队列, 任务的插入总在它的状态更新之前提交
+	bool isQueued = writer.submit([task](QSqlDatabase& db) {
+		QSqlQuery& query = DBConnection::prepared(db, ADD_TASK);
+		query.addBindValue(task.tid);
+		query.addBindValue(task.ttype);
+		query.addBindValue(task.tmode);
+		query.addBindValue(task.tdata);
+		query.addBindValue(task.tstate);
+		query.addBindValue(task.tdate);
+		query.addBindValue(task.tsource);
+		query.addBindValue(task.tdest);
+		query.addBindValue(task.tts);
+
+		if (query.exec()) {
+			qDebug() << "task insert success! tdest: " << task.tdest << " type: " << task.ttype << " tdata: " << task.tdata;
+			return 0;
+		}
+
+		qDebug() << "task insert failed! tdest: " << task.tdest << " type: " << task.ttype << " tdata: " << task.tdata << " reason: " << query.lastError().text();
+		return -1;
+	}, [this, task](int result) {
+		if (result == 0) notifyNewTaskCreate(task);
+	});
+	return isQueued ? 0 : -1;
 }
 
 QVariantList DBOP::listTasks(bool isFinished)
 {
-	static const QString TASK_GET_NOT_FINISHED("select * from Task where tstate<=1 order by datetime(tdate) asc");
-	static const QString TASK_GET_FINISHED("select * from Task where tstate>1 order by datetime(tdate) asc");
+	static const QString TASK_GET_NOT_FINISHED("select * from Task where tstate<=1 order by tts asc");
+	static const QString TASK_GET_FINISHED("select * from Task where tstate>1 order by tts asc");
 
-	QSqlQuery query;
+	QSqlDatabase db = DBConnection::threadDatabase(dbFileName);
+	QSqlQuery& query = DBConnection::prepared(db, isFinished ? TASK_GET_FINISHED : TASK_GET_NOT_FINISHED);
 	QVariantList result;
 
-	query.prepare(isFinished ? TASK_GET_FINISHED : TASK_GET_NOT_FINISHED);
 	if (!query.exec()) {
 		qDebug() << "task select all failed! isFinished: " << isFinished << " reason: " << query.lastError().text();
 		return result;
@@ -1026,30 +1178,34 @@ QVariantList DBOP::listTasks(bool isFinished)
 		item.append(query.value("tdest"));
 		result.append(QVariant(item));
 	}
+	query.finish();
 
 	qDebug() << "task select all success! isFinished: " << isFinished;
 	return result;
 }
 
-int DBOP::setTaskState(const QString& taskId, int state)
+int DBOP::setTaskState(const QString& taskId, int state, DBWriteHandler&& handler)
 {
-	static QMutex taskStateMutex;
 	static const QString SET_TASK_STATE("update Task set tstate=? where tid=?");
 
-	QSqlQuery query;
-	query.prepare(SET_TASK_STATE);
-	query.addBindValue(state);
-	query.addBindValue(taskId);
+	//同一任务的状态变化按入队顺序提交, 不再需要互斥量
+	bool isQueued = writer.submit([taskId, state](QSqlDatabase& db) {
+		QSqlQuery& query = DBConnection::prepared(db, SET_TASK_STATE);
+		query.addBindValue(state);
+		query.addBindValue(taskId);
 
-	QMutexLocker lock(&taskStateMutex);
-	if (query.exec()) {
-		state > 1 ? taskHandleFinished(taskId, state) : taskRunningStateChanged(taskId, state);
-		qDebug() << "task set state success! tid: " << taskId << " tstate" << state;
-		return 0;
-	}
+		if (query.exec()) {
+			qDebug() << "task set state success! tid: " << taskId << " tstate" << state;
+			return 0;
+		}
 
-	qDebug() << "task set state failed! tid: " << taskId << " tstate" << state << " reason: " << query.lastError().text();
-	return -1;
+		qDebug() << "task set state failed! tid: " << taskId << " tstate" << state << " reason: " << query.lastError().text();
+		return -1;
+	}, [this, taskId, state, handler](int result) {
+		if (result == 0) state > 1 ? taskHandleFinished(taskId, state) : taskRunningStateChanged(taskId, state);
+		if (handler) handler(result);
+	});
+	return isQueued ? 0 : -1;
 }
 
 static QMutex homeworkMutex;
@@ -3,6 +3,7 @@
 
 #include "Common.h"
 #include "DataModel.h"
+#include "DBWriter.h"
 
 #include "QtCore\qmutex.h"
 #include "QtCore\qvariant.h"
@@ -17,6 +18,8 @@ public:
 	//DDL
 	int createDBConn();
 	int createTables();
+	int migrateSchema();
+	void flushWrites();
 
 	//User operation
 	int addUser(const UserInfo& user);
@@ -40,6 +43,7 @@ public:
 	QVariantList listMembers(const ModelStringType& groupId);
 	int setMemeberRole(const ModelStringType& groupId, const ModelStringType& userId, int role, QString& sql=QString());
 	QStringList listJoinGroup(const ModelStringType& userId);
+	QVariantList listGroupMemberships();
 
 	//Admin operation
 	int createAdmin(const AdminInfo& admin, QString& sql = QString());
@@ -50,17 +54,19 @@ public:
 	//Session operation
 	int createSession(const SessionInfo& session);
 	int deleteSession(const ModelStringType& duuid);
-	int updateSessionLastmsg(const MessageInfo& message, bool isSend);
+	int updateSessionLastmsg(const MessageInfo& message, bool isSend, DBWriteHandler&& handler = DBWriteHandler());
 	QVariantHash getSession(int stype, const ModelStringType& uuid = ModelStringType());
 	QVariantList listSessions();
 
 	//Message operation
-	int createMessage(const MessageInfo& message, bool isSend);
+	//写操作交给写线程排队提交, 返回0只表示已入队, 提交结果通过handler和对应的信号通知
+	int createMessage(const MessageInfo& message, bool isSend, DBWriteHandler&& handler = DBWriteHandler());
+	int updateMessageData(const ModelStringType& messageId, const ModelStringType& data, DBWriteHandler&& handler = DBWriteHandler());
 	int deleteMessage(const ModelStringType& messageId);
 	QVariantList listSessionMessages(const ModelStringType& sessionDest, bool isGroup);
 
 	//Reuqest opearation
-	int createRequest(const RequestInfo& request, bool isSend);
+	int createRequest(const RequestInfo& request, bool isSend, DBWriteHandler&& handler = DBWriteHandler());
 	QVariantHash getRequestTaskNeedingInfo(const ModelStringType& requestId);
 	QVariantList listRequests(bool isFinished);
 	int setRequestState(const ModelStringType& requestId, int state);
@@ -68,7 +74,7 @@ public:
 	//Task operation
 	int createTask(TaskInfo task);
 	QVariantList listTasks(bool isFinished);
-	int setTaskState(const QString& taskId, int state);
+	int setTaskState(const QString& taskId, int state, DBWriteHandler&& handler = DBWriteHandler());
 
 	//Homework operation
 	int createHomework(HomeworkInfo homework);
@@ -92,8 +98,11 @@ private:
 	void notifySharedFileAdd(const SharedFileInfo& fileInfo);
 	void notifyHomeworkCreate(const HomeworkInfo& hwInfo);
 
+	DBWriter writer;
+
 signals:
 	void sessionMsgRecv(QVariantList recvMsg, bool isSend);
+	void sessionMsgDataUpdate(const QString& mid, const QString& mdata);
 	void seesionUpdateLastmsg(QVariantList sessionMsg);
 	void requestStateChanged(const QString& rid, int rstate);
 	void newRequestCreate(QVariantList reqMsg, bool isSend);
@@ -104,6 +113,9 @@ signals:
 	void sharedFileRemove(const QString& fpath);
 	void systemDataInitFinished();
 	void homeworkStateChanged(const QString& hid, int hstate);
+	void groupMembersAdded(const QString& ugid, const QStringList& uids);
+	void groupMemberRemoved(const QString& ugid, const QString& uid);
+	void userGroupDeleted(const QString& ugid);
 	void newHomeworkCreate(QVariantList hwMsg);
 };
 
@@ -58,62 +58,65 @@ SessionInfo::SessionInfo(int stype, const ModelStringType & suid, const ModelStr
 }
 
 MessageInfo::MessageInfo()
+	: mts(0)
 {
 }
 
 MessageInfo::MessageInfo(const ModelStringType& mduuid, int mtype, const ModelStringType &mdata, int mmode)
 	:mid(QUuid::createUuid().toString().remove(QRegExp("[{}]{1}"))), msource(NetStructureManager::getInstance()->getLocalUuid().c_str()), mduuid(mduuid), mmode(mmode),
-	mtype(mtype), mdata(mdata), mdate(QDateTime::currentDateTime().toString(timeFormat))
+	mtype(mtype), mdata(mdata), mdate(QDateTime::currentDateTime().toString(timeFormat)), mts(QDateTime::currentMSecsSinceEpoch())
 {
 }
 
 MessageInfo::MessageInfo(const ModelStringType& mid, const ModelStringType& msource, const ModelStringType & mduuid, int mtype,
 	const ModelStringType & mdata, const ModelStringType & mdate, int mmode)
-	: mid(mid), msource(msource), mduuid(mduuid), mtype(mtype), mdata(mdata), mdate(mdate), mmode(mmode)
+	: mid(mid), msource(msource), mduuid(mduuid), mtype(mtype), mdata(mdata), mdate(mdate), mmode(mmode), mts(QDateTime::currentMSecsSinceEpoch())
 {
 }
 
 RequestInfo::RequestInfo()
+	: rts(0)
 {
 }
 
 RequestInfo::RequestInfo(const ModelStringType& rdest, int rtype, const ModelStringType &rdata)
 	:rdest(rdest), rtype(rtype), rdata(rdata), rstate(ReqState::ReqWaiting), rdate(QDateTime::currentDateTime().toString(timeFormat)),
-	rid(QUuid::createUuid().toString().remove(QRegExp("[{}]{1}"))), rsource(NetStructureManager::getInstance()->getLocalUuid().c_str())
+	rid(QUuid::createUuid().toString().remove(QRegExp("[{}]{1}"))), rsource(NetStructureManager::getInstance()->getLocalUuid().c_str()), rts(QDateTime::currentMSecsSinceEpoch())
 {
 }
 
 RequestInfo::RequestInfo(const ModelStringType& rid, int rtype, const ModelStringType &rdata, 
 	const ModelStringType& rdate, const ModelStringType& rsource, const ModelStringType& rdest)
-	:rid(rid), rtype(rtype), rdata(rdata), rstate(ReqState::ReqWaiting), rsource(rsource), rdest(rdest), rdate(rdate)
+	:rid(rid), rtype(rtype), rdata(rdata), rstate(ReqState::ReqWaiting), rsource(rsource), rdest(rdest), rdate(rdate), rts(QDateTime::currentMSecsSinceEpoch())
 {
 }
 
 RequestInfo::RequestInfo(const ModelStringType & rid, int rtype, const ModelStringType & rdata, int rstate, 
 	const ModelStringType & rdate, const ModelStringType & rsource, const ModelStringType & rdest)
-	: rid(rid), rtype(rtype), rdata(rdata), rstate(rstate), rsource(rsource), rdest(rdest), rdate(rdate)
+	: rid(rid), rtype(rtype), rdata(rdata), rstate(rstate), rsource(rsource), rdest(rdest), rdate(rdate), rts(QDateTime::currentMSecsSinceEpoch())
 {
 }
 
 TaskInfo::TaskInfo()
+	: tts(0)
 {
 }
 
 TaskInfo::TaskInfo(const ModelStringType & tdest, int ttype, int tmode, const ModelStringType & tdata)
 	: tdest(tdest), ttype(ttype), tmode(tmode), tdata(tdata), tstate(TaskState::TaskExecute),  tdate(QDateTime::currentDateTime().toString(timeFormat)),
-	tid(QUuid::createUuid().toString().remove(QRegExp("[{}]{1}"))), tsource(NetStructureManager::getInstance()->getLocalUuid().c_str())
+	tid(QUuid::createUuid().toString().remove(QRegExp("[{}]{1}"))), tsource(NetStructureManager::getInstance()->getLocalUuid().c_str()), tts(QDateTime::currentMSecsSinceEpoch())
 {
 }
 
 TaskInfo::TaskInfo(const ModelStringType & tsource, const ModelStringType & tdest, int ttype, int tmode, const ModelStringType & tdata)
 	: tdest(tdest), ttype(ttype), tmode(tmode), tdata(tdata), tstate(TaskState::TaskExecute), tdate(QDateTime::currentDateTime().toString(timeFormat)),
-	tid(QUuid::createUuid().toString().remove(QRegExp("[{}]{1}"))), tsource(tsource)
+	tid(QUuid::createUuid().toString().remove(QRegExp("[{}]{1}"))), tsource(tsource), tts(QDateTime::currentMSecsSinceEpoch())
 {
 }
 
 TaskInfo::TaskInfo(const ModelStringType & tid, int ttype, int tmode, const ModelStringType & tdata, int tstate, const ModelStringType & tdate, 
 	const ModelStringType & tsource, const ModelStringType & tdest)
-	: tid(tid), ttype(ttype), tmode(tmode), tdata(tdata), tstate(tstate), tdate(tdate), tsource(tsource), tdest(tdest)
+	: tid(tid), ttype(ttype), tmode(tmode), tdata(tdata), tstate(tstate), tdate(tdate), tsource(tsource), tdest(tdest), tts(QDateTime::currentMSecsSinceEpoch())
 {
 }
 
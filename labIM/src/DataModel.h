@@ -74,6 +74,7 @@ struct MessageInfo
 	ModelStringType mduuid;
 	ModelStringType mdata;
 	ModelStringType mdate;
+	qint64 mts;	//创建或收到时的毫秒时间, 同一秒内的消息按它排序
 
 	MessageInfo();
     MessageInfo(const ModelStringType& mduuid, int mtype, const ModelStringType &mdata, int mmode);
@@ -90,6 +91,7 @@ struct RequestInfo
 	ModelStringType rdate;
 	ModelStringType rsource;
 	ModelStringType rdest;
+	qint64 rts;
 
 	RequestInfo();
 	RequestInfo(const ModelStringType& rdest, int rtype, const ModelStringType &rdata);
@@ -107,6 +109,7 @@ struct TaskInfo
 	ModelStringType tdate;
     ModelStringType tsource;
     ModelStringType tdest;
+	qint64 tts;
 
 	TaskInfo();
     TaskInfo(const ModelStringType& tdest, int ttype, int tmode, const ModelStringType &tdata);
@@ -0,0 +1,303 @@
+﻿#include "DeltaSync.h"
+
+#include "QtCore\qcryptographichash.h"
+#include "QtCore\qdatastream.h"
+#include "QtCore\qendian.h"
+
+#include <algorithm>
+#include <cmath>
+
+const int minBlockSize = 2 * 1024;
+const int maxBlockSize = 64 * 1024;
+const int maxLiteralLen = 256 * 1024;
+const int sigHeaderSize = 4 + 8 + 4;
+const int sigEntrySize = 4 + 16;
+const char deltaCopyOp = 'C';
+const char deltaDataOp = 'D';
+const char deltaEndOp = 'E';
+
+static QByteArray strongSum(const char* data, int len)
+{
+	return QCryptographicHash::hash(QByteArray::fromRawData(data, len), QCryptographicHash::Md5);
+}
+
+DeltaSignature::DeltaSignature()
+	: blockSize(0), fileSize(0)
+{
+}
+
+int DeltaSignature::build(QFile & file)
+{
+	fileSize = file.size();
+	blockSize = ((int)std::sqrt((double)fileSize) + 1023) / 1024 * 1024;
+	blockSize = std::max(minBlockSize, std::min(blockSize, maxBlockSize));
+	blocks.clear();
+
+	QByteArray buff(blockSize, '\0');
+	while (true) {
+		int readBytes = file.read(buff.data(), blockSize);
+		if (readBytes < 0) {
+			qDebug() << "delta signature read failed! filename: " << file.fileName() << " errorCode: " << file.errorString();
+			blocks.clear();
+			return -1;
+		}
+		if (readBytes == 0) break;
+
+		blocks.push_back({ weakSum(buff.constData(), readBytes), strongSum(buff.constData(), readBytes) });
+	}
+
+	indexBlocks();
+	return 0;
+}
+
+int DeltaSignature::parse(const RecvBufferType & data)
+{
+	QDataStream stream(data);
+	int blockNum = 0;
+	stream >> blockSize >> fileSize >> blockNum;
+	if (stream.status() != QDataStream::Ok || blockSize <= 0 || blockNum < 0 || (qint64)blockNum * blockSize < fileSize)
+		return -1;
+
+	blocks.resize(blockNum);
+	for (auto& block : blocks) {
+		block.strong.resize(16);
+		stream >> block.weak;
+		stream.readRawData(block.strong.data(), 16);
+	}
+
+	if (stream.status() != QDataStream::Ok) {
+		blocks.clear();
+		return -1;
+	}
+
+	indexBlocks();
+	return 0;
+}
+
+qint64 DeltaSignature::maxSerializedLen(qint64 fileSize)
+{
+	//签名长度来自网络, 按新文件大小和最小块长给出上限, 超过上限的旧文件不做增量
+	return (fileSize / minBlockSize + 1) * sigEntrySize + sigHeaderSize;
+}
+
+SendBufferType DeltaSignature::serialize() const
+{
+	SendBufferType data;
+	QDataStream stream(&data, QIODevice::WriteOnly);
+	stream << blockSize << fileSize << (int)blocks.size();
+	for (auto& block : blocks) {
+		stream << block.weak;
+		stream.writeRawData(block.strong.constData(), block.strong.size());
+	}
+	return data;
+}
+
+int DeltaSignature::getBlockLen(int idx) const
+{
+	if (idx < 0 || idx >= (int)blocks.size()) return -1;
+	return (int)std::min<qint64>(blockSize, fileSize - (qint64)idx * blockSize);
+}
+
+int DeltaSignature::findBlock(quint32 weak, const char * data, int len) const
+{
+	auto range = weakIndex.equal_range(weak);
+	if (range.first == range.second) return -1;
+
+	QByteArray strong;
+	for (auto it = range.first; it != range.second; ++it) {
+		if (getBlockLen(it->second) != len) continue;
+		if (strong.isEmpty()) strong = strongSum(data, len);
+		if (blocks[it->second].strong == strong) return it->second;
+	}
+	return -1;
+}
+
+quint32 DeltaSignature::weakSum(const char * data, int len)
+{
+	quint32 a = 0, b = 0;
+	for (int i = 0; i < len; ++i) {
+		a += (uchar)data[i];
+		b += (len - i) * (uchar)data[i];
+	}
+	return (a & 0xffff) | (b << 16);
+}
+
+void DeltaSignature::indexBlocks()
+{
+	weakIndex.clear();
+	for (int i = 0; i < (int)blocks.size(); ++i)
+		weakIndex.insert(std::make_pair(blocks[i].weak, i));
+}
+
+DeltaEncoder::DeltaEncoder()
+	: pos(0), literalStart(0), hasSum(false), isRollPending(false), sumA(0), sumB(0), matchedLen(0), coveredLen(0)
+{
+}
+
+int DeltaEncoder::loadSignature(const RecvBufferType & data)
+{
+	return signature.parse(data);
+}
+
+void DeltaEncoder::encode(SendBufferType & chunk, bool isEnd)
+{
+	window.append(chunk);
+	SendBufferType out;
+
+	const int blockSize = signature.getBlockSize();
+	const uchar* data = (const uchar*)window.constData();
+	if (signature.getBlockNum() > 0) {
+		while (true) {
+			if (isRollPending) {
+				if (pos + blockSize >= window.size()) break;
+
+				//滚动校验和: 移出窗口首字节, 移入下一个字节
+				sumA = (sumA - data[pos] + data[pos + blockSize]) & 0xffff;
+				sumB = (sumB - blockSize * data[pos] + sumA) & 0xffff;
+				++pos;
+				isRollPending = false;
+
+				if (pos - literalStart >= maxLiteralLen) {
+					emitLiteral(out, literalStart, pos);
+					literalStart = pos;
+				}
+			}
+
+			if (pos + blockSize > window.size()) break;
+
+			if (!hasSum) {
+				quint32 weak = DeltaSignature::weakSum(window.constData() + pos, blockSize);
+				sumA = weak & 0xffff;
+				sumB = weak >> 16;
+				hasSum = true;
+			}
+
+			int idx = signature.findBlock(sumA | (sumB << 16), window.constData() + pos, blockSize);
+			if (idx < 0) {
+				isRollPending = true;
+				continue;
+			}
+
+			emitLiteral(out, literalStart, pos);
+			emitCopy(out, idx);
+			pos += blockSize;
+			literalStart = pos;
+			hasSum = false;
+		}
+	}
+	else {
+		emitLiteral(out, literalStart, window.size());
+		pos = literalStart = window.size();
+	}
+
+	if (isEnd) {
+		//末尾不足一块的数据尝试匹配旧文件的最后一块
+		int lastIdx = signature.getBlockNum() - 1;
+		int lastLen = signature.getBlockLen(lastIdx);
+		int tailStart = window.size() - lastLen;
+		if (lastLen > 0 && lastLen < blockSize && tailStart >= literalStart) {
+			const char* tail = window.constData() + tailStart;
+			if (signature.findBlock(DeltaSignature::weakSum(tail, lastLen), tail, lastLen) == lastIdx) {
+				emitLiteral(out, literalStart, tailStart);
+				emitCopy(out, lastIdx);
+				literalStart = window.size();
+			}
+		}
+
+		emitLiteral(out, literalStart, window.size());
+		out.append(deltaEndOp);
+		window.clear();
+		pos = literalStart = 0;
+		hasSum = isRollPending = false;
+	}
+	else {
+		window.remove(0, literalStart);
+		pos -= literalStart;
+		literalStart = 0;
+	}
+
+	chunk = out;
+}
+
+void DeltaEncoder::emitLiteral(SendBufferType & out, int start, int end)
+{
+	while (start < end) {
+		int len = std::min(end - start, maxLiteralLen);
+		char lenBytes[4];
+		qToBigEndian<quint32>(len, (uchar*)lenBytes);
+		out.append(deltaDataOp);
+		out.append(lenBytes, 4);
+		out.append(window.constData() + start, len);
+		coveredLen += len;
+		start += len;
+	}
+}
+
+void DeltaEncoder::emitCopy(SendBufferType & out, int idx)
+{
+	char idxBytes[4];
+	qToBigEndian<quint32>(idx, (uchar*)idxBytes);
+	out.append(deltaCopyOp);
+	out.append(idxBytes, 4);
+	matchedLen += signature.getBlockLen(idx);
+	coveredLen += signature.getBlockLen(idx);
+}
+
+DeltaDecoder::DeltaDecoder()
+	: baseFile(nullptr), outFile(nullptr), blockSize(0), literalRemain(0), isEnd(false), outputLen(0)
+{
+}
+
+void DeltaDecoder::setFiles(QFile * baseFile, QFile * outFile, int blockSize)
+{
+	this->baseFile = baseFile;
+	this->outFile = outFile;
+	this->blockSize = blockSize;
+}
+
+int DeltaDecoder::decode(const RecvBufferType & data)
+{
+	pending.append(data);
+	int pos = 0;
+	while (pos < pending.size() && !isEnd) {
+		if (literalRemain > 0) {
+			int len = (int)std::min<quint32>(literalRemain, pending.size() - pos);
+			if (outFile->write(pending.constData() + pos, len) != len) return -1;
+			pos += len;
+			literalRemain -= len;
+			outputLen += len;
+			continue;
+		}
+
+		char op = pending[pos];
+		if (op == deltaEndOp) {
+			isEnd = true;
+			++pos;
+			break;
+		}
+		if (op != deltaCopyOp && op != deltaDataOp) {
+			qDebug() << "delta decode failed! unknown op: " << (int)op;
+			return -1;
+		}
+		if (pending.size() - pos < 5) break;
+
+		quint32 value = qFromBigEndian<quint32>((const uchar*)pending.constData() + pos + 1);
+		pos += 5;
+		if (op == deltaDataOp) {
+			literalRemain = value;
+			continue;
+		}
+
+		if (baseFile == nullptr || !baseFile->isOpen() || !baseFile->seek((qint64)value * blockSize)) {
+			qDebug() << "delta decode failed! invalid block: " << value;
+			return -1;
+		}
+
+		QByteArray block = baseFile->read(blockSize);
+		if (block.isEmpty() || outFile->write(block) != block.size()) return -1;
+		outputLen += block.size();
+	}
+
+	pending.remove(0, pos);
+	return 0;
+}
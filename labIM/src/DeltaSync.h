@@ -0,0 +1,86 @@
+﻿#ifndef DELTASYNC_H
+#define DELTASYNC_H
+
+#include "Common.h"
+
+#include "QtCore\qfile.h"
+
+#include <vector>
+
+//rsync式增量传输: 接收方给出已有文件的分块签名(滚动校验和 + MD5), 发送方只发送变化的数据
+//指令流格式: 'C' + 块序号 表示复制旧文件中的块, 'D' + 长度 + 数据 表示新数据, 'E' 表示结束
+class DeltaSignature
+{
+public:
+	DeltaSignature();
+
+	int build(QFile& file);
+	int parse(const RecvBufferType& data);
+	SendBufferType serialize()const;
+
+	int getBlockSize()const { return blockSize; }
+	int getBlockNum()const { return (int)blocks.size(); }
+	int getBlockLen(int idx)const;
+	int findBlock(quint32 weak, const char* data, int len)const;
+
+	static quint32 weakSum(const char* data, int len);
+	static qint64 maxSerializedLen(qint64 fileSize);
+
+private:
+	struct BlockSum {
+		quint32 weak;
+		QByteArray strong;
+	};
+
+	void indexBlocks();
+
+	int blockSize;
+	qint64 fileSize;
+	std::vector<BlockSum> blocks;
+	std::unordered_multimap<quint32, int> weakIndex;
+};
+
+class DeltaEncoder
+{
+public:
+	DeltaEncoder();
+
+	int loadSignature(const RecvBufferType& data);
+	void encode(SendBufferType& chunk, bool isEnd);
+
+	qint64 getMatchedLen()const { return matchedLen; }
+	qint64 getCoveredLen()const { return coveredLen; }
+
+private:
+	void emitLiteral(SendBufferType& out, int start, int end);
+	void emitCopy(SendBufferType& out, int idx);
+
+	DeltaSignature signature;
+	QByteArray window;
+	int pos, literalStart;
+	bool hasSum, isRollPending;
+	quint32 sumA, sumB;
+	qint64 matchedLen, coveredLen;
+};
+
+class DeltaDecoder
+{
+public:
+	DeltaDecoder();
+
+	void setFiles(QFile* baseFile, QFile* outFile, int blockSize);
+	int decode(const RecvBufferType& data);
+
+	bool isFinished()const { return isEnd; }
+	qint64 getOutputLen()const { return outputLen; }
+
+private:
+	QFile *baseFile, *outFile;
+	QByteArray pending;
+	int blockSize;
+	quint32 literalRemain;
+	bool isEnd;
+	qint64 outputLen;
+};
+
+#endif // !DELTASYNC_H
@@ -0,0 +1,74 @@
+﻿#include "DiscoveryBeacon.h"
+
+#include "QtCore\qdatastream.h"
+
+const quint8 beaconMagic = 0xB7;
+const quint8 beaconVersion = 1;
+const int uidLen = 16;
+const int macLen = 6;
+
+static void writeUid(QDataStream& stream, const QString& uid)
+{
+	auto bytes = QByteArray::fromHex(uid.toLatin1());
+	bytes.resize(uidLen);
+	stream.writeRawData(bytes.constData(), uidLen);
+}
+
+static QString readUid(QDataStream& stream)
+{
+	QByteArray bytes(uidLen, '\0');
+	stream.readRawData(bytes.data(), uidLen);
+	return bytes.count('\0') == uidLen ? QString() : QString(bytes.toHex());
+}
+
+SendBufferType DiscoveryBeacon::encode() const
+{
+	//mac为"XX-XX-XX-XX-XX-XX"格式, 去掉分隔符后按6字节存放
+	auto mac = QByteArray::fromHex(host["umac"].toString().remove('-').toLatin1());
+	mac.resize(macLen);
+
+	SendBufferType packet;
+	QDataStream stream(&packet, QIODevice::WriteOnly);
+	stream << beaconMagic << beaconVersion << (quint8)type << stage;
+	writeUid(stream, host["uid"].toString());
+	writeUid(stream, propose);
+	stream << (quint32)make_address_v4(host["uip"].toString().toStdString()).to_uint();
+	stream.writeRawData(mac.constData(), macLen);
+	stream << (quint32)host["hostScore"].toInt() << (quint32)host["forwardRate"].toInt()
+		<< (quint32)host["linkRate"].toInt() << (quint32)host["availRam"].toInt();
+	return packet;
+}
+
+bool DiscoveryBeacon::isBeacon(const RecvBufferType & packet)
+{
+	return !packet.isEmpty() && (quint8)packet[0] == beaconMagic;
+}
+
+bool DiscoveryBeacon::decode(const RecvBufferType & packet, DiscoveryBeacon & beacon)
+{
+	QDataStream stream(packet);
+	quint8 magic, version, type;
+	stream >> magic >> version >> type >> beacon.stage;
+	if (magic != beaconMagic || version != beaconVersion) return false;
+
+	beacon.type = BeaconType(type);
+	auto uid = readUid(stream);
+	beacon.propose = readUid(stream);
+
+	quint32 ip, hostScore, forwardRate, linkRate, availRam;
+	QByteArray mac(macLen, '\0');
+	stream >> ip;
+	stream.readRawData(mac.data(), macLen);
+	stream >> hostScore >> forwardRate >> linkRate >> availRam;
+	if (stream.status() != QDataStream::Ok || uid.isEmpty()) return false;
+
+	beacon.host = JsonObjType();
+	beacon.host["uid"] = uid;
+	beacon.host["uip"] = address_v4(ip).to_string().c_str();
+	beacon.host["umac"] = mac.count('\0') == macLen ? QString() : QString(mac.toHex('-').toUpper());
+	beacon.host["hostScore"] = (int)hostScore;
+	beacon.host["forwardRate"] = (int)forwardRate;
+	beacon.host["linkRate"] = (int)linkRate;
+	beacon.host["availRam"] = (int)availRam;
+	return true;
+}
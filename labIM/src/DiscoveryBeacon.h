@@ -0,0 +1,22 @@
+﻿#ifndef DISCOVERYBEACON_H
+#define DISCOVERYBEACON_H
+
+#include "Common.h"
+
+//选举信标: 选举阶段发往发现组播组的定长二进制包, 只带排序和建立连接需要的节点字段,
+//约70字节, 原来整个localHost的JSON有三百多字节. 首字节为魔数, 与JSON消息区分
+struct DiscoveryBeacon
+{
+	enum BeaconType : quint8 { VoteBeacon = 1, VotedBeacon = 2 };
+
+	BeaconType type;
+	quint8 stage;
+	QString propose;
+	JsonObjType host;
+
+	SendBufferType encode() const;
+	static bool isBeacon(const RecvBufferType& packet);
+	static bool decode(const RecvBufferType& packet, DiscoveryBeacon& beacon);
+};
+
+#endif // !DISCOVERYBEACON_H
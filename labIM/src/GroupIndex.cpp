@@ -0,0 +1,113 @@
+﻿#include "GroupIndex.h"
+#include "DBop.h"
+
+GroupIndex::GroupIndex()
+{
+	auto dbop = DBOP::getInstance();
+	QObject::connect(dbop, &DBOP::groupMembersAdded, [this](const QString& groupId, const QStringList& uids) {
+		addMembers(groupId, uids);
+	});
+	QObject::connect(dbop, &DBOP::groupMemberRemoved, [this](const QString& groupId, const QString& uid) {
+		removeMember(groupId, uid);
+	});
+	QObject::connect(dbop, &DBOP::userGroupDeleted, [this](const QString& groupId) {
+		removeGroup(groupId);
+	});
+
+	QWriteLocker locker(&lock);
+	for (auto& item : dbop->listGroupMemberships()) {
+		auto membership = item.toList();
+		auto& members = groupMembers[membership[0].toString()];
+		int index = indexOf(membership[1].toString());
+		if (members.size() <= index) members.resize(users.size());
+		members.setBit(index);
+	}
+}
+
+GroupIndex * GroupIndex::getInstance()
+{
+	static GroupIndex instance;
+	return &instance;
+}
+
+int GroupIndex::getUserIndex(const QString & uid)
+{
+	{
+		QReadLocker locker(&lock);
+		auto it = userIndex.find(uid);
+		if (it != userIndex.end()) return it.value();
+	}
+
+	QWriteLocker locker(&lock);
+	return indexOf(uid);
+}
+
+QString GroupIndex::getUser(int index)
+{
+	QReadLocker locker(&lock);
+	return index < users.size() ? users[index] : QString();
+}
+
+bool GroupIndex::isMember(const QString & groupId, const QString & uid)
+{
+	QReadLocker locker(&lock);
+	auto groupIt = groupMembers.find(groupId);
+	auto userIt = userIndex.find(uid);
+	if (groupIt == groupMembers.end() || userIt == userIndex.end()) return false;
+	return userIt.value() < groupIt.value().size() && groupIt.value().testBit(userIt.value());
+}
+
+QBitArray GroupIndex::intersect(const QString & groupId, const QBitArray & links)
+{
+	QReadLocker locker(&lock);
+	auto groupIt = groupMembers.find(groupId);
+	if (groupIt == groupMembers.end()) return QBitArray();
+	return groupIt.value() & links;
+}
+
+QStringList GroupIndex::getGroupsOf(const QBitArray & hosts)
+{
+	QReadLocker locker(&lock);
+	QStringList groups;
+	for (auto it = groupMembers.begin(); it != groupMembers.end(); ++it) {
+		if ((it.value() & hosts).count(true) > 0)
+			groups.append(it.key());
+	}
+	return groups;
+}
+
+void GroupIndex::addMembers(const QString & groupId, const QStringList & uids)
+{
+	QWriteLocker locker(&lock);
+	auto& members = groupMembers[groupId];
+	for (auto& uid : uids) {
+		int index = indexOf(uid);
+		if (members.size() <= index) members.resize(users.size());
+		members.setBit(index);
+	}
+}
+
+void GroupIndex::removeMember(const QString & groupId, const QString & uid)
+{
+	QWriteLocker locker(&lock);
+	auto groupIt = groupMembers.find(groupId);
+	auto userIt = userIndex.find(uid);
+	if (groupIt == groupMembers.end() || userIt == userIndex.end()) return;
+	if (userIt.value() < groupIt.value().size()) groupIt.value().clearBit(userIt.value());
+}
+
+void GroupIndex::removeGroup(const QString & groupId)
+{
+	QWriteLocker locker(&lock);
+	groupMembers.remove(groupId);
+}
+
+int GroupIndex::indexOf(const QString & uid)
+{
+	//序号只增不减, 已分配的位不会被其他节点复用
+	auto it = userIndex.find(uid);
+	if (it != userIndex.end()) return it.value();
+
+	users.append(uid);
+	return userIndex[uid] = users.size() - 1;
+}
@@ -0,0 +1,39 @@
+﻿#ifndef GROUPINDEX_H
+#define GROUPINDEX_H
+
+#include "Common.h"
+
+#include "QtCore\qbitarray.h"
+#include "QtCore\qhash.h"
+#include "QtCore\qreadwritelock.h"
+#include "QtCore\qstringlist.h"
+
+//组成员索引: 每个节点分配固定的位序号, 每个组保存一张成员位图, 与连接位图求交即得到要转发的连接
+//启动时一次查询载入全部组成员, 之后随数据库的成员变化事件增量更新
+class GroupIndex : public boost::noncopyable
+{
+public:
+	static GroupIndex* getInstance();
+
+	int getUserIndex(const QString& uid);
+	QString getUser(int index);
+	bool isMember(const QString& groupId, const QString& uid);
+	QBitArray intersect(const QString& groupId, const QBitArray& links);
+	QStringList getGroupsOf(const QBitArray& hosts);
+
+	void addMembers(const QString& groupId, const QStringList& uids);
+	void removeMember(const QString& groupId, const QString& uid);
+	void removeGroup(const QString& groupId);
+
+private:
+	GroupIndex();
+
+	int indexOf(const QString& uid);
+
+	QReadWriteLock lock;
+	QHash<QString, int> userIndex;
+	QStringList users;
+	QHash<QString, QBitArray> groupMembers;
+};
+
+#endif // !GROUPINDEX_H
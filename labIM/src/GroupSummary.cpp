@@ -0,0 +1,58 @@
+﻿#include "GroupSummary.h"
+
+#include "QtCore\qcryptographichash.h"
+#include "QtCore\qendian.h"
+
+const int summaryBitNum = 2048;
+const int summaryHashNum = 3;
+
+GroupSummary::GroupSummary()
+	: bits(summaryBitNum / 8, '\0')
+{
+}
+
+void GroupSummary::add(const QString & groupId)
+{
+	int positions[summaryHashNum];
+	getPositions(groupId, positions);
+	for (int position : positions)
+		bits[position / 8] = bits[position / 8] | (1 << (position % 8));
+}
+
+void GroupSummary::merge(const GroupSummary & other)
+{
+	for (int index = 0; index < bits.size() && index < other.bits.size(); ++index)
+		bits[index] = bits[index] | other.bits[index];
+}
+
+bool GroupSummary::mightContain(const QString & groupId) const
+{
+	int positions[summaryHashNum];
+	getPositions(groupId, positions);
+	for (int position : positions) {
+		if ((bits[position / 8] & (1 << (position % 8))) == 0)
+			return false;
+	}
+	return true;
+}
+
+QString GroupSummary::toBase64() const
+{
+	return bits.toBase64();
+}
+
+GroupSummary GroupSummary::fromBase64(const QString & data)
+{
+	GroupSummary summary;
+	auto bytes = QByteArray::fromBase64(data.toLatin1());
+	if (bytes.size() == summary.bits.size()) summary.bits = bytes;
+	return summary;
+}
+
+void GroupSummary::getPositions(const QString & groupId, int positions[]) const
+{
+	//摘要在节点之间交换, 哈希值必须与进程和Qt版本无关, 取MD5的前几个32位分段作为各个哈希值
+	auto digest = QCryptographicHash::hash(groupId.toUtf8(), QCryptographicHash::Md5);
+	for (int index = 0; index < summaryHashNum; ++index)
+		positions[index] = qFromLittleEndian<quint32>((const uchar*)digest.constData() + index * 4) % summaryBitNum;
+}
@@ -0,0 +1,27 @@
+﻿#ifndef GROUPSUMMARY_H
+#define GROUPSUMMARY_H
+
+#include "Common.h"
+
+//子树组摘要: 子树内所有节点所在组的布隆过滤器, 路由节点之间交换, 只把组消息转发给可能有成员的子树
+//固定256字节, 组数在几百以内时误判率很低, 误判只会多转发一次, 不会漏发
+class GroupSummary
+{
+public:
+	GroupSummary();
+
+	void add(const QString& groupId);
+	void merge(const GroupSummary& other);
+	bool mightContain(const QString& groupId) const;
+	bool operator==(const GroupSummary& other) const { return bits == other.bits; }
+
+	QString toBase64() const;
+	static GroupSummary fromBase64(const QString& data);
+
+private:
+	void getPositions(const QString& groupId, int positions[]) const;
+
+	QByteArray bits;
+};
+
+#endif // !GROUPSUMMARY_H
@@ -15,8 +15,6 @@
 
 #include <chrono>
 
-#include "JlCompress.h"
-
 using namespace std::chrono;
 
 const StringType homeworkFamilyStr("HomeworkManage");
@@ -204,11 +202,10 @@ void HomeworkManager::startHwExecuteTimer(TimerPtr timerPtr, int countdownSec, Q
 		auto dirChildDirs = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::Readable, QDir::Name);
 
 		QDir answerDir(dir.absolutePath() + (dirChildDirs.isEmpty() ? "" : ("/" + dirChildDirs[0])));
-		QString answerFile = tmpDir.c_str() + answerDir.dirName() + ".zip";
-		JlCompress::compressDir(answerFile, answerDir.absolutePath());
 
+		//边压缩边发送, 不再先在tmpDir中生成完整的zip文件
 		auto addr = JsonObjType::fromVariantHash(DBOP::getInstance()->getUser(memberDataPtr->hwInfoMap[homeworkId][1]));
-		auto servicePtr = std::make_shared<FileSendService>(answerFile, memberDataPtr->hwInfoMap[homeworkId][0]);
+		auto servicePtr = std::make_shared<ZipSendService>(answerDir.absolutePath(), answerDir.dirName() + ".zip", memberDataPtr->hwInfoMap[homeworkId][0]);
 		ConnectionManager::getInstance()->connnectHost(ConnType::CONN_TEMP, INVALID_ID, addr, servicePtr, [](const boost::system::error_code& err) {
 			if (err != 0) {
 				qDebug() << "send file connnection connect failed!";
@@ -0,0 +1,84 @@
+﻿#include "HostProbe.h"
+#include "HostScorer.h"
+
+#include "QtCore\qfile.h"
+#include "QtCore\qsavefile.h"
+
+const StringType hostProbeFile = "hostprobe.json";
+
+static JsonObjType cachedHost;
+
+bool HostProbe::loadCache()
+{
+	QFile file(hostProbeFile.c_str());
+	if (!file.open(QFile::ReadOnly)) return false;
+
+	auto host = JsonDocType::fromJson(file.readAll()).object();
+	file.close();
+
+	//主机名或地址变化(换了网络, DHCP重新分配)时缓存作废
+	auto ip = host["uip"].toString().toStdString();
+	if (ip.empty() || host["hostName"].toString().toStdString() != boost::asio::ip::host_name() || !isLocalAddress(ip))
+		return false;
+
+	setLocalIp(ip);
+	cachedHost = host;
+	return true;
+}
+
+JsonObjType HostProbe::probe()
+{
+	if (cachedHost.isEmpty()) {
+		cachedHost = measure(getLocalIp());
+		saveCache(cachedHost);
+		return cachedHost;
+	}
+
+	//可用内存每次启动都不同, 读取很快, 不使用缓存
+	JsonObjType host(cachedHost);
+	host.remove("hostName");
+	host["availRam"] = int(getAvailMemory() >> 20);
+	return host;
+}
+
+void HostProbe::refreshCache()
+{
+	if (cachedHost.isEmpty()) return;
+	saveCache(measure(cachedHost["uip"].toString().toStdString()));
+}
+
+JsonObjType HostProbe::measure(const StringType & ip)
+{
+	JsonObjType host;
+	host["uip"] = ip.c_str();
+	host["umac"] = getMac(ip).c_str();
+	HostScorer::measureLocal(host);
+	return host;
+}
+
+bool HostProbe::isLocalAddress(const StringType & ip)
+{
+	//能绑定说明地址仍属于本机, 不需要解析主机名
+	io_context context;
+	udp::socket sock(context);
+	boost::system::error_code ec;
+	auto addr = make_address_v4(ip, ec);
+	if (!ec) sock.open(udp::v4(), ec);
+	if (!ec) sock.bind(udp::endpoint(addr, 0), ec);
+	return !ec;
+}
+
+void HostProbe::saveCache(const JsonObjType & host)
+{
+	JsonObjType cache(host);
+	cache["hostName"] = boost::asio::ip::host_name().c_str();
+
+	QSaveFile file(hostProbeFile.c_str());
+	if (!file.open(QFile::WriteOnly)) {
+		qDebug() << "save host probe open failed! filePath: " << hostProbeFile.c_str();
+		return;
+	}
+	file.write(JsonDocType(cache).toJson(JsonDocType::Compact));
+	if (!file.commit())
+		qDebug() << "save host probe commit failed! filePath: " << hostProbeFile.c_str();
+}
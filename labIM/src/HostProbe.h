@@ -0,0 +1,21 @@
+﻿#ifndef HOSTPROBE_H
+#define HOSTPROBE_H
+
+#include "Common.h"
+
+//本机探测: 解析本机地址, ARP查MAC和测量转发能力都要几到几十毫秒, 结果缓存到文件.
+//缓存的地址仍能在本机绑定时直接使用, 启动完成后在工作线程重新测量, 供下次启动使用
+class HostProbe
+{
+public:
+	static bool loadCache();
+	static JsonObjType probe();
+	static void refreshCache();
+
+private:
+	static JsonObjType measure(const StringType& ip);
+	static bool isLocalAddress(const StringType& ip);
+	static void saveCache(const JsonObjType& host);
+};
+
+#endif // !HOSTPROBE_H
@@ -0,0 +1,63 @@
+﻿#include "HostScorer.h"
+
+#include "QtCore\qcryptographichash.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std::chrono;
+
+const int benchBlockSize = 256 * 1024;
+const int benchBlockNum = 8;
+const int defaultLinkRate = 100;
+const double HostScorer::unknownRttMs = 10;
+
+void HostScorer::measureLocal(JsonObjType & host)
+{
+	int forwardRate = benchmarkForward();
+	int linkRate = int(getLinkSpeed(host["uip"].toString().toStdString()) / 1000000);
+	if (linkRate <= 0) linkRate = defaultLinkRate;
+
+	host["forwardRate"] = forwardRate;
+	host["linkRate"] = linkRate;
+	host["availRam"] = int(getAvailMemory() >> 20);
+	host["hostScore"] = std::min(forwardRate, linkRate);
+
+	qDebug() << "host score measured! forwardRate: " << forwardRate << " linkRate: " << linkRate << " score: " << host["hostScore"].toInt();
+}
+
+bool HostScorer::rankBefore(const JsonObjType & l, const JsonObjType & r)
+{
+	auto ls = l["hostScore"].toInt(), rs = r["hostScore"].toInt();
+	if (ls != rs)
+		return ls > rs;
+
+	auto lr = l["availRam"].toInt(), rr = r["availRam"].toInt();
+	if (lr != rr)
+		return lr > rr;
+
+	//分值相同时按uid排序, 保证所有节点得到相同的全序, 选举才能收敛
+	return l["uid"].toString() < r["uid"].toString();
+}
+
+double HostScorer::routerScore(const JsonObjType & host, double rttMs)
+{
+	return host["hostScore"].toInt() / (1.0 + rttMs);
+}
+
+int HostScorer::benchmarkForward()
+{
+	//模拟一次转发: 每块数据拷贝一次再算一次摘要, 结果为每微秒处理的比特数即Mbps
+	QByteArray src(benchBlockSize, '\0'), dst(benchBlockSize, '\0');
+	for (int i = 0; i < benchBlockSize; ++i)
+		src[i] = char(i * 131);
+
+	auto start = steady_clock::now();
+	for (int i = 0; i < benchBlockNum; ++i) {
+		memcpy(dst.data(), src.constData(), benchBlockSize);
+		QCryptographicHash::hash(dst, QCryptographicHash::Md5);
+	}
+	auto elapsed = duration_cast<microseconds>(steady_clock::now() - start).count();
+
+	return int(qint64(benchBlockSize) * benchBlockNum * 8 / std::max<long long>(elapsed, 1));
+}
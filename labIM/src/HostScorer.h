@@ -0,0 +1,21 @@
+﻿#ifndef HOSTSCORER_H
+#define HOSTSCORER_H
+
+#include "Common.h"
+
+//节点评分: 用几毫秒的内存拷贝加摘要计算测出本机的转发能力, 与网卡速率取较小值作为容量分(Mbps)
+//选主节点只用容量分排序; 选路由节点和备用节点时再除以主节点实测的往返时延, 连接最好的节点担任路由
+class HostScorer
+{
+public:
+	static void measureLocal(JsonObjType& host);
+	static bool rankBefore(const JsonObjType& l, const JsonObjType& r);
+	static double routerScore(const JsonObjType& host, double rttMs);
+
+	static const double unknownRttMs;
+
+private:
+	static int benchmarkForward();
+};
+
+#endif // !HOSTSCORER_H
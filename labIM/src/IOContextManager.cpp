@@ -1,7 +1,9 @@
 ﻿#include "IOContextManager.h"
 
+#include <algorithm>
+
 IOContextManager::IOContextManager()
-	:hsLoop(1), ioLoop(1)
+	:hsLoop(1), ioLoop(1), workerNum(std::max(1, (int)std::thread::hardware_concurrency() - 1))
 {
 }
 
@@ -33,6 +35,12 @@ void IOContextManager::run()
 
 	workers.push_back(std::move(hsLoopThread));
 	workers.push_back(std::move(ioLoopThread));
+
+	//压缩等CPU密集的工作放到独立线程池, 不阻塞网络线程
+	auto workGuard(new io_context::work(workLoop));
+	for (int i = 0; i < workerNum; ++i) {
+		workers.push_back(std::thread([](io_context& loop) { loop.run(); }, std::ref(workLoop)));
+	}
 }
 
 void IOContextManager::wait()
@@ -47,4 +55,5 @@ void IOContextManager::stop()
 {
 	hsLoop.stop();
 	ioLoop.stop();
+	workLoop.stop();
 }
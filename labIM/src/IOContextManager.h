@@ -9,6 +9,8 @@ class IOContextManager : public boost::noncopyable
 private:
 	io_context hsLoop;
 	io_context ioLoop;
+	io_context workLoop;
+	int workerNum;
 	std::vector<std::thread> workers;
 
 	~IOContextManager();
@@ -18,6 +20,8 @@ public:
 
 	inline io_context& getHSLoop() { return hsLoop; }
 	inline io_context& getIOLoop() { return ioLoop; }
+	inline io_context& getWorkLoop() { return workLoop; }
+	inline int getWorkerNum()const { return workerNum; }
 
 	void init();
 	void run();
@@ -0,0 +1,25 @@
+﻿#include "MessageDedup.h"
+
+MessageDedup::MessageDedup(int maxEntries, qint64 windowMs)
+	: maxEntries(maxEntries), windowMs(windowMs)
+{
+	clock.start();
+}
+
+bool MessageDedup::isFirstSeen(const QString & msgId)
+{
+	QMutexLocker lock(&mutex);
+	if (current.size() >= maxEntries || clock.elapsed() >= windowMs) rotate();
+
+	if (current.contains(msgId) || previous.contains(msgId)) return false;
+
+	current.insert(msgId);
+	return true;
+}
+
+void MessageDedup::rotate()
+{
+	previous.swap(current);
+	current.clear();
+	clock.restart();
+}
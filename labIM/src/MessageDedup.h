@@ -0,0 +1,29 @@
+﻿#ifndef MESSAGEDEDUP_H
+#define MESSAGEDEDUP_H
+
+#include "Common.h"
+
+#include "QtCore\qmutex.h"
+#include "QtCore\qset.h"
+#include "QtCore\qelapsedtimer.h"
+
+//消息去重缓存: 两代集合轮换, 当前代写满或超过时间窗口后降为上一代, 旧的上一代整体丢弃
+//查询同时看两代, 内存不超过两代的容量, 窗口内重复到达的消息都能识别
+class MessageDedup : public boost::noncopyable
+{
+public:
+	MessageDedup(int maxEntries, qint64 windowMs);
+
+	bool isFirstSeen(const QString& msgId);
+
+private:
+	void rotate();
+
+	QMutex mutex;
+	QSet<QString> current, previous;
+	QElapsedTimer clock;
+	int maxEntries;
+	qint64 windowMs;
+};
+
+#endif // !MESSAGEDEDUP_H
@@ -4,11 +4,14 @@
 #include "MessageManager.h"
 #include "IOContextManager.h"
 #include "ConnectionManager.h"
+#include "DiscoveryBeacon.h"
+#include "NetSimulator.h"
 
 #include <iostream>
 
 MessageManager::MessageManager(io_context& loop, int tcpPort, int udpPort):
-	tcpListener(loop), tcpPort(tcpPort), udpListener(loop), udpPort(udpPort), udpRecvBuff(BUF_SIZE, '\0')
+	tcpListener(loop), tcpPort(tcpPort), udpListener(loop), udpPort(udpPort), udpRecvBuff(BUF_SIZE, '\0'),
+	discoveryEndpoint(make_address_v4(UDP_BROADCAST_ADDR), udpPort)
 {
 }
 
@@ -40,6 +43,17 @@ void MessageManager::startUdp(const StringType& ip)
 	udpListener.set_option(udp::socket::reuse_address(true));
 	udpListener.set_option(udp::socket::broadcast(true));
 	udpListener.bind(endpoint);
+
+	//选举信标发往站点本地组播组, 子网内不参与的主机不必处理; 加入失败时仍用受限广播
+	boost::system::error_code ec;
+	udpListener.set_option(multicast::join_group(make_address_v4(UDP_DISCOVERY_ADDR), endpoint.address().to_v4()), ec);
+	if (!ec) udpListener.set_option(multicast::outbound_interface(endpoint.address().to_v4()), ec);
+	if (!ec) udpListener.set_option(multicast::hops(1), ec);
+	if (!ec) udpListener.set_option(multicast::enable_loopback(endpoint.address().is_loopback()), ec);
+	if (!ec)
+		discoveryEndpoint = udp::endpoint(make_address_v4(UDP_DISCOVERY_ADDR), udpPort);
+	else
+		qDebug() << "join discovery group failed, fall back to broadcast! errorCode: " << ec;
 	
 	do_recvfrom();
 }
@@ -59,9 +73,7 @@ void MessageManager::sendtoHost(const JsonObjType& addr, JsonObjType msg, Sendto
 	JsonDocType doc(msg);
 	auto sendData = std::make_shared<SendBufferType>(doc.toJson(JSON_FORMAT).data());
 	udp::endpoint ed(make_address(ip), HostDescription::udpPort);
-	udpListener.async_send_to(boost::asio::buffer(sendData->data(), sendData->size()), ed, [=](const boost::system::error_code& err, std::size_t send_bytes) {
-		handler(err, send_bytes);
-	});
+	sendDatagram(sendData, ed, msg["action"].toString(), std::move(handler));
 }
 
 void MessageManager::broadcast(JsonObjType msg, SendtoHandler&& handler)
@@ -69,8 +81,26 @@ void MessageManager::broadcast(JsonObjType msg, SendtoHandler&& handler)
 	JsonDocType doc(msg);
 	auto sendData = std::make_shared<SendBufferType>(doc.toJson(JSON_FORMAT).data());
 	udp::endpoint ed(make_address_v4(UDP_BROADCAST_ADDR), udpPort);
-	udpListener.async_send_to(boost::asio::buffer(sendData->data(), sendData->size()), ed, [=](const boost::system::error_code& err, std::size_t send_bytes) {
-		handler(err, send_bytes);
+	sendDatagram(sendData, ed, msg["action"].toString(), std::move(handler));
+}
+
+void MessageManager::announce(const SendBufferType & beacon)
+{
+	auto sendData = std::make_shared<SendBufferType>(beacon);
+	sendDatagram(sendData, discoveryEndpoint, "Beacon", [](const boost::system::error_code& err, std::size_t) {
+		if (err != 0) qDebug() << "announce beacon failed! error: " << err;
+	});
+}
+
+void MessageManager::sendDatagram(SendBufferPtr sendData, const udp::endpoint& dest, const QString& action, SendtoHandler&& handler)
+{
+	//开启网络模拟时数据报可能被丢弃或延迟发送
+	auto simulator = NetSimulator::getInstance();
+	simulator->countSend(action);
+	simulator->transmitDatagram([this, sendData, dest, handler]() {
+		udpListener.async_send_to(boost::asio::buffer(sendData->data(), sendData->size()), dest, [sendData, handler](const boost::system::error_code& err, std::size_t send_bytes) {
+			handler(err, send_bytes);
+		});
 	});
 }
 
@@ -94,12 +124,20 @@ void MessageManager::do_accept()
 
 void MessageManager::do_recvfrom()
 {
-	udp::endpoint ep(make_address(UDP_BROADCAST_ADDR), udpPort);
-	udpListener.async_receive_from(boost::asio::buffer(udpRecvBuff.data(), udpRecvBuff.size()), ep, 
+	udpListener.async_receive_from(boost::asio::buffer(udpRecvBuff.data(), udpRecvBuff.size()), recvEndpoint, 
 		[this](const boost::system::error_code & err, std::size_t read_bytes) {
+			auto packet = udpRecvBuff.left(read_bytes);
+			if (DiscoveryBeacon::isBeacon(packet)) {
+				NetSimulator::getInstance()->countRecv("Beacon");
+				if (beaconHandler) beaconHandler(packet);
+				do_recvfrom();
+				return;
+			}
+
 			qDebug() << "RECV  len: " << read_bytes << " data: " << udpRecvBuff.left(read_bytes);
 
 			JsonObjType request = JsonDocType::fromJson(udpRecvBuff.left(read_bytes)).object();
+			NetSimulator::getInstance()->countRecv(request["action"].toString());
 			familyParse(request, ConnPtr());
 			
 			do_recvfrom();
@@ -4,6 +4,8 @@
 #include "Common.h"
 #include "MsgParser.h"
 
+typedef std::function<void(const RecvBufferType&)> BeaconHandler;
+
 class MessageManager : public std::enable_shared_from_this<MessageManager>, public boost::noncopyable, public MsgFamilyParser
 {
 public:
@@ -15,6 +17,8 @@ public:
 
 	void sendtoHost(const JsonObjType& addr, JsonObjType msg, SendtoHandler&& handler);
 	void broadcast(JsonObjType msg, SendtoHandler&& handler);
+	void announce(const SendBufferType& beacon);
+	void setBeaconHandler(BeaconHandler&& handler) { beaconHandler = handler; }
 
 	void do_accept();
 	void do_recvfrom();
@@ -28,11 +32,14 @@ private:
 	RecvBufferType udpRecvBuff;
 	RecvBufferType udpMsgBuff;
 	std::istringstream is;
+	udp::endpoint recvEndpoint, discoveryEndpoint;
+	BeaconHandler beaconHandler;
 
 	MessageManager(io_context& loop, int tcpPort, int udpPort);
 
 	void startTcp(const StringType& ip);
 	void startUdp(const StringType& ip);
+	void sendDatagram(SendBufferPtr sendData, const udp::endpoint& dest, const QString& action, SendtoHandler&& handler);
 };
 
 #endif
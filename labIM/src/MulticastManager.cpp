@@ -0,0 +1,567 @@
+﻿#include "MulticastManager.h"
+#include "IOContextManager.h"
+#include "NetStructureManager.h"
+#include "SharedFileManager.h"
+#include "ConnectionManager.h"
+#include "TaskManager.h"
+#include "DataModel.h"
+#include "DBop.h"
+
+#include "QtCore\qfileinfo.h"
+
+#include <random>
+
+using namespace std::chrono;
+
+const quint8 mcastMagic = 0x4D;
+const char mcastAnnounceType = 1;
+const char mcastDataType = 2;
+const char mcastFinType = 3;
+const char mcastNackType = 4;
+const char mcastAckType = 5;
+const int mcastHeadLen = 6;
+const int mcastDataHeadLen = mcastHeadLen + 4;
+const int mcastPacketSize = 1200;
+const qint64 maxMcastFileSize = 4LL * 1024 * 1024 * 1024;
+
+const int paceIntervalMs = 5;
+const double initRate = 8.0 * 1024 * 1024;
+const double minRate = 1.0 * 1024 * 1024;
+const double maxRate = 100.0 * 1024 * 1024;
+const double rateStep = 64.0 * 1024;
+const double rateBackoff = 0.8;
+const int backoffIntervalMs = 100;
+const int announceInterval = 2048;
+const int finIntervalMs = 200;
+const int quietFinRounds = 3;
+const int maxFinRounds = 150;
+
+const int recvTickMs = 300;
+const int recvTimeoutMs = 30000;
+const int maxNackRanges = 128;
+const int maxNackDelayMs = 20;
+
+struct McastSendSession {
+	quint32 sid;
+	QFile file;
+	qint64 fileSize;
+	quint32 packetNum, nextSeq;
+	int sinceAnnounce, finRounds, quietRounds;
+	bool isNacked, isFinishing;
+	double rate;
+	steady_clock::time_point lastBackoff;
+	std::set<quint32> repairSeqs;
+	std::set<QString> pendingAcks;
+	QString filePath, taskId;
+	TaskProgressPtr progress;
+	JsonObjType info;
+	std::shared_ptr<boost::asio::steady_timer> timer;
+};
+
+struct McastRecvSession {
+	quint32 sid;
+	QFile file;
+	qint64 fileSize;
+	quint32 packetNum, recvNum;
+	int packetSize;
+	bool isNackPending;
+	std::vector<bool> bitmap;
+	JsonObjType info;
+	udp::endpoint source;
+	steady_clock::time_point lastRecv;
+	std::shared_ptr<boost::asio::steady_timer> timer, nackTimer;
+};
+
+static std::mt19937& randomEngine()
+{
+	static std::mt19937 engine(std::random_device{}());
+	return engine;
+}
+
+static SendBufferType makeHead(char type, quint32 sid)
+{
+	SendBufferType packet;
+	QDataStream stream(&packet, QIODevice::WriteOnly);
+	stream << mcastMagic << (quint8)type << sid;
+	return packet;
+}
+
+MulticastManager::MulticastManager(io_context & loop)
+	: loop(loop), sock(loop), mcastEndpoint(make_address_v4(UDP_MULTICAST_ADDR), HostDescription::mcastPort),
+	recvBuff(2048, '\0'), isRunning(false)
+{
+}
+
+MulticastManager::~MulticastManager()
+{
+}
+
+MulticastManager * MulticastManager::getInstance()
+{
+	static MulticastManager instance(IOContextManager::getInstance()->getHSLoop());
+	return &instance;
+}
+
+void MulticastManager::run()
+{
+	auto ip = make_address_v4(getLocalIp());
+	boost::system::error_code ec;
+	sock.open(udp::v4(), ec);
+	if (!ec) sock.set_option(udp::socket::reuse_address(true), ec);
+	if (!ec) sock.bind(udp::endpoint(address_v4::any(), HostDescription::mcastPort), ec);
+	if (!ec) sock.set_option(multicast::join_group(make_address_v4(UDP_MULTICAST_ADDR), ip), ec);
+	if (!ec) sock.set_option(multicast::outbound_interface(ip), ec);
+	if (!ec) sock.set_option(multicast::hops(1), ec);
+	if (!ec) sock.set_option(multicast::enable_loopback(false), ec);
+	if (ec) {
+		qDebug() << "multicast start failed! errorCode: " << ec;
+		sock.close(ec);
+		return;
+	}
+
+	isRunning = true;
+	do_recvfrom();
+}
+
+int MulticastManager::sendFile(const QString & groupId, const QString & filePath)
+{
+	if (!isRunning) return -1;
+
+	auto session = std::make_shared<McastSendSession>();
+	session->file.setFileName(filePath);
+	if (!session->file.open(QFile::ReadOnly)) {
+		qDebug() << "multicast send file open failed! filePath: " << filePath;
+		return -1;
+	}
+
+	session->sid = randomEngine()();
+	session->fileSize = session->file.size();
+	if (session->fileSize > maxMcastFileSize) {
+		qDebug() << "multicast send file too large! filePath: " << filePath << " fileSize: " << session->fileSize;
+		return -1;
+	}
+	session->packetNum = quint32((session->fileSize + mcastPacketSize - 1) / mcastPacketSize);
+	session->nextSeq = 0;
+	session->sinceAnnounce = session->finRounds = session->quietRounds = 0;
+	session->isNacked = session->isFinishing = false;
+	session->rate = initRate;
+	session->lastBackoff = steady_clock::now();
+	session->info["fileName"] = QFileInfo(filePath).fileName();
+	session->info["fileSize"] = session->fileSize;
+	session->info["fileGroup"] = groupId;
+	session->info["fileOwner"] = NetStructureManager::getInstance()->getLocalUuid().c_str();
+	session->timer = std::make_shared<boost::asio::steady_timer>(loop);
+	session->filePath = filePath;
+
+	//需要回复ACK的节点: 组内成员, 已知的路由节点以及本节点下载时使用的路由节点
+	QString localId = session->info["fileOwner"].toString();
+	for (auto& member : DBOP::getInstance()->listMembers(groupId))
+		session->pendingAcks.insert(member.toList()[0].toString());
+	for (auto& router : ConnectionManager::getInstance()->getRoutingTable().getRouters())
+		session->pendingAcks.insert(router.c_str());
+	session->pendingAcks.insert(ConnectionManager::getInstance()->getRandomServiceDest());
+	session->pendingAcks.erase(localId);
+	session->pendingAcks.erase(QString());
+
+	TaskInfo task(groupId, TaskType::FileTransferTask, TransferMode::Group, JsonDocType(session->info).toJson(JsonDocType::Compact));
+	if (DBOP::getInstance()->createTask(task) == 0) {
+		session->taskId = task.tid;
+		session->progress = TaskManager::getInstance()->trackTaskProgress(task.tid, session->fileSize);
+	}
+
+	boost::asio::post(loop, [this, session]() {
+		sendSessions[session->sid] = session;
+		sendAnnounce(session, mcastAnnounceType);
+		sendTick(session);
+	});
+	return 0;
+}
+
+void MulticastManager::do_recvfrom()
+{
+	sock.async_receive_from(boost::asio::buffer(recvBuff.data(), recvBuff.size()), recvEndpoint,
+		[this](const boost::system::error_code& err, std::size_t readBytes) {
+			if (err == boost::asio::error::operation_aborted)
+				return;
+
+			if (!err && readBytes >= mcastHeadLen)
+				packetHandle(recvBuff.left(readBytes), recvEndpoint);
+
+			do_recvfrom();
+		}
+	);
+}
+
+void MulticastManager::packetHandle(const RecvBufferType & packet, const udp::endpoint & source)
+{
+	QDataStream stream(packet);
+	quint8 magic = 0, type = 0;
+	quint32 sid = 0;
+	stream >> magic >> type >> sid;
+	if (magic != mcastMagic) return;
+
+	switch (type)
+	{
+	case mcastAnnounceType:
+	case mcastFinType:
+		announceHandle(sid, type, stream, source);
+		break;
+	case mcastDataType:
+		dataHandle(sid, packet);
+		break;
+	case mcastNackType:
+		nackHandle(sid, stream);
+		break;
+	case mcastAckType:
+		ackHandle(sid, stream);
+		break;
+	default:
+		break;
+	}
+}
+
+void MulticastManager::sendAnnounce(McastSendSessionPtr session, char type)
+{
+	auto packet = makeHead(type, session->sid);
+	QDataStream stream(&packet, QIODevice::WriteOnly | QIODevice::Append);
+	stream << session->fileSize << session->packetNum << (quint16)mcastPacketSize << JsonDocType(session->info).toJson(JSON_FORMAT);
+	sendPacket(packet, mcastEndpoint);
+}
+
+void MulticastManager::sendTick(McastSendSessionPtr session)
+{
+	session->isFinishing = false;
+
+	//按当前速率发送一个节拍的数据, 重传请求优先于新数据
+	double budget = session->rate * paceIntervalMs / 1000;
+	while (budget > 0) {
+		quint32 seq = 0;
+		if (!session->repairSeqs.empty()) {
+			seq = *session->repairSeqs.begin();
+			session->repairSeqs.erase(session->repairSeqs.begin());
+		}
+		else if (session->nextSeq < session->packetNum) {
+			seq = session->nextSeq++;
+		}
+		else {
+			break;
+		}
+
+		auto packet = makeHead(mcastDataType, session->sid);
+		QDataStream stream(&packet, QIODevice::WriteOnly | QIODevice::Append);
+		stream << seq;
+		if (!session->file.seek((qint64)seq * mcastPacketSize)) break;
+		packet.append(session->file.read(mcastPacketSize));
+		sendPacket(packet, mcastEndpoint);
+		budget -= packet.size();
+
+		//周期性重发公告, 便于中途加入的接收方
+		if (++session->sinceAnnounce >= announceInterval) {
+			session->sinceAnnounce = 0;
+			sendAnnounce(session, mcastAnnounceType);
+		}
+	}
+
+	if (session->progress.get() != nullptr)
+		session->progress->doneLen.store(std::min<qint64>((qint64)session->nextSeq * mcastPacketSize, session->fileSize), std::memory_order_relaxed);
+
+	if (!session->isNacked)
+		session->rate = std::min(maxRate, session->rate + rateStep);
+	session->isNacked = false;
+
+	if (session->repairSeqs.empty() && session->nextSeq >= session->packetNum) {
+		sendFin(session);
+		return;
+	}
+
+	session->timer->expires_after(milliseconds(paceIntervalMs));
+	session->timer->async_wait([this, session](const boost::system::error_code&) {
+		sendTick(session);
+	});
+}
+
+void MulticastManager::sendFin(McastSendSessionPtr session)
+{
+	//所有节点都已回复ACK, 或者连续几轮结束公告没有收到重传请求, 剩下未回复的节点视为收不到组播
+	if (session->pendingAcks.empty() || session->quietRounds >= quietFinRounds || session->finRounds >= maxFinRounds) {
+		finishSend(session);
+		return;
+	}
+
+	session->isFinishing = true;
+	sendAnnounce(session, mcastFinType);
+	++session->finRounds;
+	++session->quietRounds;
+
+	session->timer->expires_after(milliseconds(finIntervalMs));
+	session->timer->async_wait([this, session](const boost::system::error_code&) {
+		if (session->repairSeqs.empty())
+			sendFin(session);
+		else
+			sendTick(session);
+	});
+}
+
+void MulticastManager::finishSend(McastSendSessionPtr session)
+{
+	qDebug() << "multicast send file finished! fileName: " << session->info["fileName"].toString() << " finRounds: " << session->finRounds << " silentNodes: " << session->pendingAcks.size();
+	session->timer->cancel();
+	session->file.close();
+	sendSessions.erase(session->sid);
+
+	//未回复的节点逐个走TCP上传, 每个上传各自登记任务, 接收方已有旧文件时按增量传输
+	if (!session->pendingAcks.empty()) {
+		auto silentNodes = session->pendingAcks;
+		auto fileInfo = session->info;
+		fileInfo["fileName"] = session->filePath;
+		boost::asio::post(IOContextManager::getInstance()->getIOLoop(), [silentNodes, fileInfo]() mutable {
+			for (auto& node : silentNodes)
+				ConnectionManager::getInstance()->uploadFileToNode(node, fileInfo);
+		});
+	}
+
+	if (!session->taskId.isEmpty()) TaskManager::getInstance()->finishTask(session->taskId);
+}
+
+void MulticastManager::ackHandle(quint32 sid, QDataStream & stream)
+{
+	auto it = sendSessions.find(sid);
+	if (it == sendSessions.end()) return;
+
+	QString uid;
+	stream >> uid;
+	if (stream.status() != QDataStream::Ok) return;
+
+	auto session = it->second;
+	session->pendingAcks.erase(uid);
+	if (session->pendingAcks.empty() && session->isFinishing)
+		session->timer->cancel();
+}
+
+void MulticastManager::nackHandle(quint32 sid, QDataStream & stream)
+{
+	auto it = sendSessions.find(sid);
+	if (it == sendSessions.end()) return;
+
+	auto session = it->second;
+	quint16 rangeNum = 0;
+	stream >> rangeNum;
+	for (int i = 0; i < rangeNum && stream.status() == QDataStream::Ok; ++i) {
+		quint32 start = 0, num = 0;
+		stream >> start >> num;
+		for (quint32 seq = start; seq < start + num && seq < session->packetNum; ++seq)
+			session->repairSeqs.insert(seq);
+	}
+
+	session->quietRounds = 0;
+	session->isNacked = true;
+
+	auto now = steady_clock::now();
+	if (now - session->lastBackoff >= milliseconds(backoffIntervalMs)) {
+		session->rate = std::max(minRate, session->rate * rateBackoff);
+		session->lastBackoff = now;
+	}
+
+	//结束阶段收到重传请求时立即开始补发
+	if (session->isFinishing)
+		session->timer->cancel();
+}
+
+void MulticastManager::announceHandle(quint32 sid, char type, QDataStream & stream, const udp::endpoint & source)
+{
+	//ACK可能丢失, 已收齐的会话再次收到结束公告时重新回复
+	if (type == mcastFinType && completedSessions.count(sid)) {
+		sendAck(sid, source);
+		return;
+	}
+	if (sendSessions.count(sid) || finishedSessions.count(sid)) return;
+
+	McastRecvSessionPtr session;
+	auto it = recvSessions.find(sid);
+	if (it == recvSessions.end()) {
+		QByteArray infoData;
+		quint16 packetSize = 0;
+		session = std::make_shared<McastRecvSession>();
+		stream >> session->fileSize >> session->packetNum >> packetSize >> infoData;
+		if (stream.status() != QDataStream::Ok || packetSize == 0) return;
+		//公告未经认证, 长度与分包数必须自洽且不超过上限
+		if (session->fileSize < 0 || session->fileSize > maxMcastFileSize
+			|| session->packetNum != quint32((session->fileSize + packetSize - 1) / packetSize)) {
+			qDebug() << "multicast announce invalid! fileSize: " << session->fileSize << " packetNum: " << session->packetNum << " packetSize: " << packetSize;
+			return;
+		}
+
+		session->info = JsonDocType::fromJson(infoData).object();
+		if (!isReceiver(session->info["fileGroup"].toString())) {
+			finishedSessions.insert(sid);
+			return;
+		}
+
+		//只取文件名部分, 防止路径穿越到群目录之外
+		QString fileName = QFileInfo(session->info["fileName"].toString()).fileName();
+		if (fileName.isEmpty() || fileName == "." || fileName == "..") {
+			qDebug() << "multicast announce invalid fileName! fileName: " << session->info["fileName"].toString();
+			finishedSessions.insert(sid);
+			return;
+		}
+		session->info["fileName"] = fileName;
+
+		session->sid = sid;
+		session->packetSize = packetSize;
+		session->recvNum = 0;
+		session->isNackPending = false;
+		session->bitmap.assign(session->packetNum, false);
+		session->lastRecv = steady_clock::now();
+		session->timer = std::make_shared<boost::asio::steady_timer>(loop);
+		session->nackTimer = std::make_shared<boost::asio::steady_timer>(loop);
+		session->file.setFileName(groupDir.c_str() + session->info["fileName"].toString() + ".mcast");
+		if (!session->file.open(QFile::ReadWrite | QFile::Truncate) || !session->file.resize(session->fileSize)) {
+			qDebug() << "multicast recv file open failed! filePath: " << session->file.fileName();
+			finishedSessions.insert(sid);
+			return;
+		}
+
+		session->source = source;
+		recvSessions[sid] = session;
+		if (session->packetNum == 0) {
+			finishRecv(session, true);
+			return;
+		}
+		recvTick(session);
+	}
+	else {
+		session = it->second;
+		session->source = source;
+	}
+
+	if (type != mcastFinType || session->isNackPending) return;
+
+	//随机延迟后再请求重传, 错开各接收方的请求
+	session->isNackPending = true;
+	session->nackTimer->expires_after(milliseconds(std::uniform_int_distribution<int>(0, maxNackDelayMs)(randomEngine())));
+	session->nackTimer->async_wait([this, session](const boost::system::error_code& err) {
+		session->isNackPending = false;
+		if (err != boost::asio::error::operation_aborted)
+			sendNack(session);
+	});
+}
+
+void MulticastManager::dataHandle(quint32 sid, const RecvBufferType & packet)
+{
+	auto it = recvSessions.find(sid);
+	if (it == recvSessions.end() || packet.size() < mcastDataHeadLen) return;
+
+	auto session = it->second;
+	QDataStream stream(packet.mid(mcastHeadLen, 4));
+	quint32 seq = 0;
+	stream >> seq;
+	if (seq >= session->packetNum || session->bitmap[seq]) return;
+
+	qint64 offset = (qint64)seq * session->packetSize;
+	int payloadLen = packet.size() - mcastDataHeadLen;
+	if (payloadLen != std::min<qint64>(session->packetSize, session->fileSize - offset)) return;
+
+	if (!session->file.seek(offset) || session->file.write(packet.constData() + mcastDataHeadLen, payloadLen) != payloadLen) {
+		qDebug() << "multicast recv file write failed! filePath: " << session->file.fileName();
+		finishRecv(session, false);
+		return;
+	}
+
+	session->bitmap[seq] = true;
+	session->lastRecv = steady_clock::now();
+	if (++session->recvNum >= session->packetNum)
+		finishRecv(session, true);
+}
+
+void MulticastManager::recvTick(McastRecvSessionPtr session)
+{
+	session->timer->expires_after(milliseconds(recvTickMs));
+	session->timer->async_wait([this, session](const boost::system::error_code& err) {
+		if (err == boost::asio::error::operation_aborted)
+			return;
+
+		auto idle = steady_clock::now() - session->lastRecv;
+		if (idle >= milliseconds(recvTimeoutMs)) {
+			qDebug() << "multicast recv file timeout! filePath: " << session->file.fileName();
+			finishRecv(session, false);
+			return;
+		}
+
+		//一段时间没有收到数据但仍有缺包, 主动请求重传
+		if (idle >= milliseconds(recvTickMs))
+			sendNack(session);
+		recvTick(session);
+	});
+}
+
+void MulticastManager::sendNack(McastRecvSessionPtr session)
+{
+	if (session->recvNum >= session->packetNum) return;
+
+	std::vector<std::pair<quint32, quint32>> ranges;
+	for (quint32 seq = 0; seq < session->packetNum && (int)ranges.size() < maxNackRanges; ++seq) {
+		if (session->bitmap[seq]) continue;
+
+		quint32 start = seq;
+		while (seq < session->packetNum && !session->bitmap[seq]) ++seq;
+		ranges.push_back(std::make_pair(start, seq - start));
+	}
+
+	auto packet = makeHead(mcastNackType, session->sid);
+	QDataStream stream(&packet, QIODevice::WriteOnly | QIODevice::Append);
+	stream << (quint16)ranges.size();
+	for (auto& range : ranges)
+		stream << range.first << range.second;
+	sendPacket(packet, session->source);
+}
+
+void MulticastManager::finishRecv(McastRecvSessionPtr session, bool isOk)
+{
+	session->timer->cancel();
+	session->nackTimer->cancel();
+	session->file.close();
+	recvSessions.erase(session->sid);
+	finishedSessions.insert(session->sid);
+
+	if (!isOk) {
+		session->file.remove();
+		return;
+	}
+
+	QString sharedFilePath = groupDir.c_str() + session->info["fileName"].toString();
+	QFile::remove(sharedFilePath);
+	if (!QFile::rename(session->file.fileName(), sharedFilePath)) {
+		qDebug() << "multicast recv file rename failed! filePath: " << sharedFilePath;
+		return;
+	}
+
+	qDebug() << "multicast recv file finished! filePath: " << sharedFilePath;
+	SharedFileInfo sharedFile(sharedFilePath, session->info["fileOwner"].toString(), session->info["fileGroup"].toString());
+	SharedFileManager::getInstance()->addSharedFile(sharedFile);
+
+	completedSessions.insert(session->sid);
+	sendAck(session->sid, session->source);
+}
+
+void MulticastManager::sendAck(quint32 sid, const udp::endpoint & dest)
+{
+	auto packet = makeHead(mcastAckType, sid);
+	QDataStream stream(&packet, QIODevice::WriteOnly | QIODevice::Append);
+	stream << QString(NetStructureManager::getInstance()->getLocalUuid().c_str());
+	sendPacket(packet, dest);
+}
+
+bool MulticastManager::isReceiver(const QString & groupId)
+{
+	//路由节点保存组文件供下载, 组内成员直接保存一份本地副本
+	auto netManager = NetStructureManager::getInstance();
+	if (netManager->getLocalRole() == ROLE_ROUTER) return true;
+	return DBOP::getInstance()->listJoinGroup(netManager->getLocalUuid().c_str()).contains(groupId);
+}
+
+void MulticastManager::sendPacket(const SendBufferType & packet, const udp::endpoint & dest)
+{
+	boost::system::error_code ec;
+	sock.send_to(boost::asio::buffer(packet.data(), packet.size()), dest, 0, ec);
+	if (ec) qDebug() << "multicast send packet failed! errorCode: " << ec;
+}
@@ -0,0 +1,61 @@
+﻿#ifndef MULTICASTMANAGER_H
+#define MULTICASTMANAGER_H
+
+#include "Common.h"
+
+#include "QtCore\qfile.h"
+#include "QtCore\qdatastream.h"
+
+#include <map>
+#include <set>
+
+struct McastSendSession;
+struct McastRecvSession;
+typedef std::shared_ptr<McastSendSession> McastSendSessionPtr;
+typedef std::shared_ptr<McastRecvSession> McastRecvSessionPtr;
+
+//基于NACK的可靠组播: 文件只向组播组发送一次, 接收方发现缺包后请求重传, 发送方只补发缺失的包.
+//每个接收方收齐后回复ACK, 结束时仍未回复的节点(组播被过滤, 错过公告等)改用TCP逐个补发
+class MulticastManager : public boost::noncopyable
+{
+public:
+	~MulticastManager();
+	static MulticastManager* getInstance();
+
+	void run();
+	int sendFile(const QString& groupId, const QString& filePath);
+
+private:
+	MulticastManager(io_context& loop);
+
+	void do_recvfrom();
+	void packetHandle(const RecvBufferType& packet, const udp::endpoint& source);
+
+	void sendAnnounce(McastSendSessionPtr session, char type);
+	void sendTick(McastSendSessionPtr session);
+	void sendFin(McastSendSessionPtr session);
+	void nackHandle(quint32 sid, QDataStream& stream);
+	void ackHandle(quint32 sid, QDataStream& stream);
+	void finishSend(McastSendSessionPtr session);
+
+	void announceHandle(quint32 sid, char type, QDataStream& stream, const udp::endpoint& source);
+	void dataHandle(quint32 sid, const RecvBufferType& packet);
+	void recvTick(McastRecvSessionPtr session);
+	void sendNack(McastRecvSessionPtr session);
+	void finishRecv(McastRecvSessionPtr session, bool isOk);
+	void sendAck(quint32 sid, const udp::endpoint& dest);
+	bool isReceiver(const QString& groupId);
+
+	void sendPacket(const SendBufferType& packet, const udp::endpoint& dest);
+
+	io_context& loop;
+	udp::socket sock;
+	udp::endpoint mcastEndpoint, recvEndpoint;
+	RecvBufferType recvBuff;
+	bool isRunning;
+	std::map<quint32, McastSendSessionPtr> sendSessions;
+	std::map<quint32, McastRecvSessionPtr> recvSessions;
+	std::set<quint32> finishedSessions, completedSessions;
+};
+
+#endif // !MULTICASTMANAGER_H
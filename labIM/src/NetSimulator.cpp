@@ -0,0 +1,143 @@
+﻿#include "NetSimulator.h"
+#include "IOContextManager.h"
+#include "NetStructureManager.h"
+
+#include "QtCore\qsavefile.h"
+
+#include "boost\asio\steady_timer.hpp"
+
+using namespace std::chrono;
+
+const StringType simStatsFile = "netstats.json";
+const int simDumpInterval = 2000;
+
+NetSimulator::NetSimulator()
+	: isOn(false), delayMs(0), jitterMs(0), lossRate(0), randomEngine((uint)system_clock::to_time_t(system_clock::now())),
+	startTime(steady_clock::now()), convergedMs(-1)
+{
+}
+
+NetSimulator * NetSimulator::getInstance()
+{
+	static NetSimulator instance;
+	return &instance;
+}
+
+void NetSimulator::enable(int newDelayMs, int newJitterMs, double newLossRate)
+{
+	delayMs = std::max(newDelayMs, 0);
+	jitterMs = std::max(newJitterMs, 0);
+	lossRate = newLossRate;
+	isOn = true;
+	startTime = steady_clock::now();
+
+	dumpTimer = std::make_shared<boost::asio::steady_timer>(IOContextManager::getInstance()->getHSLoop());
+	scheduleDump();
+}
+
+void NetSimulator::transmit(const tcp::socket::executor_type& executor, SendHandler && handler)
+{
+	//同一TCP连接上的消息不能乱序, 只加固定时延
+	delayed(executor, isOn ? delayMs : 0, std::move(handler));
+}
+
+void NetSimulator::transmitDatagram(SendHandler && handler)
+{
+	int delay = 0;
+	if (isOn) {
+		QMutexLocker lock(&mutex);
+		if (std::uniform_real_distribution<double>(0, 1)(randomEngine) < lossRate) return;
+		delay = delayMs + (jitterMs > 0 ? std::uniform_int_distribution<int>(0, jitterMs)(randomEngine) : 0);
+	}
+
+	delayed(IOContextManager::getInstance()->getHSLoop().get_executor(), delay, std::move(handler));
+}
+
+void NetSimulator::delayed(const tcp::socket::executor_type& executor, int delay, SendHandler && handler)
+{
+	if (delay <= 0) {
+		handler();
+		return;
+	}
+
+	auto timer = std::make_shared<boost::asio::steady_timer>(executor, milliseconds(delay));
+	timer->async_wait([timer, handler](const boost::system::error_code&) {
+		handler();
+	});
+}
+
+void NetSimulator::countSend(const QString & action)
+{
+	if (!isOn) return;
+	QMutexLocker lock(&mutex);
+	++sendCount[action];
+}
+
+void NetSimulator::countRecv(const QString & action)
+{
+	if (!isOn) return;
+	QMutexLocker lock(&mutex);
+	++recvCount[action];
+}
+
+void NetSimulator::recordHops(int hops)
+{
+	if (!isOn) return;
+	QMutexLocker lock(&mutex);
+	++hopCount[hops];
+}
+
+void NetSimulator::markConverged()
+{
+	if (!isOn) return;
+	QMutexLocker lock(&mutex);
+	if (convergedMs < 0) convergedMs = duration_cast<milliseconds>(steady_clock::now() - startTime).count();
+}
+
+void NetSimulator::dumpStats()
+{
+	auto toJson = [](const std::map<QString, int>& counts) {
+		JsonObjType obj;
+		for (auto& count : counts)
+			obj[count.first] = count.second;
+		return obj;
+	};
+
+	JsonObjType stats;
+	{
+		QMutexLocker lock(&mutex);
+		JsonObjType hops;
+		long long hopSum = 0, msgNum = 0;
+		for (auto& count : hopCount) {
+			hops[QString::number(count.first)] = count.second;
+			hopSum += (long long)count.first * count.second;
+			msgNum += count.second;
+		}
+
+		stats["convergedMs"] = (double)convergedMs;
+		stats["send"] = toJson(sendCount);
+		stats["recv"] = toJson(recvCount);
+		stats["hops"] = hops;
+		stats["avgHops"] = msgNum > 0 ? double(hopSum) / msgNum : 0.0;
+	}
+	stats["uid"] = NetStructureManager::getInstance()->getLocalUuid().c_str();
+	stats["role"] = NetStructureManager::getInstance()->getLocalRole();
+
+	QSaveFile file(simStatsFile.c_str());
+	if (!file.open(QFile::WriteOnly)) {
+		qDebug() << "dump simulator stats failed! filePath: " << simStatsFile.c_str();
+		return;
+	}
+	file.write(JsonDocType(stats).toJson(JsonDocType::Indented));
+	file.commit();
+}
+
+void NetSimulator::scheduleDump()
+{
+	dumpTimer->expires_from_now(milliseconds(simDumpInterval));
+	dumpTimer->async_wait([this](const boost::system::error_code& err) {
+		if (err == boost::asio::error::operation_aborted) return;
+		dumpStats();
+		scheduleDump();
+	});
+}
@@ -0,0 +1,53 @@
+﻿#ifndef NETSIMULATOR_H
+#define NETSIMULATOR_H
+
+#include "Common.h"
+
+#include "QtCore\qmutex.h"
+
+#include <chrono>
+#include <map>
+#include <random>
+
+//网络模拟: 同一台机器上每个实例绑定不同的回环地址(127.0.0.x)即可组成多节点网络.
+//开启后控制消息经过这里发送, 按配置加时延和丢包(TCP只加时延), 并定期把选举收敛时间,
+//单播跳数分布和各类消息的收发数量写入统计文件, 未开启时直接发送, 不做统计
+class NetSimulator : public boost::noncopyable
+{
+public:
+	typedef std::function<void()> SendHandler;
+
+	static NetSimulator* getInstance();
+
+	void enable(int delayMs, int jitterMs, double lossRate);
+	bool isEnabled()const { return isOn; }
+
+	void transmit(const tcp::socket::executor_type& executor, SendHandler&& handler);
+	void transmitDatagram(SendHandler&& handler);
+
+	void countSend(const QString& action);
+	void countRecv(const QString& action);
+	void recordHops(int hops);
+	void markConverged();
+
+private:
+	NetSimulator();
+
+	void delayed(const tcp::socket::executor_type& executor, int delay, SendHandler&& handler);
+	void dumpStats();
+	void scheduleDump();
+
+	bool isOn;
+	int delayMs, jitterMs;
+	double lossRate;
+	std::default_random_engine randomEngine;
+	std::shared_ptr<boost::asio::steady_timer> dumpTimer;
+
+	QMutex mutex;
+	std::chrono::steady_clock::time_point startTime;
+	qint64 convergedMs;
+	std::map<QString, int> sendCount, recvCount;
+	std::map<int, int> hopCount;
+};
+
+#endif // !NETSIMULATOR_H
@@ -4,7 +4,13 @@
 #include "ConnectionManager.h"
 #include "DBop.h"
 #include "Services.h"
+#include "HostScorer.h"
+#include "DiscoveryBeacon.h"
+#include "NetSimulator.h"
+#include "HostProbe.h"
+#include "StartupTimer.h"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <queue>
@@ -12,6 +18,8 @@
 #include "boost\asio\steady_timer.hpp"
 
 #include "QtCore\qcryptographichash.h"
+#include "QtCore\qdatetime.h"
+#include "QtCore\qsavefile.h"
 
 using namespace std::chrono;
 
@@ -19,21 +27,47 @@ const StringType structureManagefamilyStr("StructureManage");
 const StringType voteRunStr("Voting");
 const StringType voteFinishStr("Voted");
 const StringType structInitStr("StructInit");
-const StringType structMaintainStr("StructInit");
-const ushort maxStage = 10;
-const ushort minStage = 5;
+const StringType probeStr("Probe");
+const StringType probeAckStr("ProbeAck");
+const StringType structMaintainStr("StructMaintain");
+const StringType attachChildOpStr("AttachChild");
+const StringType brotherUpdateOpStr("BrotherUpdate");
+const StringType hostLeaveOpStr("HostLeave");
+const StringType hostJoinOpStr("HostJoin");
+const StringType routeUpdateOpStr("RouteUpdate");
+const StringType attachRouterOpStr("AttachRouter");
+const StringType standbyUpdateOpStr("StandbyUpdate");
+const StringType standbySyncOpStr("StandbySync");
+const StringType routerTakeoverOpStr("RouterTakeover");
+const StringType masterYieldOpStr("MasterYield");
+const StringType heartbeatStr("Heartbeat");
+const ushort maxStage = 8;
+const ushort minStage = 2;
 const ushort minHost = 2;
 const ushort votedRepeatNum = 3;
-const ushort stageTimeout = 1000;
+const ushort votedRepeatInterval = 30;
+const ushort stageTimeout = 40;
+const ushort stageJitter = 40;
 const ushort routerNum = 5;
 const ushort backupNum = 2;
 const ushort nodeMaxChildNum = 20;
+const ushort maxLevelNum = 7;
+const ushort rejoinTimeout = 3000;
+const ushort maxRejoinInterval = 30000;
+const ushort maxAnnounceGap = 4;
+const ushort heartbeatInterval = 500;
+const ushort heartbeatTimeout = 1500;
+const ushort takeoverTimeout = 3000;
+const ushort warmStartTimeout = 500;
+const ushort masterBeaconTicks = 10;
+const ushort yieldTeardownDelay = 200;
 
-std::vector<int> getLevelNumSet() {
+//每层最多能容纳的累计节点数(含主节点)
+std::vector<int> getLevelNumSet(int fanout) {
 	std::vector<int> s;
-	for (int i = 0, num = 1, count = num; i < 7; ++i) {
+	for (int i = 0, num = 1, count = num; i < maxLevelNum; ++i) {
 		s.push_back(count);
-		num *= routerNum;
+		num *= fanout;
 		count += num;
 	}
 
@@ -41,14 +75,12 @@ std::vector<int> getLevelNumSet() {
 }
 
 NetStructureManager::NetStructureManager(io_context& context)
-	:randomEngine((uint)system_clock::to_time_t(system_clock::now())), randomRange(0, 500), voteStageTimer(context), role(ROLE_NULL), curAdmin(),
-	hostSet([](const JsonObjType&l, const JsonObjType&r){
+	:randomEngine((uint)system_clock::to_time_t(system_clock::now())), randomRange(0, stageJitter), voteStageTimer(context), heartbeatTimer(context), role(ROLE_NULL), curAdmin(),
+	lastHostNum(0), masterEpoch(0), lastAnnounceNum(0), announceGap(1), quietStages(0), isStructBuilt(false), isHeartbeatRunning(false), beaconTicks(0), standbyRank(0), routerFanout(routerNum), memberFanout(nodeMaxChildNum), hostSet([](const JsonObjType&l, const JsonObjType&r){
         if (l["uid"] == r["uid"])
 			return false;
 
-		auto lv = l["cpuFrequency"].toInt() + l["availRam"].toInt();
-		auto rv = r["cpuFrequency"].toInt() + r["availRam"].toInt();
-		return lv > rv;
+		return HostScorer::rankBefore(l, r);
 	})
 {
 	initHost();
@@ -64,87 +96,177 @@ NetStructureManager * NetStructureManager::getInstance()
     return &instance;
 }
 
+void NetStructureManager::setTreeFanout(ushort newRouterFanout, ushort newMemberFanout)
+{
+	//下次分配结构时生效
+	routerFanout = std::max<ushort>(newRouterFanout, 2);
+	memberFanout = std::max<ushort>(newMemberFanout, 1);
+}
+
 void NetStructureManager::initHost()
 {
-	auto availRam = getAvailMemory();
-	auto cpuFrequency = getCpuFrequency();
-	auto ip = getLocalIp();
-	auto mac = getMac(ip);
+	localHost = HostProbe::probe();
+	auto ip = localHost["uip"].toString().toStdString(), mac = localHost["umac"].toString().toStdString();
     auto uid = QCryptographicHash::hash(QByteArray((ip + mac).c_str(), ip.length() + mac.length()), QCryptographicHash::Md5).toHex().toStdString();
-
     localHost["uid"] =  uid.c_str();
-	localHost["availRam"] = (int)availRam;
-	localHost["cpuFrequency"] = (int)cpuFrequency;
-    localHost["uip"] = ip.c_str();
-    localHost["umac"] = mac.c_str();
 
 	hostSet.insert(localHost);
 
+	MessageManager::getInstance()->setBeaconHandler(std::bind(&NetStructureManager::beaconHandle, this, _1));
     MessageManager::getInstance()->registerFamilyHandler(structureManagefamilyStr, std::bind(&NetStructureManager::actionParse, this, _1, _2));
     ConnectionManager::getInstance()->registerFamilyHandler(structureManagefamilyStr, std::bind(&NetStructureManager::actionParse, this, _1, _2));
 
 	registerActionHandler(voteRunStr, std::bind(&NetStructureManager::voteRun, this, _1, _2));
 	registerActionHandler(voteFinishStr, std::bind(&NetStructureManager::voteFinished, this, _1, _2));
 	registerActionHandler(structInitStr, std::bind(&NetStructureManager::structureInit, this, _1, _2));
+	registerActionHandler(structMaintainStr, std::bind(&NetStructureManager::structureMaintain, this, _1, _2));
+	registerActionHandler(probeStr, std::bind(&NetStructureManager::probeHandle, this, _1, _2));
+	registerActionHandler(probeAckStr, std::bind(&NetStructureManager::probeAckHandle, this, _1, _2));
+	registerActionHandler(heartbeatStr, std::bind(&NetStructureManager::heartbeatHandle, this, _1, _2));
+}
+
+void NetStructureManager::warmStart()
+{
+	//上次是普通节点或路由节点时直接向原主节点报到, 原主节点不再响应时才重新选举
+	QFile file(topologyFile.c_str());
+	JsonObjType snapshot;
+	if (file.open(QFile::ReadOnly)) {
+		snapshot = JsonDocType::fromJson(file.readAll()).object();
+		file.close();
+	}
+
+	auto master = snapshot["master"].toString();
+	auto addr = JsonObjType::fromVariantHash(DBOP::getInstance()->getUser(master));
+	if (master.isEmpty() || master == localHost["uid"].toString() || snapshot["role"].toInt() == ROLE_MASTER || addr["uip"].toString().isEmpty()) {
+		buildNetStructure(1);
+		return;
+	}
+
+	curMaster = master.toStdString();
+	masterEpoch = (qint64)snapshot["epoch"].toDouble();
+	qDebug() << "warm start! master: " << master << " epoch: " << masterEpoch;
+
+	//主节点确认纪元未变时优先把本节点挂回原上级
+	JsonObjType sendMsg(localHost);
+	sendMsg["family"] = structureManagefamilyStr.c_str();
+	sendMsg["action"] = voteRunStr.c_str();
+	sendMsg["propose"] = master;
+	sendMsg["epoch"] = snapshot["epoch"];
+	sendMsg["parent"] = snapshot["parent"];
+	MessageManager::getInstance()->sendtoHost(addr, sendMsg, [](const boost::system::error_code& err, std::size_t) {
+		if (err != 0) qDebug() << "warm start request failed! error: " << err;
+	});
+
+	voteStageTimer.expires_from_now(milliseconds(warmStartTimeout));
+	voteStageTimer.async_wait([this](const boost::system::error_code& err) {
+		if (err == boost::asio::error::operation_aborted || role != ROLE_NULL)
+			return;
+
+		qDebug() << "warm start timeout, fall back to election";
+		curMaster.clear();
+		masterEpoch = 0;
+		buildNetStructure(1);
+	});
+}
+
+void NetStructureManager::saveTopology()
+{
+	auto toArray = [](const std::vector<StringType>& ids) {
+		JsonAryType ary;
+		for (auto& id : ids)
+			ary.push_back(id.c_str());
+		return ary;
+	};
+
+	auto cm = ConnectionManager::getInstance();
+	auto parents = cm->getConnIds(ConnType::CONN_PARENT);
+	JsonObjType snapshot;
+	snapshot["epoch"] = (double)masterEpoch;
+	snapshot["role"] = role;
+	snapshot["master"] = curMaster.c_str();
+	snapshot["parent"] = parents.empty() ? QString() : QString(parents[0].c_str());
+	snapshot["brothers"] = toArray(cm->getConnIds(ConnType::CONN_BROTHER));
+	snapshot["children"] = toArray(cm->getConnIds(ConnType::CONN_CHILD));
+	if (snapshot == lastSnapshot) return;
+
+	QSaveFile file(topologyFile.c_str());
+	if (!file.open(QFile::WriteOnly)) {
+		qDebug() << "save topology open failed! filePath: " << topologyFile.c_str();
+		return;
+	}
+	file.write(JsonDocType(snapshot).toJson(JsonDocType::Compact));
+	if (!file.commit()) {
+		qDebug() << "save topology commit failed! filePath: " << topologyFile.c_str();
+		return;
+	}
+	lastSnapshot = snapshot;
 }
 
 void NetStructureManager::buildNetStructure(int stage)
 {
-	/*auto timeout = randomRange(randomEngine);
-	msgTimer.expires_from_now(milliseconds(timeout));*/
-	voteStageTimer.expires_from_now(milliseconds(stageTimeout));
+	//每轮的超时较短且随机, 节点错开广播(第一轮也加随机延迟, 避免同时启动的节点一起发); 各节点保留每个节点最新的提名, 不再每轮清空
+	if (stage == 1) {
+		lastPropose.clear();
+		announceGap = 1;
+	}
+	voteStageTimer.expires_from_now(milliseconds((stage == 1 ? 0 : stageTimeout) + randomRange(randomEngine)));
 	voteStageTimer.async_wait([this, stage](const boost::system::error_code& err) {
-		if (err == boost::asio::error::operation_aborted) 
+		if (err == boost::asio::error::operation_aborted || role != ROLE_NULL) 
 			return;
 
-		JsonObjType sendMsg(localHost);
+		//提名或已知节点数变化时立即发信标, 否则按1,2,4轮的间隔重发, 其余轮次不发
 		auto maxHost = *hostSet.begin();
-		sendMsg["stage"] =  stage;
-		sendMsg["family"] = structureManagefamilyStr.c_str();
-		sendMsg["action"] = voteRunStr.c_str();
-        sendMsg["propose"] = maxHost["uid"].toString();
-
-        MessageManager::getInstance()->broadcast(sendMsg, [this, sendMsg](const boost::system::error_code&, std::size_t send_bytes) {
-			//std::cout << "SEND  len: " << send_bytes << " data: " << StringType(sendData->begin(), sendData->begin() + send_bytes) << std::endl;
-		});
+		QString propose = maxHost["uid"].toString();
+		bool isChanged = propose != lastPropose || hostSet.size() != lastAnnounceNum;
+		if (isChanged || ++quietStages >= announceGap) {
+			announceVote(DiscoveryBeacon::VoteBeacon, propose, stage);
+			announceGap = isChanged ? 1 : std::min<ushort>(announceGap * 2, maxAnnounceGap);
+			quietStages = 0;
+			lastPropose = propose;
+			lastAnnounceNum = hostSet.size();
+		}
 
-		if (hostSet.size() >= minHost && stage >= minStage && (float)voteCondition.size() / (float)hostSet.size() - 0.5 > 0.000001) {
+		//已知节点数在一轮内没有变化且超过半数节点提名自己时立即结束选举
+		bool isStable = hostSet.size() == lastHostNum;
+		bool isBest = maxHost["uid"] == localHost["uid"];
+		lastHostNum = hostSet.size();
+		if (isBest && isStable && hostSet.size() >= minHost && stage >= minStage && (voteCondition.size() + 1) * 2 > hostSet.size()) {
 			qDebug() << "voted became master";
 			becomeMaster(1);
 			return;
 		}
 
-		if (stage >= maxStage) {
+		//只有自己或者等不到多数票时, 已知最优的节点自行成为主节点; 最优节点失联时其余节点再等一轮后接管
+		if ((stage >= maxStage && isBest) || stage >= maxStage * 2) {
 			qDebug() << "max stage became master";
 			becomeMaster(1);
-			dumpUserToDB();
 			return;
 		}
 
 		qDebug() << "END STAGE " << stage << ": " << voteCondition.size();
-		voteCondition.clear();
-		qDebug() << "START STAGE " << stage << ": " << voteCondition.size();
 		buildNetStructure(stage + 1);
 	});
 }
 
 void NetStructureManager::becomeMaster(ushort repeatCounter)
 {
-	voteStageTimer.expires_from_now(milliseconds(stageTimeout));
-	voteStageTimer.async_wait([this, repeatCounter](const boost::system::error_code& err) {
-		if (err == boost::asio::error::operation_aborted)
-			return;
-
-		JsonObjType sendMsg(localHost);
-		sendMsg["family"] = structureManagefamilyStr.c_str();
-		sendMsg["action"] = voteFinishStr.c_str();
-        sendMsg["propose"] = sendMsg["uid"].toString();
+	if (repeatCounter == 1) {
+		setRole(ROLE_MASTER);
+		curMaster = localHost["uid"].toString().toStdString();
+		masterEpoch = QDateTime::currentMSecsSinceEpoch();
+		saveTopology();
+		structureReady();
+		qDebug() << "became master";
+		probeHosts();
+	}
 
-        MessageManager::getInstance()->broadcast(sendMsg, [this, sendMsg](const boost::system::error_code&, std::size_t send_bytes) {
-			//std::cout << "SEND  len: " << send_bytes << " data: " << StringType(sendData->begin(), sendData->begin() + send_bytes) << std::endl;
-		});
+	announceVote(DiscoveryBeacon::VotedBeacon, localHost["uid"].toString(), 0);
 
-		qDebug() << "became master";
+	//UDP广播可能丢失, 短间隔重复几次后开始分配角色
+	voteStageTimer.expires_from_now(milliseconds(votedRepeatInterval));
+	voteStageTimer.async_wait([this, repeatCounter](const boost::system::error_code& err) {
+		if (err == boost::asio::error::operation_aborted || role != ROLE_MASTER)
+			return;
 
 		if (repeatCounter < votedRepeatNum) {
 			becomeMaster(repeatCounter + 1);
@@ -155,71 +277,782 @@ void NetStructureManager::becomeMaster(ushort repeatCounter)
 	});
 }
 
+void NetStructureManager::replyVoted(const JsonObjType& dest)
+{
+	JsonObjType sendMsg(localHost);
+	sendMsg["family"] = structureManagefamilyStr.c_str();
+	sendMsg["action"] = voteFinishStr.c_str();
+	sendMsg["propose"] = sendMsg["uid"].toString();
+	sendMsg["epoch"] = (double)masterEpoch;
+
+	MessageManager::getInstance()->sendtoHost(dest, sendMsg, [](const boost::system::error_code& err, std::size_t) {
+		if (err != 0) qDebug() << "reply voted failed! error: " << err;
+	});
+}
+
+void NetStructureManager::announceVote(quint8 type, const QString& propose, int stage)
+{
+	DiscoveryBeacon beacon;
+	beacon.type = DiscoveryBeacon::BeaconType(type);
+	beacon.stage = stage;
+	beacon.propose = propose;
+	beacon.host = localHost;
+	MessageManager::getInstance()->announce(beacon.encode());
+}
+
+void NetStructureManager::beaconHandle(const RecvBufferType& packet)
+{
+	DiscoveryBeacon beacon;
+	if (!DiscoveryBeacon::decode(packet, beacon)) {
+		qDebug() << "discovery beacon decode failed! len: " << packet.size();
+		return;
+	}
+
+	JsonObjType msg(beacon.host);
+	msg["propose"] = beacon.propose;
+	if (beacon.type == DiscoveryBeacon::VoteBeacon)
+		voteRun(msg, ConnPtr());
+	else if (beacon.type == DiscoveryBeacon::VotedBeacon)
+		voteFinished(msg, ConnPtr());
+}
+
+void NetStructureManager::probeHosts()
+{
+	//在重复广播选举结果的间隙测量到各节点的往返时延, 分配路由节点时使用
+	for (auto& host : hostSet) {
+		if (host["uid"] != localHost["uid"]) probeHost(host);
+	}
+}
+
+void NetStructureManager::probeHost(const JsonObjType& host)
+{
+	JsonObjType sendMsg;
+	sendMsg["family"] = structureManagefamilyStr.c_str();
+	sendMsg["action"] = probeStr.c_str();
+	sendMsg["source"] = localHost;
+	sendMsg["sendTime"] = (double)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+	MessageManager::getInstance()->sendtoHost(host, sendMsg, [](const boost::system::error_code&, std::size_t) {});
+}
+
+double NetStructureManager::getRtt(const JsonObjType& host)
+{
+	//没有回应探测的节点按较大的时延计算
+	auto rttIt = hostRtt.find(host["uid"].toString().toStdString());
+	return rttIt == hostRtt.end() ? HostScorer::unknownRttMs : rttIt->second;
+}
+
+bool NetStructureManager::routerBefore(const JsonObjType& l, const JsonObjType& r)
+{
+	//容量分除以时延后相同再按选举顺序, 多数节点都在千兆网卡上时容量分往往相同, 由时延区分
+	auto ls = HostScorer::routerScore(l, getRtt(l)), rs = HostScorer::routerScore(r, getRtt(r));
+	if (ls != rs)
+		return ls > rs;
+	return HostScorer::rankBefore(l, r);
+}
+
+void NetStructureManager::probeHandle(JsonObjType& msg, ConnPtr)
+{
+	JsonObjType sendMsg;
+	sendMsg["family"] = structureManagefamilyStr.c_str();
+	sendMsg["action"] = probeAckStr.c_str();
+	sendMsg["uid"] = localHost["uid"];
+	sendMsg["sendTime"] = msg["sendTime"];
+	MessageManager::getInstance()->sendtoHost(msg["source"].toObject(), sendMsg, [](const boost::system::error_code&, std::size_t) {});
+}
+
+void NetStructureManager::probeAckHandle(JsonObjType& msg, ConnPtr)
+{
+	auto now = duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+	hostRtt[msg["uid"].toString().toStdString()] = (now - (qint64)msg["sendTime"].toDouble()) / 1000.0;
+}
+
 void NetStructureManager::hostRoleAssignment()
 {
-	if (hostSet.size() == 1) return ;
+	isStructBuilt = true;
+	if (hostSet.size() <= 1) {
+		startHeartbeat();
+		dumpUserToDB();
+		return;
+	}
 
 	std::vector<JsonObjType> nodes;
-	auto hostIt = hostSet.begin();
-	for (++hostIt; hostIt != hostSet.end(); ++hostIt) {
-		nodes.push_back(*hostIt);
+	for (auto& host : hostSet) {
+		if (host["uid"] == localHost["uid"]) continue;
+		nodes.push_back(host);
+		memberHosts[host["uid"].toString().toStdString()] = host;
+	}
+
+	//按容量分与实测时延排序, 排在前面的担任路由节点
+	std::sort(nodes.begin(), nodes.end(), [this](const JsonObjType& l, const JsonObjType& r) { return routerBefore(l, r); });
+
+	//路由节点之间组成routerFanout叉树, 每个路由节点带memberFanout个成员节点, 层数随节点数自动确定;
+	//最多层数也放不下时增加每个路由节点的成员数, 保证每个节点的连接数有上限
+	int memberNum = memberFanout;
+	int routerCount = (nodes.size() + memberNum) / (memberNum + 1);
+	auto levelNumSet = getLevelNumSet(routerFanout);
+	if (routerCount > levelNumSet.back() - 1) {
+		routerCount = levelNumSet.back() - 1;
+		memberNum = (nodes.size() - 1) / routerCount;
+	}
+	int depth = 1;
+	while (levelNumSet[depth] - 1 < routerCount) ++depth;
+	qDebug() << "structure routers: " << routerCount << " depth: " << depth;
+
+	//按层次排列路由节点: 第index个路由节点的上级是第index / routerFanout - 1个, 第一层的上级是主节点
+	auto localUid = localHost["uid"].toString().toStdString();
+	auto& routingTable = ConnectionManager::getInstance()->getRoutingTable();
+	for (int index = 0; index < routerCount; ++index) {
+		auto uid = nodes[index]["uid"].toString().toStdString();
+		auto parent = index < routerFanout ? localUid : nodes[index / routerFanout - 1]["uid"].toString().toStdString();
+		routerParent[uid] = parent;
+		routerSubs[parent].push_back(uid);
+		routerChildren[uid] = std::set<std::string>();
+		routingTable.setOwner(uid, uid);
+		routingTable.setParent(uid, parent);
+	}
+
+	for (int index = routerCount; index < nodes.size(); ++index) {
+		auto uid = nodes[index]["uid"].toString().toStdString();
+		auto router = nodes[(index - routerCount) / memberNum]["uid"].toString().toStdString();
+		routerChildren[router].insert(uid);
+		routingTable.setOwner(uid, router);
+	}
+
+	//主节点只连接第一层路由节点, 下层结构随结构消息由各路由节点逐层下发
+	for (auto& router : routerSubs[localUid])
+		assignRouter(getRouterSpec(router, true), JsonAryType());
+	for (auto& router : routerParent)
+		standbyDirty.insert(router.first);
+	startHeartbeat();
+	dumpUserToDB();
+}
+
+JsonObjType NetStructureManager::getRouterSpec(const std::string& router, bool withSubtree)
+{
+	auto& brothers = routerSubs[routerParent[router]];
+	int order = std::find(brothers.begin(), brothers.end(), router) - brothers.begin();
+
+	JsonAryType brotherAry;
+	if (brothers.size() >= 2) {
+		brotherAry.push_back(memberHosts[brothers[(order + brothers.size() - 1) % brothers.size()]]);
+		brotherAry.push_back(memberHosts[brothers[(order + 1) % brothers.size()]]);
 	}
 
-	int routerNum = nodes.size() / (nodeMaxChildNum + 1);
-	routerNum += nodes.size() % (nodeMaxChildNum + 1) == 0 ? 0 : 1;
+	JsonObjType spec;
+	spec["host"] = memberHosts[router];
+	spec["order"] = order;
+	spec["brothers"] = brotherAry;
+	if (!withSubtree) return spec;
+
+	JsonAryType children, routers;
+	for (auto& child : routerChildren[router])
+		children.push_back(memberHosts[child]);
+	for (auto& sub : routerSubs[router])
+		routers.push_back(getRouterSpec(sub, true));
+	spec["children"] = children;
+	spec["routers"] = routers;
+	return spec;
+}
+
+std::string NetStructureManager::findRouterSlot()
+{
+	//按层次找第一个下级路由节点未满的节点, 树保持尽量矮
+	std::queue<std::string> routers;
+	routers.push(localHost["uid"].toString().toStdString());
+	while (!routers.empty()) {
+		auto router = routers.front();
+		routers.pop();
+		auto& subs = routerSubs[router];
+		if (subs.size() < routerFanout) return router;
+		for (auto& sub : subs) routers.push(sub);
+	}
+	return std::string();
+}
+
+void NetStructureManager::assignRouter(const JsonObjType& spec, const JsonAryType& hosts)
+{
+	JsonObjType sendMsg;
+	sendMsg["family"] = structureManagefamilyStr.c_str();
+	sendMsg["action"] = structInitStr.c_str();
+	sendMsg["assignRole"] = ROLE_ROUTER;
+	sendMsg["linkType"] = ConnType::CONN_PARENT;
+	sendMsg["order"] = spec["order"];
+	sendMsg["source"] = localHost;
+	sendMsg["epoch"] = (double)masterEpoch;
+	sendMsg["brothers"] = spec["brothers"];
+	if (spec.contains("children")) sendMsg["children"] = spec["children"];
+	if (spec.contains("routers")) sendMsg["routers"] = spec["routers"];
+	sendMsg["routes"] = ConnectionManager::getInstance()->getRoutingTable().toJson();
+	if (!hosts.isEmpty()) sendMsg["hosts"] = hosts;
 
     auto cm = ConnectionManager::getInstance();
+	JsonObjType addr(spec["host"].toObject());
+    auto connId = addr["uid"].toString().toStdString();
+	auto servicePtr = std::make_shared<NetStructureService>();
+    cm->connnectHost(ConnType::CONN_CHILD, connId, addr, servicePtr, [cm, connId, sendMsg](const boost::system::error_code& err) {
+		if (err != 0)
+			return;
 
-	for (int counter = 0; counter < routerNum; ++counter) {
-		JsonObjType sendMsg;
-		sendMsg["family"] = structureManagefamilyStr.c_str();
-		sendMsg["action"] = structInitStr.c_str();
-		sendMsg["assignRole"] = ROLE_ROUTER;
-		sendMsg["order"] = counter;
-		sendMsg["source"] = localHost;
-
-		JsonAryType brothers;
-		brothers.push_back(nodes[counter == 0 ? routerNum - 1 : counter - 1]);
-		brothers.push_back(nodes[counter == routerNum - 1 ? 0 : counter + 1]);
-		sendMsg["brothers"] = brothers;
-
-		JsonAryType children;
-		int nodeIndex = counter*nodeMaxChildNum + routerNum;
-		for (int childCnt = 0; childCnt < nodeMaxChildNum && nodeIndex < nodes.size(); ++childCnt, ++nodeIndex)
-			children.push_back(nodes[nodeIndex]);
-		sendMsg["children"] = children;
-		
-        auto connId = nodes[counter]["uid"].toString().toStdString();
-		
-		auto servicePtr = std::make_shared<NetStructureService>();
-        cm->connnectHost(ConnType::CONN_CHILD, connId, nodes[counter], servicePtr, [cm, connId, sendMsg](const boost::system::error_code& err) {
-			if (err != 0)
-				return;
-
-			qDebug() << "connect success";
-            cm->sendtoConn(connId, sendMsg);
+		qDebug() << "connect success";
+        cm->sendtoConn(connId, sendMsg);
+	});
+}
+
+void NetStructureManager::reattachRouter(const std::string& router)
+{
+	//只重新下发上级连接与兄弟关系, 它与下级路由节点和子节点的连接保持不变
+	auto parent = routerParent[router];
+	auto spec = getRouterSpec(router, false);
+	if (parent == localHost["uid"].toString().toStdString())
+		assignRouter(spec, JsonAryType());
+	else
+		sendMaintainMsg(parent, attachRouterOpStr, spec);
+}
+
+void NetStructureManager::attachHost(const JsonObjType& host, const std::string& preferRouter)
+{
+	auto uid = host["uid"].toString().toStdString();
+	bool isNew = memberHosts.find(uid) == memberHosts.end();
+	memberHosts[uid] = host;
+
+	//路由节点重新报到说明它失去了上级连接
+	if (routerChildren.find(uid) != routerChildren.end()) {
+		reattachRouter(uid);
+		return;
+	}
+
+	//已挂在某个路由节点下的节点重新请求时只让原路由节点重连
+	for (auto& router : routerChildren) {
+		if (router.second.count(uid)) {
+			sendMaintainMsg(router.first, attachChildOpStr, host, getKnownHosts());
+			return;
+		}
+	}
+
+	//新节点挂到子节点最少的路由节点下(重启的节点优先挂回原上级), 所有路由节点都满了才把它提升为新的路由节点
+	std::string minRouter;
+	size_t minChildNum = memberFanout;
+	auto preferIt = routerChildren.find(preferRouter);
+	if (preferIt != routerChildren.end() && preferIt->second.size() < minChildNum) {
+		minRouter = preferRouter;
+	}
+	else {
+		for (auto& router : routerChildren) {
+			if (router.second.size() < minChildNum) {
+				minRouter = router.first;
+				minChildNum = router.second.size();
+			}
+		}
+	}
+
+	if (!minRouter.empty()) {
+		routerChildren[minRouter].insert(uid);
+		standbyDirty.insert(minRouter);
+		publishRoute(uid, minRouter);
+		sendMaintainMsg(minRouter, attachChildOpStr, host, getKnownHosts());
+	}
+	else {
+		//新路由节点按层次补到第一个未满的位置, 由它的上级连接并下发结构
+		auto parent = findRouterSlot();
+		routerParent[uid] = parent;
+		routerSubs[parent].push_back(uid);
+		routerChildren[uid] = std::set<std::string>();
+		standbyDirty.insert(parent);
+		publishRoute(uid, uid, parent);
+
+		auto spec = getRouterSpec(uid, true);
+		if (parent == localHost["uid"].toString().toStdString())
+			assignRouter(spec, getKnownHosts());
+		else
+			sendMaintainMsg(parent, attachRouterOpStr, spec, getKnownHosts());
+
+		//新路由节点插在同级环尾, 环首的路由节点补上与它的兄弟连接
+		auto& brothers = routerSubs[parent];
+		if (brothers.size() > 2) sendMaintainMsg(brothers.front(), brotherUpdateOpStr, host);
+	}
+
+	if (isNew) {
+		//后加入的节点补测时延, 之后选备用节点时使用
+		probeHost(host);
+
+		JsonObjType datas;
+		datas["op"] = hostJoinOpStr.c_str();
+		datas["host"] = host;
+		ConnectionManager::getInstance()->sendActionMsg(TransferMode::Broadcast, structureManagefamilyStr, structMaintainStr, datas);
+	}
+}
+
+void NetStructureManager::removeHost(const std::string& uid)
+{
+	//有备用节点的路由节点先等备用节点接管, 超时仍未接管再按路由节点离开处理
+	auto standbyIt = routerStandbys.find(uid);
+	if (standbyIt != routerStandbys.end() && !standbyIt->second.empty() && routerParent.count(uid)) {
+		auto timer = std::make_shared<boost::asio::steady_timer>(IOContextManager::getInstance()->getHSLoop());
+		timer->expires_from_now(milliseconds(takeoverTimeout));
+		timer->async_wait([this, timer, uid](const boost::system::error_code&) {
+			if (!routerParent.count(uid)) return;
+			routerStandbys.erase(uid);
+			removeHost(uid);
 		});
+		return;
+	}
+
+	memberHosts.erase(uid);
+	routerStandbys.erase(uid);
+	for (auto& router : routerChildren) {
+		if (router.second.erase(uid)) standbyDirty.insert(router.first);
+	}
+	publishRoute(uid, std::string());
+
+	auto parentIt = routerParent.find(uid);
+	if (parentIt == routerParent.end()) return;
+
+	//路由节点离开: 同级前后两个兄弟直接相连, 它的下级路由节点改挂到它的上级下, 子节点重新挂到其他路由节点下
+	auto parent = parentIt->second;
+	routerParent.erase(parentIt);
+	auto& brothers = routerSubs[parent];
+	auto routerIt = std::find(brothers.begin(), brothers.end(), uid);
+	int index = routerIt - brothers.begin();
+	if (routerIt != brothers.end()) brothers.erase(routerIt);
+	auto orphanRouters = routerSubs[uid];
+	auto orphans = routerChildren[uid];
+	routerSubs.erase(uid);
+	routerChildren.erase(uid);
+	standbyDirty.erase(uid);
+	if (routerParent.count(parent)) standbyDirty.insert(parent);
+
+	if (brothers.size() >= 2) {
+		auto& prev = brothers[(index + brothers.size() - 1) % brothers.size()];
+		auto& next = brothers[index % brothers.size()];
+		sendMaintainMsg(next, brotherUpdateOpStr, memberHosts[prev]);
+	}
+
+	//上级暂时超出扇出上限, 之后提升的路由节点会按层次补到空出的位置
+	for (auto& orphanRouter : orphanRouters) {
+		routerParent[orphanRouter] = parent;
+		brothers.push_back(orphanRouter);
+		publishRoute(orphanRouter, orphanRouter, parent);
+		reattachRouter(orphanRouter);
+	}
+
+	for (auto& orphan : orphans) {
+		if (memberHosts.find(orphan) != memberHosts.end())
+			attachHost(memberHosts[orphan]);
 	}
-	dumpUserToDB();
+}
+
+void NetStructureManager::publishRoute(const std::string& uid, const std::string& router, const std::string& parent)
+{
+	JsonObjType datas;
+	datas["op"] = routeUpdateOpStr.c_str();
+	datas["uid"] = uid.c_str();
+	datas["router"] = router.c_str();
+	datas["parent"] = parent.c_str();
+	applyRouteUpdate(datas);
+}
+
+void NetStructureManager::applyRouteUpdate(const JsonObjType& datas)
+{
+	auto uid = datas["uid"].toString().toStdString(), router = datas["router"].toString().toStdString();
+	auto parent = datas["parent"].toString().toStdString();
+	auto& routingTable = ConnectionManager::getInstance()->getRoutingTable();
+	if (router.empty()) {
+		routingTable.removeHost(uid);
+	}
+	else {
+		routingTable.setOwner(uid, router);
+		if (!parent.empty()) routingTable.setParent(uid, parent);
+	}
+
+	//路由更新沿路由树逐层下发, 每个节点只转发给自己的下级路由节点和备用节点
+	JsonObjType sendMsg;
+	sendMsg["family"] = structureManagefamilyStr.c_str();
+	sendMsg["action"] = structMaintainStr.c_str();
+	sendMsg["data"] = datas;
+	ConnectionManager::getInstance()->sendtoChildRouters(sendMsg);
+	if (role == ROLE_ROUTER) {
+		for (auto& standby : standbys)
+			ConnectionManager::getInstance()->sendtoConn(standby, sendMsg);
+	}
+}
+
+void NetStructureManager::updateStandbys(const std::string& router)
+{
+	//子节点中容量与时延最好的backupNum个作为备用节点, 接管后它们就是路由节点; 主节点把路由节点的结构同步给它们
+	std::vector<JsonObjType> candidates;
+	for (auto& child : routerChildren[router])
+		candidates.push_back(memberHosts[child]);
+	std::sort(candidates.begin(), candidates.end(), [this](const JsonObjType& l, const JsonObjType& r) { return routerBefore(l, r); });
+	if (candidates.size() > backupNum) candidates.resize(backupNum);
+
+	auto oldStandbys = routerStandbys[router];
+	std::vector<std::string> newStandbys;
+	JsonAryType standbyAry;
+	for (auto& candidate : candidates) {
+		newStandbys.push_back(candidate["uid"].toString().toStdString());
+		standbyAry.push_back(candidate["uid"]);
+	}
+
+	for (int rank = 0; rank < newStandbys.size(); ++rank) {
+		bool isNew = std::find(oldStandbys.begin(), oldStandbys.end(), newStandbys[rank]) == oldStandbys.end();
+		syncStandby(router, newStandbys[rank], rank, isNew);
+	}
+
+	for (auto& oldStandby : oldStandbys) {
+		if (std::find(newStandbys.begin(), newStandbys.end(), oldStandby) == newStandbys.end()
+			&& memberHosts.count(oldStandby) && !routerParent.count(oldStandby))
+			syncStandby(std::string(), oldStandby, 0, false);
+	}
+
+	if (newStandbys != oldStandbys) {
+		JsonObjType datas;
+		datas["op"] = standbyUpdateOpStr.c_str();
+		datas["dest"] = router.c_str();
+		datas["standbys"] = standbyAry;
+		ConnectionManager::getInstance()->sendActionMsg(TransferMode::Single, structureManagefamilyStr, structMaintainStr, datas);
+	}
+	routerStandbys[router] = newStandbys;
+}
+
+void NetStructureManager::syncStandby(const std::string& router, const std::string& standby, int rank, bool withRoutes)
+{
+	JsonObjType datas;
+	datas["op"] = standbySyncOpStr.c_str();
+	datas["dest"] = standby.c_str();
+	datas["router"] = router.c_str();
+	datas["rank"] = rank;
+
+	//备用节点保存接管所需的全部连接: 上级, 兄弟, 其余子节点和下级路由节点; 路由表只在首次指定时下发, 之后由路由节点转发更新
+	if (!router.empty()) {
+		auto spec = getRouterSpec(router, false);
+		auto parent = routerParent[router];
+		spec["parent"] = parent == localHost["uid"].toString().toStdString() ? localHost : memberHosts[parent];
+
+		JsonAryType children, routers;
+		for (auto& child : routerChildren[router]) {
+			if (child != standby) children.push_back(memberHosts[child]);
+		}
+		for (auto& sub : routerSubs[router])
+			routers.push_back(getRouterSpec(sub, false));
+		spec["children"] = children;
+		spec["routers"] = routers;
+		datas["spec"] = spec;
+		if (withRoutes) datas["routes"] = ConnectionManager::getInstance()->getRoutingTable().toJson();
+	}
+
+	ConnectionManager::getInstance()->sendActionMsg(TransferMode::Single, structureManagefamilyStr, structMaintainStr, datas);
+}
+
+void NetStructureManager::routerTakeover(const std::string& oldRouter, const JsonObjType& host)
+{
+	//备用节点原样接替路由节点的位置: 上级, 同级顺序, 下级路由节点和其余子节点都不变
+	auto uid = host["uid"].toString().toStdString();
+	auto parentIt = routerParent.find(oldRouter);
+	if (parentIt == routerParent.end() || routerParent.count(uid)) return;
+
+	qDebug() << "router take over! old: " << oldRouter.c_str() << " new: " << uid.c_str();
+	auto parent = parentIt->second;
+	routerParent.erase(parentIt);
+	routerParent[uid] = parent;
+	auto& brothers = routerSubs[parent];
+	std::replace(brothers.begin(), brothers.end(), oldRouter, uid);
+
+	auto subs = routerSubs[oldRouter];
+	auto children = routerChildren[oldRouter];
+	children.erase(uid);
+	routerSubs.erase(oldRouter);
+	routerChildren.erase(oldRouter);
+	routerSubs[uid] = subs;
+	routerChildren[uid] = children;
+	routerStandbys[uid] = routerStandbys[oldRouter];
+	routerStandbys.erase(oldRouter);
+	memberHosts.erase(oldRouter);
+	memberHosts[uid] = host;
+
+	publishRoute(oldRouter, std::string());
+	publishRoute(uid, uid, parent);
+	for (auto& sub : subs)
+		publishRoute(sub, sub, uid);
+	for (auto& child : children)
+		publishRoute(child, uid);
+
+	standbyDirty.erase(oldRouter);
+	standbyDirty.insert(uid);
+	if (routerParent.count(parent)) standbyDirty.insert(parent);
+}
+
+void NetStructureManager::takeoverRouter()
+{
+	//排在后面的备用节点晚若干个心跳周期, 前面的备用节点接管后会连接它, 它就不用再接管
+	voteStageTimer.expires_from_now(milliseconds(standbyRank * heartbeatInterval));
+	voteStageTimer.async_wait([this](const boost::system::error_code& err) {
+		if (err == boost::asio::error::operation_aborted || ConnectionManager::getInstance()->hasParent())
+			return;
+
+		auto oldRouter = standbyOf;
+		auto spec = standbySpec;
+		standbyOf.clear();
+		setRole(ROLE_ROUTER);
+		qDebug() << "take over router: " << oldRouter.c_str();
+
+		//上级收到带接管标记的结构消息后通知主节点, 其余连接按保存的结构重新建立
+		auto parent = spec["parent"].toObject();
+		buildInitMsgAndConnectDest(parent, ConnType::CONN_PARENT, JsonAryType(), oldRouter);
+
+		JsonAryType brothers = spec["brothers"].toArray();
+		if (!brothers.isEmpty()) {
+			auto brother = brothers[0].toObject();
+			if (ConnectionManager::getInstance()->findConn(brother["uid"].toString().toStdString()).get() == nullptr)
+				buildInitMsgAndConnectDest(brother, ConnType::CONN_BROTHER);
+		}
+
+		for (auto childObj : spec["children"].toArray())
+			buildInitMsgAndConnectDest(childObj.toObject(), ConnType::CONN_CHILD);
+
+		for (auto routerObj : spec["routers"].toArray())
+			assignRouter(routerObj.toObject(), JsonAryType());
+
+		rejoin();
+	});
+}
+
+void NetStructureManager::startHeartbeat()
+{
+	if (isHeartbeatRunning) return;
+	isHeartbeatRunning = true;
+	heartbeat();
+}
+
+void NetStructureManager::heartbeat()
+{
+	heartbeatTimer.expires_from_now(milliseconds(heartbeatInterval));
+	heartbeatTimer.async_wait([this](const boost::system::error_code& err) {
+		if (err == boost::asio::error::operation_aborted)
+			return;
+
+		JsonObjType sendMsg;
+		sendMsg["family"] = structureManagefamilyStr.c_str();
+		sendMsg["action"] = heartbeatStr.c_str();
+
+		//父子连接上互发心跳, 对方掉电或网线断开时没有断开通知, 超时未收到心跳同样按断开处理
+		auto cm = ConnectionManager::getInstance();
+		auto now = steady_clock::now();
+		for (auto type : { ConnType::CONN_PARENT, ConnType::CONN_CHILD }) {
+			for (auto& id : cm->getConnIds(type)) {
+				auto beatIt = lastBeat.find(id);
+				if (beatIt == lastBeat.end()) {
+					lastBeat[id] = now;
+				}
+				else if (now - beatIt->second > milliseconds(heartbeatTimeout)) {
+					qDebug() << "heartbeat timeout! id: " << id.c_str();
+					auto conn = cm->findConn(id);
+					if (conn.get() != nullptr)
+						boost::asio::post(conn->sock.get_executor(), [conn]() { conn->stop(); });
+					connectionLost(id, type);
+					continue;
+				}
+				cm->sendtoConn(id, sendMsg);
+			}
+		}
+
+		if (role == ROLE_ROUTER)
+			cm->refreshGroupSummary();
+		saveTopology();
+
+		//主节点定期广播选举结果, 网络分区恢复后两个主节点能互相发现并由排序靠后的一方退出
+		if (role == ROLE_MASTER && ++beaconTicks >= masterBeaconTicks) {
+			beaconTicks = 0;
+			announceVote(DiscoveryBeacon::VotedBeacon, localHost["uid"].toString(), 0);
+		}
+
+		//结构变化后合并到下一次心跳时再同步备用节点, 新建的连接也已就绪
+		if (role == ROLE_MASTER) {
+			auto dirtyRouters = std::move(standbyDirty);
+			standbyDirty.clear();
+			for (auto& router : dirtyRouters) {
+				if (routerParent.count(router)) updateStandbys(router);
+			}
+		}
+
+		heartbeat();
+	});
+}
+
+void NetStructureManager::heartbeatHandle(JsonObjType& msg, ConnPtr conn)
+{
+	if (conn.get() == nullptr) return;
+
+	auto id = conn->getID();
+	boost::asio::post(voteStageTimer.get_executor(), [this, id]() {
+		lastBeat[id] = steady_clock::now();
+	});
+}
+
+JsonAryType NetStructureManager::getKnownHosts()
+{
+	JsonAryType hosts;
+	hosts.push_back(localHost);
+	for (auto& host : memberHosts)
+		hosts.push_back(host.second);
+	return hosts;
+}
+
+void NetStructureManager::sendMaintainMsg(const std::string& dest, const StringType& op, const JsonObjType& host, const JsonAryType& hosts)
+{
+	//目标可能在下面几层, 按路由表逐跳转发
+	JsonObjType datas;
+	datas["op"] = op.c_str();
+	datas["host"] = host;
+	datas["dest"] = dest.c_str();
+	if (!hosts.isEmpty()) datas["hosts"] = hosts;
+	ConnectionManager::getInstance()->sendActionMsg(TransferMode::Single, structureManagefamilyStr, structMaintainStr, datas);
+}
+
+void NetStructureManager::connectionLost(const StringType& id, ConnImplType type)
+{
+	boost::asio::post(voteStageTimer.get_executor(), [this, id, type]() {
+		qDebug() << "structure connection lost! id: " << id.c_str() << " type: " << type;
+		lastBeat.erase(id);
+
+		if (role == ROLE_MASTER && type == ConnType::CONN_CHILD) {
+			removeHost(id);
+		}
+		else if (role == ROLE_ROUTER && type == ConnType::CONN_CHILD) {
+			//子节点或下级路由节点离开只需通知主节点更新结构, 其余连接保持不变
+			JsonObjType datas;
+			datas["op"] = hostLeaveOpStr.c_str();
+			datas["uid"] = id.c_str();
+			datas["dest"] = curMaster.c_str();
+			ConnectionManager::getInstance()->sendActionMsg(TransferMode::Single, structureManagefamilyStr, structMaintainStr, datas);
+		}
+		else if (role == ROLE_MEMBER && type == ConnType::CONN_PARENT && id == standbyOf) {
+			takeoverRouter();
+		}
+		else if ((role == ROLE_MEMBER || role == ROLE_ROUTER) && type == ConnType::CONN_PARENT) {
+			rejoin();
+		}
+	});
+}
+
+void NetStructureManager::rejoin(ushort attempt)
+{
+	//父节点失联后等待主节点把自己重新挂到其他路由节点下, 超时仍未恢复时重新向主节点报到
+	//主节点长时间不响应时报到间隔按指数退避, 避免大量掉线节点持续广播
+	int interval = std::min<int>(rejoinTimeout << std::min<ushort>(attempt, 4), maxRejoinInterval);
+	voteStageTimer.expires_from_now(milliseconds(interval + randomRange(randomEngine)));
+	voteStageTimer.async_wait([this, attempt](const boost::system::error_code& err) {
+		if (err == boost::asio::error::operation_aborted || ConnectionManager::getInstance()->hasParent())
+			return;
+
+		announceVote(DiscoveryBeacon::VoteBeacon, curMaster.c_str(), 0);
+		rejoin(attempt + 1);
+	});
+}
+
+void NetStructureManager::yieldStructure(const JsonObjType& master)
+{
+	//退出当前结构: 清掉主节点与路由节点的状态, 等退让消息转发给下级后断开结构连接, 再向新的主节点报到
+	curMaster = master["uid"].toString().toStdString();
+	if (master.contains("epoch")) masterEpoch = (qint64)master["epoch"].toDouble();
+	setRole(ROLE_MEMBER);
+	isStructBuilt = false;
+	memberHosts.clear();
+	routerParent.clear();
+	routerSubs.clear();
+	routerChildren.clear();
+	routerStandbys.clear();
+	standbyDirty.clear();
+	standbys.clear();
+	standbyOf.clear();
+	standbySpec = JsonObjType();
+
+	voteStageTimer.expires_from_now(milliseconds(yieldTeardownDelay));
+	voteStageTimer.async_wait([this](const boost::system::error_code& err) {
+		if (err == boost::asio::error::operation_aborted)
+			return;
+
+		auto cm = ConnectionManager::getInstance();
+		for (auto type : { ConnType::CONN_PARENT, ConnType::CONN_CHILD, ConnType::CONN_BROTHER }) {
+			for (auto& id : cm->getConnIds(type)) {
+				auto conn = cm->findConn(id);
+				if (conn.get() != nullptr)
+					boost::asio::post(conn->sock.get_executor(), [conn]() { conn->stop(); });
+			}
+		}
+		cm->getRoutingTable().clear();
+		lastBeat.clear();
+
+		announceVote(DiscoveryBeacon::VoteBeacon, curMaster.c_str(), 0);
+		rejoin();
+	});
 }
 
 void NetStructureManager::voteRun(JsonObjType& msg, ConnPtr)
 {
     auto uuid = msg["uid"].toString(), propose = msg["propose"].toString();
+	if (uuid == localHost["uid"].toString()) return;
+
     if (propose == localHost["uid"].toString())
 		voteCondition.insert(uuid.toStdString());
+	else
+		voteCondition.erase(uuid.toStdString());
+
+	//重启后直接报到的节点带着上次的纪元和上级, 纪元相同说明上级仍在本主节点的结构中
+	std::string preferRouter;
+	if (msg.contains("epoch") && (qint64)msg["epoch"].toDouble() == masterEpoch)
+		preferRouter = msg["parent"].toString().toStdString();
+
 	msg.remove("propose");
 	msg.remove("stage");
+	msg.remove("family");
+	msg.remove("action");
+	msg.remove("epoch");
+	msg.remove("parent");
+
+	//选举结束后才启动的节点直接告知当前主节点, 由主节点增量挂入现有结构
+	if (role == ROLE_MASTER) {
+		replyVoted(msg);
+		if (isStructBuilt) {
+			attachHost(msg, preferRouter);
+			return;
+		}
+	}
+
 	hostSet.insert(msg);
 }
 
 void NetStructureManager::voteFinished(JsonObjType& msg, ConnPtr)
 {
-	if (role == ROLE_NULL) {
-        setRole(msg["propose"] == localHost["uid"] ? ROLE_MASTER : ROLE_MEMBER);
+	if (msg["propose"] == localHost["uid"]) return;
+
+	//已在结构中的节点只认自己的主节点, 另一分区主节点的广播由本分区主节点处理
+	auto uid = msg["uid"].toString().toStdString();
+	if ((role == ROLE_MEMBER || role == ROLE_ROUTER) && uid != curMaster && ConnectionManager::getInstance()->hasParent())
+		return;
+
+	if (role != ROLE_MASTER) {
+		curMaster = uid;
+		if (msg.contains("epoch")) masterEpoch = (qint64)msg["epoch"].toDouble();
 	}
-	else if (role == ROLE_MEMBER) {
+	if (role == ROLE_NULL) {
+		//之后的结构消息会取消报到; 主节点已分配完结构时靠报到挂入
+		setRole(ROLE_MEMBER);
 		voteStageTimer.cancel();
+		structureReady();
+		rejoin();
+	}
+	else if (role == ROLE_MASTER && hostSet.key_comp()(msg, localHost)) {
+		//同时出现两个主节点时排序靠后的一方退出, 通知自己结构中的节点一起重新向新主节点报到
+		qDebug() << "yield master to: " << msg["uid"].toString();
+		JsonObjType datas;
+		datas["op"] = masterYieldOpStr.c_str();
+		datas["host"] = msg;
+		ConnectionManager::getInstance()->sendActionMsg(TransferMode::Broadcast, structureManagefamilyStr, structMaintainStr, datas);
+		yieldStructure(msg);
+	}
+	else if (role == ROLE_MASTER) {
+		//排序靠后的主节点可能收不到广播, 直接告知它
+		replyVoted(msg);
 	}
 
 	qDebug() << "BECAME ROLE: " << role;
@@ -228,6 +1061,11 @@ void NetStructureManager::voteFinished(JsonObjType& msg, ConnPtr)
 void NetStructureManager::structureInit(JsonObjType& msg, ConnPtr conn)
 {
 	qDebug() << "structureInit";
+	//丢失了选举结果广播的节点以收到的结构消息为准
+	voteStageTimer.cancel();
+	if (role == ROLE_NULL) setRole(ROLE_MEMBER);
+	structureReady();
+
 	if (msg.contains("assignRole") && msg.contains("order")) {
 		setRole(HostRole(msg["assignRole"].toInt()));
 		auto servicePtr = conn->getService().get();
@@ -236,25 +1074,66 @@ void NetStructureManager::structureInit(JsonObjType& msg, ConnPtr conn)
 		qDebug() << "set role and order";
 	}
 	
+	//下级路由节点与上级角色相同, 连接类型由上级在消息中指定
 	auto source = msg["source"].toObject();
-	connLevelup(source, conn);
+	auto linkType = msg.contains("linkType") ? msg["linkType"].toInt() : ConnType::getConnType(role, HostRole(source["role"].toInt()));
+	connLevelup(source, conn, linkType);
+	if (msg.contains("epoch") && linkType == ConnType::CONN_PARENT) masterEpoch = (qint64)msg["epoch"].toDouble();
+
+	if (msg.contains("takeover")) {
+		//原路由节点的备用节点接替了它, 由主节点更新结构
+		auto oldRouter = msg["takeover"].toString().toStdString();
+		if (role == ROLE_MASTER) {
+			boost::asio::post(voteStageTimer.get_executor(), [this, oldRouter, source]() {
+				routerTakeover(oldRouter, source);
+			});
+		}
+		else {
+			JsonObjType datas;
+			datas["op"] = routerTakeoverOpStr.c_str();
+			datas["uid"] = oldRouter.c_str();
+			datas["host"] = source;
+			datas["dest"] = curMaster.c_str();
+			ConnectionManager::getInstance()->sendActionMsg(TransferMode::Single, structureManagefamilyStr, structMaintainStr, datas);
+		}
+	}
+
+	for (auto hostObj : msg["hosts"].toArray())
+		hostSet.insert(hostObj.toObject());
+
+	if (msg.contains("routes"))
+		ConnectionManager::getInstance()->getRoutingTable().fromJson(msg["routes"].toObject());
 
 	if (role == ROLE_ROUTER)
 	{
 		JsonAryType brothers = msg["brothers"].toArray();
-		if (!brothers.isEmpty())
-			buildInitMsgAndConnectDest(brothers[0].toObject(), ConnType::CONN_BROTHER);
+		if (!brothers.isEmpty()) {
+			auto brother = brothers[0].toObject();
+			if (ConnectionManager::getInstance()->findConn(brother["uid"].toString().toStdString()).get() == nullptr)
+				buildInitMsgAndConnectDest(brother, ConnType::CONN_BROTHER);
+		}
 
 		JsonAryType children = msg["children"].toArray();
 		for (auto& childObj : children) {
 			buildInitMsgAndConnectDest(childObj.toObject(), ConnType::CONN_CHILD);
 		}
+
+		//下级路由节点由本节点连接并下发它的结构
+		for (auto routerObj : msg["routers"].toArray())
+			assignRouter(routerObj.toObject(), JsonAryType());
 	}
 
+	startHeartbeat();
 	dumpUserToDB();
 }
 
-void NetStructureManager::dumpUserToDB() 
+void NetStructureManager::structureReady()
+{
+	StartupTimer::getInstance()->mark("networkReady");
+	NetSimulator::getInstance()->markConverged();
+}
+
+void NetStructureManager::dumpUserToDB(bool isInit) 
 {
 	if (!hostSet.empty()) {
 		auto userList = std::make_shared<std::vector<UserInfo>>();
@@ -269,11 +1148,13 @@ void NetStructureManager::dumpUserToDB()
 
 		AdminInfo defaultAdmin(QString("admin"), QString("18782087866"));
 
-		IOContextManager::getInstance()->getIOLoop().post([this, userList, defaultGroup, defaultAdmin]() {
+		IOContextManager::getInstance()->getIOLoop().post([this, userList, defaultGroup, defaultAdmin, isInit]() {
 			auto dbop = DBOP::getInstance();
 			dbop->addUsers(userList);
-			dbop->createUserGroup(defaultGroup);
+			if (isInit) dbop->createUserGroup(defaultGroup);
 			dbop->addMembers(userList, defaultGroup);
+			if (!isInit) return;
+
 			dbop->createAdmin(defaultAdmin);
 			dbop->systemDataInitFinished();
 		});
@@ -281,24 +1162,32 @@ void NetStructureManager::dumpUserToDB()
 	}
 }
 
-void NetStructureManager::connLevelup(JsonObjType & msg, ConnPtr conn)
+void NetStructureManager::connLevelup(JsonObjType & msg, ConnPtr conn, ConnImplType type)
 {
     auto cm = ConnectionManager::getInstance();
 
     cm->unregisterObj(conn->getID());
     auto uuid = msg["uid"].toString().toStdString();
-	auto destRole = msg["role"].toInt();
-    cm->registerObj(uuid, ConnType::getConnType(role, HostRole(destRole)), conn);
+    cm->registerObj(uuid, type, conn);
+	boost::asio::post(voteStageTimer.get_executor(), [this, uuid]() {
+		lastBeat[uuid] = steady_clock::now();
+	});
 
-	qDebug() << "connection level up: " << ConnType::getConnType(role, HostRole(destRole));
+	qDebug() << "connection level up: " << type;
 }
 
-void NetStructureManager::buildInitMsgAndConnectDest(JsonObjType& dest, ConnImplType type)
+void NetStructureManager::buildInitMsgAndConnectDest(JsonObjType& dest, ConnImplType type, const JsonAryType& hosts, const std::string& takeover)
 {
 	JsonObjType sendMsg;
 	sendMsg["family"] = structureManagefamilyStr.c_str();
 	sendMsg["action"] = structInitStr.c_str();
 	sendMsg["source"] = localHost;
+	sendMsg["epoch"] = (double)masterEpoch;
+	if (!hosts.isEmpty()) sendMsg["hosts"] = hosts;
+	if (!takeover.empty()) {
+		sendMsg["takeover"] = takeover.c_str();
+		sendMsg["linkType"] = ConnType::CONN_CHILD;
+	}
 
     auto cm = ConnectionManager::getInstance();
     auto connId = dest["uid"].toString().toStdString();
@@ -316,4 +1205,49 @@ void NetStructureManager::buildInitMsgAndConnectDest(JsonObjType& dest, ConnImpl
 
 void NetStructureManager::structureMaintain(JsonObjType& msg, ConnPtr conn)
 {
+	auto datas = msg["data"].toObject();
+	boost::asio::post(voteStageTimer.get_executor(), [this, datas]() mutable {
+		auto op = datas["op"].toString().toStdString();
+		auto host = datas["host"].toObject();
+
+		if (op == attachChildOpStr && role == ROLE_ROUTER) {
+			buildInitMsgAndConnectDest(host, ConnType::CONN_CHILD, datas["hosts"].toArray());
+		}
+		else if (op == brotherUpdateOpStr && role == ROLE_ROUTER) {
+			if (ConnectionManager::getInstance()->findConn(host["uid"].toString().toStdString()).get() == nullptr)
+				buildInitMsgAndConnectDest(host, ConnType::CONN_BROTHER);
+		}
+		else if (op == attachRouterOpStr && role == ROLE_ROUTER) {
+			assignRouter(host, datas["hosts"].toArray());
+		}
+		else if (op == routeUpdateOpStr && (role == ROLE_ROUTER || !standbyOf.empty())) {
+			applyRouteUpdate(datas);
+		}
+		else if (op == standbyUpdateOpStr && role == ROLE_ROUTER) {
+			standbys.clear();
+			for (auto standby : datas["standbys"].toArray())
+				standbys.push_back(standby.toString().toStdString());
+		}
+		else if (op == standbySyncOpStr && role == ROLE_MEMBER) {
+			standbyOf = datas["router"].toString().toStdString();
+			standbyRank = datas["rank"].toInt();
+			standbySpec = datas["spec"].toObject();
+			if (datas.contains("routes"))
+				ConnectionManager::getInstance()->getRoutingTable().fromJson(datas["routes"].toObject());
+		}
+		else if (op == routerTakeoverOpStr && role == ROLE_MASTER) {
+			routerTakeover(datas["uid"].toString().toStdString(), host);
+		}
+		else if (op == hostLeaveOpStr && role == ROLE_MASTER) {
+			removeHost(datas["uid"].toString().toStdString());
+		}
+		else if (op == masterYieldOpStr && role != ROLE_MASTER) {
+			yieldStructure(host);
+		}
+		else if (op == hostJoinOpStr) {
+			if (host["uid"] == localHost["uid"]) return;
+			hostSet.insert(host);
+			dumpUserToDB(false);
+		}
+	});
 }
@@ -4,8 +4,11 @@
 #include "Common.h"
 #include "MsgParser.h"
 
+#include <chrono>
+#include <map>
 #include <random>
 #include <set>
+#include <vector>
 
 class NetStructureManager: public boost::noncopyable, public MsgActionParser
 {
@@ -20,34 +23,95 @@ public:
 	QString getCurAdmin()const { return curAdmin; };
 	void setAdmin(const QString& newIsAdmin) { curAdmin = newIsAdmin; }
 
+	void warmStart();
 	void buildNetStructure(int stage);
+	void setTreeFanout(ushort newRouterFanout, ushort newMemberFanout);
+	void connectionLost(const StringType& id, ConnImplType type);
 private:
 	NetStructureManager(io_context& context);
 	
 	void initHost();
 	void becomeMaster(ushort repeatCounter);
+	void replyVoted(const JsonObjType& dest);
+	void announceVote(quint8 type, const QString& propose, int stage);
+	void beaconHandle(const RecvBufferType& packet);
+	void probeHosts();
+	void probeHost(const JsonObjType& host);
+	double getRtt(const JsonObjType& host);
+	bool routerBefore(const JsonObjType& l, const JsonObjType& r);
+	void probeHandle(JsonObjType& msg, ConnPtr);
+	void probeAckHandle(JsonObjType& msg, ConnPtr);
 	void hostRoleAssignment();
+	JsonObjType getRouterSpec(const std::string& router, bool withSubtree);
+	std::string findRouterSlot();
+	void assignRouter(const JsonObjType& spec, const JsonAryType& hosts);
+	void reattachRouter(const std::string& router);
+	void attachHost(const JsonObjType& host, const std::string& preferRouter = std::string());
+	void removeHost(const std::string& uid);
+	void publishRoute(const std::string& uid, const std::string& router, const std::string& parent = std::string());
+	void applyRouteUpdate(const JsonObjType& datas);
+	void updateStandbys(const std::string& router);
+	void syncStandby(const std::string& router, const std::string& standby, int rank, bool withRoutes);
+	void routerTakeover(const std::string& oldRouter, const JsonObjType& host);
+	void takeoverRouter();
+	void startHeartbeat();
+	void heartbeat();
+	void heartbeatHandle(JsonObjType& msg, ConnPtr conn);
+	JsonAryType getKnownHosts();
+	void sendMaintainMsg(const std::string& dest, const StringType& op, const JsonObjType& host, const JsonAryType& hosts = JsonAryType());
+	void rejoin(ushort attempt = 0);
+	void yieldStructure(const JsonObjType& master);
 
 	void voteRun(JsonObjType& msg, ConnPtr);
 	void voteFinished(JsonObjType& msg, ConnPtr);
 	void structureInit(JsonObjType& msg, ConnPtr conn);
 	void structureMaintain(JsonObjType& msg, ConnPtr conn);
 
-	void connLevelup(JsonObjType& msg, ConnPtr conn);
-	void buildInitMsgAndConnectDest(JsonObjType& dest, ConnImplType type);
-	void dumpUserToDB();
+	void connLevelup(JsonObjType& msg, ConnPtr conn, ConnImplType type);
+	void buildInitMsgAndConnectDest(JsonObjType& dest, ConnImplType type, const JsonAryType& hosts = JsonAryType(), const std::string& takeover = std::string());
+	void dumpUserToDB(bool isInit = true);
+	void saveTopology();
+	void structureReady();
 
 	void setRole(HostRole newRole) { role = newRole; localHost["role"] = newRole; }
 
 	boost::asio::steady_timer voteStageTimer;
+	boost::asio::steady_timer heartbeatTimer;
 	std::default_random_engine randomEngine;
 	std::uniform_int_distribution<unsigned> randomRange;
 
 	QString curAdmin;
 	HostRole role;
 	JsonObjType localHost;
+	size_t lastHostNum;
+	qint64 masterEpoch;
+	JsonObjType lastSnapshot;
+	QString lastPropose;
+	size_t lastAnnounceNum;
+	ushort announceGap, quietStages;
+	bool isStructBuilt;
+	bool isHeartbeatRunning;
+	ushort beaconTicks;
+	ushort routerFanout, memberFanout;
+	std::string curMaster;
 	std::set<JsonObjType, std::function<bool (const JsonObjType& , const JsonObjType&)>> hostSet;
 	std::set<std::string> voteCondition;
+	std::map<std::string, double> hostRtt;
+	std::map<std::string, std::chrono::steady_clock::time_point> lastBeat;
+
+	//路由节点: 自己的备用节点; 备用节点: 所备份的路由节点, 接管顺序以及接管所需的结构
+	std::vector<std::string> standbys;
+	std::string standbyOf;
+	int standbyRank;
+	JsonObjType standbySpec;
+
+	//主节点维护的结构: 除主节点外的所有节点, 各路由节点的上级, 每个节点按顺序排列的下级路由节点(同级组成兄弟环), 各路由节点的子节点
+	std::map<std::string, JsonObjType> memberHosts;
+	std::map<std::string, std::string> routerParent;
+	std::map<std::string, std::vector<std::string>> routerSubs;
+	std::map<std::string, std::set<std::string>> routerChildren;
+	std::map<std::string, std::vector<std::string>> routerStandbys;
+	std::set<std::string> standbyDirty;
 };
 
 #endif
@@ -0,0 +1,85 @@
+﻿#include "RelayFeed.h"
+
+RelayFeed::RelayFeed(const QString & filePath)
+	: filePath(filePath), availLen(0), isEnd(false), isError(false), isReleased(false), nextId(0)
+{
+}
+
+qint64 RelayFeed::getAvailLen(bool & isEnd, bool & isError)
+{
+	QMutexLocker lock(&mutex);
+	isEnd = this->isEnd;
+	isError = this->isError;
+	return availLen;
+}
+
+void RelayFeed::setAvailLen(qint64 len)
+{
+	QMutexLocker lock(&mutex);
+	if (len <= availLen) return;
+
+	availLen = len;
+	notifyAll();
+}
+
+void RelayFeed::finish()
+{
+	QMutexLocker lock(&mutex);
+	isEnd = true;
+	notifyAll();
+	tryRelease();
+}
+
+void RelayFeed::fail()
+{
+	QMutexLocker lock(&mutex);
+	isEnd = isError = true;
+	notifyAll();
+	tryRelease();
+}
+
+int RelayFeed::reserve()
+{
+	//转发方建立连接之前先占位, 避免文件在连接建立前收完就被改名
+	QMutexLocker lock(&mutex);
+	int id = nextId++;
+	subscribers[id] = Subscriber();
+	return id;
+}
+
+void RelayFeed::subscribe(int id, tcp::socket::executor_type executor, NotifyHandler && handler)
+{
+	QMutexLocker lock(&mutex);
+	if (subscribers.find(id) == subscribers.end()) return;
+	subscribers[id] = { std::make_shared<tcp::socket::executor_type>(executor), handler };
+}
+
+void RelayFeed::unsubscribe(int id)
+{
+	QMutexLocker lock(&mutex);
+	subscribers.erase(id);
+	tryRelease();
+}
+
+void RelayFeed::setReleaseHandler(ReleaseHandler && handler)
+{
+	QMutexLocker lock(&mutex);
+	releaseHandler = handler;
+}
+
+void RelayFeed::notifyAll()
+{
+	for (auto& subscriber : subscribers) {
+		if (subscriber.second.executor.get() != nullptr)
+			boost::asio::post(*subscriber.second.executor, subscriber.second.handler);
+	}
+}
+
+void RelayFeed::tryRelease()
+{
+	//文件写完且所有转发方都已关闭文件后才能改名或删除
+	if (!isEnd || !subscribers.empty() || isReleased) return;
+
+	isReleased = true;
+	if (releaseHandler) releaseHandler(!isError);
+}
@@ -0,0 +1,52 @@
+﻿#ifndef RELAYFEED_H
+#define RELAYFEED_H
+
+#include "Common.h"
+
+#include "QtCore\qmutex.h"
+
+#include <map>
+
+//直通转发: 接收方每写入并校验一段数据就更新可读长度, 转发到下一跳的发送方随之读取,
+//不必等整个文件收完. 接收与转发的连接可能在不同的线程, 状态由互斥量保护
+class RelayFeed : public boost::noncopyable
+{
+public:
+	typedef std::function<void()> NotifyHandler;
+	typedef std::function<void(bool)> ReleaseHandler;
+
+	RelayFeed(const QString& filePath);
+
+	QString getFilePath()const { return filePath; }
+	qint64 getAvailLen(bool& isEnd, bool& isError);
+
+	void setAvailLen(qint64 len);
+	void finish();
+	void fail();
+
+	int reserve();
+	void subscribe(int id, tcp::socket::executor_type executor, NotifyHandler&& handler);
+	void unsubscribe(int id);
+	void setReleaseHandler(ReleaseHandler&& handler);
+
+private:
+	struct Subscriber {
+		std::shared_ptr<tcp::socket::executor_type> executor;
+		NotifyHandler handler;
+	};
+
+	void notifyAll();
+	void tryRelease();
+
+	QMutex mutex;
+	QString filePath;
+	qint64 availLen;
+	bool isEnd, isError, isReleased;
+	int nextId;
+	std::map<int, Subscriber> subscribers;
+	ReleaseHandler releaseHandler;
+};
+
+typedef std::shared_ptr<RelayFeed> RelayFeedPtr;
+
+#endif // !RELAYFEED_H
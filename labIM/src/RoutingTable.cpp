@@ -0,0 +1,75 @@
+﻿#include "RoutingTable.h"
+
+void RoutingTable::setOwner(const std::string & uid, const std::string & router)
+{
+	QWriteLocker locker(&lock);
+	ownerMap[uid] = router;
+}
+
+void RoutingTable::setParent(const std::string & router, const std::string & parent)
+{
+	QWriteLocker locker(&lock);
+	parentMap[router] = parent;
+}
+
+void RoutingTable::removeHost(const std::string & uid)
+{
+	QWriteLocker locker(&lock);
+	ownerMap.erase(uid);
+	parentMap.erase(uid);
+}
+
+void RoutingTable::clear()
+{
+	QWriteLocker locker(&lock);
+	ownerMap.clear();
+	parentMap.clear();
+}
+
+std::string RoutingTable::getOwner(const std::string & uid)
+{
+	QReadLocker locker(&lock);
+	auto it = ownerMap.find(uid);
+	return it == ownerMap.end() ? std::string() : it->second;
+}
+
+std::string RoutingTable::getParent(const std::string & router)
+{
+	QReadLocker locker(&lock);
+	auto it = parentMap.find(router);
+	return it == parentMap.end() ? std::string() : it->second;
+}
+
+std::set<std::string> RoutingTable::getRouters()
+{
+	QReadLocker locker(&lock);
+	std::set<std::string> routers;
+	for (auto& route : ownerMap)
+		routers.insert(route.second);
+	return routers;
+}
+
+JsonObjType RoutingTable::toJson()
+{
+	QReadLocker locker(&lock);
+	JsonObjType owners, parents;
+	for (auto& route : ownerMap)
+		owners[route.first.c_str()] = route.second.c_str();
+	for (auto& route : parentMap)
+		parents[route.first.c_str()] = route.second.c_str();
+
+	JsonObjType routes;
+	routes["owners"] = owners;
+	routes["parents"] = parents;
+	return routes;
+}
+
+void RoutingTable::fromJson(const JsonObjType & routes)
+{
+	QWriteLocker locker(&lock);
+	auto owners = routes["owners"].toObject(), parents = routes["parents"].toObject();
+	for (auto it = owners.begin(); it != owners.end(); ++it)
+		ownerMap[it.key().toStdString()] = it.value().toString().toStdString();
+	for (auto it = parents.begin(); it != parents.end(); ++it)
+		parentMap[it.key().toStdString()] = it.value().toString().toStdString();
+}
@@ -0,0 +1,33 @@
+﻿#ifndef ROUTINGTABLE_H
+#define ROUTINGTABLE_H
+
+#include "Common.h"
+
+#include "QtCore\qreadwritelock.h"
+
+#include <set>
+#include <unordered_map>
+
+//路由表: 记录每个节点挂在哪个路由节点下(路由节点记录为自身)以及每个路由节点的上级, 由主节点分配结构时下发并增量更新
+//下一跳: 直连的节点直接发送, 否则沿目标所属路由节点的上级链向上找到直连的子节点或兄弟节点, 都没有时交给父节点
+class RoutingTable : public boost::noncopyable
+{
+public:
+	void setOwner(const std::string& uid, const std::string& router);
+	void setParent(const std::string& router, const std::string& parent);
+	void removeHost(const std::string& uid);
+	void clear();
+
+	std::string getOwner(const std::string& uid);
+	std::string getParent(const std::string& router);
+	std::set<std::string> getRouters();
+	JsonObjType toJson();
+	void fromJson(const JsonObjType& routes);
+
+private:
+	QReadWriteLock lock;
+	std::unordered_map<std::string, std::string> ownerMap;
+	std::unordered_map<std::string, std::string> parentMap;
+};
+
+#endif // !ROUTINGTABLE_H
@@ -6,11 +6,13 @@
 #include "DataModel.h"
 #include "NetStructureManager.h"
 #include "SharedFileManager.h"
+#include "NetSimulator.h"
 
 #include "QtCore\qfile.h"
 #include "QtCore\qfileinfo.h"
 #include "QtCore\qurl.h"
 #include "QtCore\qthread.h"
+#include "QtCore\qendian.h"
 
 const QString netStructureServiceStr("NetStructureService");
 const QString picTransferServiceStr("PicTransferService");
@@ -20,6 +22,8 @@ const QString fileSendServiceStr("FileSendService");
 const QString taskPauseStr("TaskPause");
 const QString taskStopStr("TaskStop");
 const QString taskRestartStr("TaskRestart");
+const int msgHeadLen = 4;
+const quint32 maxMsgLen = 16 * 1024 * 1024;
 
 ServicePtr Service::getServicePtr(const QString & name, JsonObjType & params)
 {
@@ -46,7 +50,7 @@ ServicePtr Service::getServicePtr(const QString & name, JsonObjType & params)
 }
 
 Service::Service()
-    : readBuff(BUF_SIZE, '\0')
+    : readBuff(BUF_SIZE, '\0'), relayId(-1), isReadEnd(false), isWriting(false), isMsgWriting(false), isExecuteWaiting(false)
 {
 }
 
@@ -68,18 +72,34 @@ void Service::dataHandle()
             return;
         }
 
-        auto rawMsg = readBuff.length() == readBytes ? readBuff : readBuff.left(readBytes);
-        char* dataPtr = rawMsg.data();
-        short msgLen = 0;
-        memcpy(&msgLen, dataPtr, 2);
-        auto serviceInfor = JsonDocType::fromJson(QByteArray(dataPtr + 2, msgLen)).object();
+        //服务头可能超过一次读取的长度(如带缩略图的图片参数), 收齐后再创建服务
+        readRemain.append(readBuff.constData(), readBytes);
+        if (readRemain.length() < msgHeadLen) {
+            dataHandle();
+            return;
+        }
+
+        //长度头不可信, 超过上限时直接断开, 不再无限制地缓存
+        quint32 msgLen = qFromLittleEndian<quint32>((const uchar*)readRemain.constData());
+        if (msgLen > maxMsgLen) {
+            qDebug() << "service head too long! len: " << msgLen;
+            conn->stop();
+            return;
+        }
+        if ((qint64)readRemain.length() < (qint64)msgLen + msgHeadLen) {
+            dataHandle();
+            return;
+        }
+
+        auto serviceInfor = JsonDocType::fromJson(readRemain.mid(msgHeadLen, msgLen)).object();
         auto newServicePtr = getServicePtr(serviceInfor["serviceName"].toString(), serviceInfor["serviceParam"].toObject());
 		auto oldService = conn->getService(); //extend the object life time
+        auto remain = readRemain.mid(msgLen + msgHeadLen);
+        readRemain.clear();
         conn->setService(newServicePtr);
 
-        int remainBytes = readBytes - msgLen - 2;
-        if (remainBytes > 0) {
-            newServicePtr->setRemain(readBuff.right(remainBytes));
+        if (!remain.isEmpty()) {
+            newServicePtr->setRemain(remain);
         }
     });
 }
@@ -89,19 +109,61 @@ void Service::sendData(JsonObjType rawData)
     JsonDocType doc(rawData);
     auto sendData = std::make_shared<SendBufferType>(doc.toJson(JSON_FORMAT).data());
 
-    ////此处应该记录日志
-    //if (msg->length() + 2 > BUF_SIZE) return;
+    //超过上限的消息对端会直接断开连接, 不发送
+    if ((quint32)sendData->length() > maxMsgLen) {
+        qDebug() << "tcp msg too long! len: " << sendData->length();
+        return;
+    }
 
-    auto msgLen = (short)sendData->length();
-    char mlenBytes[2]{ '\0' };
-    memcpy(mlenBytes, &msgLen, 2);
-    sendData->insert(0, mlenBytes, 2);
+    //长度头为4字节, 上千节点的路由表与节点列表也能放进一条结构消息
+    char mlenBytes[msgHeadLen]{ '\0' };
+    qToLittleEndian<quint32>(sendData->length(), (uchar*)mlenBytes);
+    sendData->insert(0, mlenBytes, msgHeadLen);
 
-    conn->sock.async_send(boost::asio::buffer(sendData->data(), sendData->size()), [this, sendData](const boost::system::error_code& ec, std::size_t writeBytes) {
-        qDebug() << "TCP SEND  len: " << writeBytes << " data: " << sendData->left(writeBytes);
+    //一次async_send可能只发出一部分, 多个线程同时发送还会交错; 在连接的IO线程上排队, 逐条完整写出
+    boost::asio::dispatch(conn->sock.get_executor(), [this, sendData]() {
+        msgQueue.push_back(sendData);
+        if (!isWriting && !isMsgWriting) writeNextMsg();
     });
 }
 
+void Service::writeNextMsg()
+{
+	if (msgQueue.empty()) {
+		if (isExecuteWaiting) {
+			isExecuteWaiting = false;
+			execute();
+		}
+		return;
+	}
+
+	auto msg = msgQueue.front();
+	isMsgWriting = true;
+	boost::asio::async_write(conn->sock, boost::asio::buffer(msg->data(), msg->size()), [this, msg](const boost::system::error_code& ec, std::size_t writeBytes) {
+		isMsgWriting = false;
+		qDebug() << "TCP SEND  len: " << writeBytes << " data: " << msg->left(writeBytes);
+		if (ec != 0) {
+			qDebug() << "tcp msg send failed! error: " << ec;
+			msgQueue.clear();
+			isExecuteWaiting = false;
+			return;
+		}
+
+		msgQueue.pop_front();
+		writeNextMsg();
+	});
+}
+
+bool Service::waitMsgWrite()
+{
+	//数据块与消息不能在同一个socket上交错, 有排队的消息时先写完消息再继续发数据
+	if (msgQueue.empty()) return false;
+
+	isExecuteWaiting = true;
+	if (!isMsgWriting) writeNextMsg();
+	return true;
+}
+
 void Service::execute()
 {
 }
@@ -116,43 +178,175 @@ void Service::restore()
 
 void Service::stop()
 {
+	releaseRelay();
 }
 
-int Service::getProgress()
+void Service::trackProgress(const QString & tid, qint64 totalLen)
 {
-	return 0;
+	progress = TaskManager::getInstance()->trackTaskProgress(tid, totalLen);
+}
+
+void Service::updateProgress(qint64 doneLen)
+{
+	if (progress.get() != nullptr) progress->doneLen.store(doneLen, std::memory_order_relaxed);
+}
+
+QVariantHash Service::getTransferInfo()
+{
+	QVariantHash info;
+	info["chunkSize"] = tuner.getChunkSize();
+	info["inflightNum"] = tuner.getInflightNum();
+	info["recvBuffSize"] = tuner.getRecvBuffSize();
+	info["throughput"] = tuner.getThroughput();
+	info["rtt"] = tuner.getRttMs();
+	info["diskLatency"] = tuner.getDiskMs();
+	if (compressor.getEnable()) {
+		info["compressRatio"] = compressor.getRatio();
+		info["compressCpu"] = compressor.getCpuMs();
+	}
+	return info;
+}
+
+int Service::readAhead(QFile & file)
+{
+	//压缩时预读深度至少覆盖工作线程数, 保证压缩并行进行
+	int readDepth = tuner.getInflightNum();
+	if (compressor.getEnable())
+		readDepth = std::max(readDepth, IOContextManager::getInstance()->getWorkerNum() + 1);
+
+	int readNum = 0;
+	while (!isReadEnd && (int)sendQueue.size() < readDepth) {
+		int chunkSize = tuner.getChunkSize();
+		if (relayFeed.get() != nullptr) {
+			//直通转发时只读取上一跳已经收到并写入的部分
+			bool isFeedEnd = false, isFeedError = false;
+			qint64 availLen = relayFeed->getAvailLen(isFeedEnd, isFeedError) - file.pos();
+			if (isFeedError) return -1;
+			if (availLen <= 0 && !isFeedEnd) break;
+			if (availLen > 0) chunkSize = (int)std::min<qint64>(chunkSize, availLen);
+		}
+
+		auto chunk = std::make_shared<SendBufferType>(chunkSize, '\0');
+		auto readStart = TransferTuner::Clock::now();
+		int readBytes = file.read(chunk->data(), chunk->size());
+		if (readBytes < 0) return -1;
+		if (readBytes == 0) {
+			isReadEnd = true;
+			chunk->clear();
+			encodeChunk(chunk, true);
+			if (!chunk->isEmpty()) sendQueue.push_back(chunk);
+			break;
+		}
+
+		tuner.diskRead(readBytes, std::chrono::duration_cast<TransferTuner::Duration>(TransferTuner::Clock::now() - readStart));
+		chunk->resize(readBytes);
+		encodeChunk(chunk, false);
+		if (!chunk->isEmpty()) sendQueue.push_back(chunk);
+		++readNum;
+	}
+
+	return readNum;
+}
+
+void Service::encodeChunk(SendBufferPtr chunk, bool)
+{
+	if (!compressor.getEnable() || chunk->isEmpty()) return;
+
+	if (!compressor.shouldCompress()) {
+		compressor.packRaw(*chunk);
+		return;
+	}
+
+	//压缩在工作线程池中进行, 完成后回到连接所在线程继续发送
+	encodingChunks.insert(chunk.get());
+	auto self = conn;
+	boost::asio::post(IOContextManager::getInstance()->getWorkLoop(), [this, self, chunk]() {
+		auto packStart = TransferTuner::Clock::now();
+		auto frame = std::make_shared<SendBufferType>(StreamCompressor::pack(*chunk));
+		auto cost = std::chrono::duration_cast<TransferTuner::Duration>(TransferTuner::Clock::now() - packStart);
+
+		boost::asio::post(self->sock.get_executor(), [this, self, chunk, frame, cost]() {
+			compressor.chunkPacked(chunk->size(), frame->size(), cost);
+			*chunk = *frame;
+			encodingChunks.erase(chunk.get());
+			if (self->sock.is_open()) execute();
+		});
+	});
 }
 
-void Service::msgHandleLoop(size_t readBytes, RecvBufferType & readBuff, RecvBufferType & readRemain, ConnPtr conn, std::function<void(JsonObjType&)>&& handler)
+void Service::setRelay(RelayFeedPtr feed)
+{
+	relayFeed = feed;
+	relayId = feed->reserve();
+}
+
+void Service::subscribeRelay()
+{
+	if (relayFeed.get() == nullptr || relayId < 0) return;
+
+	auto self = conn;
+	relayFeed->subscribe(relayId, conn->sock.get_executor(), [this, self]() {
+		if (self->sock.is_open()) execute();
+	});
+}
+
+void Service::releaseRelay()
+{
+	if (relayFeed.get() == nullptr || relayId < 0) return;
+
+	relayFeed->unsubscribe(relayId);
+	relayId = -1;
+}
+
+int Service::decodeChunk(RecvBufferType & data)
+{
+	if (!compressor.getEnable()) return 0;
+	return compressor.unpack(data);
+}
+
+int Service::chunkRawLen(const SendBufferType & chunk, int writeBytes) const
+{
+	return compressor.getEnable() ? StreamCompressor::frameRawLen(chunk) : writeBytes;
+}
+
+int Service::msgHandleLoop(size_t readBytes, RecvBufferType & readBuff, RecvBufferType & readRemain, ConnPtr conn, std::function<void(JsonObjType&)>&& handler)
 {
 	auto rawMsg = readRemain + (readBuff.length() == readBytes ? readBuff : readBuff.left(readBytes));
 	char* dataPtr = rawMsg.data();
-	short handleDataLen = 0, msgLen = 0, allDataLen = rawMsg.length();
+	int handleDataLen = 0, allDataLen = rawMsg.length();
+	quint32 msgLen = 0;
 
 	qDebug() << "TCP RECV  len: " << readRemain.length() + readBytes << " data: " << rawMsg.left(readRemain.length() + readBytes);
 
 	do
 	{
-		if (allDataLen - handleDataLen < 2) break;
+		if (allDataLen - handleDataLen < msgHeadLen) break;
 
-		memcpy(&msgLen, dataPtr, 2);
+		msgLen = qFromLittleEndian<quint32>((const uchar*)dataPtr);
+		if (msgLen > maxMsgLen) {
+			qDebug() << "tcp msg too long! len: " << msgLen;
+			readRemain.clear();
+			return -1;
+		}
 
-		if (allDataLen - handleDataLen < msgLen + 2) break;
+		if ((qint64)allDataLen - handleDataLen < (qint64)msgLen + msgHeadLen) break;
 
-		auto msg = JsonDocType::fromJson(QByteArray(dataPtr + 2, msgLen)).object();
+		auto msg = JsonDocType::fromJson(QByteArray(dataPtr + msgHeadLen, msgLen)).object();
 		handler(msg);
 
-		dataPtr += msgLen + 2;
-		handleDataLen += msgLen + 2;
+		dataPtr += msgLen + msgHeadLen;
+		handleDataLen += msgLen + msgHeadLen;
 
 	} while (allDataLen != handleDataLen);
 
-	if (allDataLen == handleDataLen || allDataLen - handleDataLen > BUF_SIZE) {
+	//未收完的消息拷贝保留到下次读取, 携带路由表等较长的结构消息会跨越多次读取
+	if (allDataLen == handleDataLen) {
 		readRemain.clear();
 	}
 	else {
-		readRemain.setRawData(dataPtr, allDataLen - handleDataLen);
+		readRemain = QByteArray(dataPtr, allDataLen - handleDataLen);
 	}
+	return 0;
 }
 
 NetStructureService::NetStructureService()
@@ -177,13 +371,21 @@ void NetStructureService::dataHandle()
     conn->sock.async_receive(boost::asio::buffer(readBuff.data(), readBuff.size()), [this](const boost::system::error_code& ec, std::size_t readBytes) {
         if (ec != 0) {
             qDebug() << "tcp connect error: " << ec;
+			if (ec != boost::asio::error::operation_aborted)
+				NetStructureManager::getInstance()->connectionLost(conn->getID(), conn->getParent()->getConnType(conn->getID()));
             conn->stop();
             return;
         }
 
-		msgHandleLoop(readBytes, readBuff, readRemain, conn, [this](JsonObjType& msg) {
+		int result = msgHandleLoop(readBytes, readBuff, readRemain, conn, [this](JsonObjType& msg) {
+			NetSimulator::getInstance()->countRecv(msg["action"].toString());
 			conn->getParent()->familyParse(msg, conn);
 		});
+		if (result != 0) {
+			NetStructureManager::getInstance()->connectionLost(conn->getID(), conn->getParent()->getConnType(conn->getID()));
+			conn->stop();
+			return;
+		}
 
         dataHandle();
     });
@@ -191,14 +393,13 @@ void NetStructureService::dataHandle()
 
 //Picture Transfer Service
 PicTransferService::PicTransferService(const QString& fileName, JsonObjType& taskParam)
-    : writeBuff(1024*512, '\0'), isInit(false), fileName(fileName), isSender(true), taskParam(taskParam)
+    : isInit(false), fileName(fileName), isSender(true), hasThumb(false), taskParam(taskParam)
 {
 }
 
 PicTransferService::PicTransferService(JsonObjType& taskParam)
-    : isInit(false), fileSize(0), recvFileLen(0), isSender(false), taskParam(taskParam)
+    : isInit(false), fileSize(0), recvFileLen(0), isSender(false), hasThumb(false), taskParam(taskParam)
 {
-    readBuff.resize(1024*512);
 }
 
 PicTransferService::~PicTransferService()
@@ -213,21 +414,48 @@ void PicTransferService::start()
 		serviceInfor["serviceName"] = picTransferServiceStr;
 		serviceInfor["serviceParam"] = taskParam;
 		Service::sendData(serviceInfor);
+		subscribeRelay();
 		execute();
 	}
-	else { dataHandle(); }
+	else {
+		showThumb();
+		dataHandle();
+	}
+}
+
+void PicTransferService::showThumb()
+{
+	//带缩略图的图片消息先以缩略图入库显示, 原图收完后再替换消息内容
+	auto thumbData = QByteArray::fromBase64(taskParam["picThumb"].toString().toLatin1());
+	if (thumbData.isEmpty()) return;
+
+	QString thumbName = tmpDir.c_str() + QString("thumb_") + taskParam["picStoreName"].toString() + ".jpg";
+	QFile thumbFile(thumbName);
+	if (!thumbFile.open(QFile::WriteOnly) || thumbFile.write(thumbData) != thumbData.size()) {
+		qDebug() << "write thumbnail failed! filename: " << thumbName;
+		return;
+	}
+	thumbFile.close();
+
+	MessageInfo msgInfo(taskParam["msgId"].toString(), taskParam["msgSource"].toString(), taskParam["msgDest"].toString(), taskParam["msgType"].toInt(),
+		QUrl::fromLocalFile(thumbName).toString(), taskParam["msgDate"].toString(), taskParam["msgMode"].toInt());
+	hasThumb = SessionManager::getInstance()->createMessage(msgInfo, false) == 0;
 }
 
 void PicTransferService::dataHandle()
 {
+    readBuff.resize(tuner.getRecvBuffSize());
     conn->sock.async_receive(boost::asio::buffer(readBuff.data(), readBuff.size()), [this](const boost::system::error_code& ec, std::size_t readBytes) {
         if (ec != 0) {
             qDebug() << "PicTransferService tcp connect error: " << ec;
 			if (picFile.isOpen()) picFile.close();
+			if (forwardFeed.get() != nullptr) forwardFeed->fail();
             conn->stop();
             return;
         }
 
+        tuner.chunkRecv(readBytes);
+
         auto rawMsg = readBuff.length() == readBytes ? readBuff : readBuff.left(readBytes);
         if (!readRemain.isEmpty()) {
             rawMsg.push_front(readRemain);
@@ -244,6 +472,13 @@ void PicTransferService::dataHandle()
 				return;
 			}
             isInit = true;
+
+			//群图片边收边转发给下一跳
+			if (taskParam["msgMode"].toInt() == (int)SessionType::GroupSession) {
+				forwardFeed = std::make_shared<RelayFeed>(fileName);
+				taskParam["picRealName"] = fileName;
+				ConnectionManager::getInstance()->uploadPicMsgToCommonSpace(taskParam["msgDest"].toString(), taskParam.toVariantHash(), true, forwardFeed);
+			}
         }
 
 		//qDebug() << "recv file recv executing! filename: " << fileName << " recvBytes: " << readBytes;
@@ -252,26 +487,33 @@ void PicTransferService::dataHandle()
 		if (writeBytes == -1) {
 			qDebug() << "recv picture write failed! filename: " << fileName << " errorCode: " << ec;
 			picFile.close();
+			if (forwardFeed.get() != nullptr) forwardFeed->fail();
 			conn->stop();
 			return;
 		}
 
 		//qDebug() << "recv file write executing! filename: " << fileName << " writeBytes: " << writeBytes;
 		recvFileLen += writeBytes;
+		if (forwardFeed.get() != nullptr) {
+			picFile.flush();
+			forwardFeed->setAvailLen(recvFileLen);
+		}
+
 		if (recvFileLen >= fileSize) {
 			qDebug() << "recv picture recv finished! filename: " << fileName;
 			picFile.close();
+			if (forwardFeed.get() != nullptr) forwardFeed->finish();
 			conn->stop();
 
 			QUrl fileUrl = QUrl::fromLocalFile(tmpDir.c_str() + taskParam["picStoreName"].toString());
+			if (hasThumb) {
+				SessionManager::getInstance()->updateMessageData(taskParam["msgId"].toString(), fileUrl.toString());
+				return;
+			}
+
 			MessageInfo msgInfo(taskParam["msgId"].toString(), taskParam["msgSource"].toString(), taskParam["msgDest"].toString(), taskParam["msgType"].toInt(),
 				fileUrl.toString(), taskParam["msgDate"].toString(), taskParam["msgMode"].toInt());
 			SessionManager::getInstance()->createMessage(msgInfo, false);
-			
-			if (msgInfo.mmode == (int)SessionType::GroupSession) {
-				taskParam["picRealName"] = tmpDir.c_str() + taskParam["picStoreName"].toString();
-				ConnectionManager::getInstance()->uploadPicMsgToCommonSpace(msgInfo.mduuid, taskParam.toVariantHash(), true);
-			}
 			return;
 		}
 
@@ -283,7 +525,7 @@ void PicTransferService::execute()
 {
     if (!isInit) {
 		picFile.setFileName(fileName);
-        if (!picFile.open(QFile::ReadOnly) ) {
+        if (!picFile.open(relayFeed.get() != nullptr ? QFile::ReadOnly | QFile::Unbuffered : QFile::ReadOnly) ) {
             qDebug() << "send file open failed! filenme:" << fileName;
 			conn->stop();
 			return;
@@ -292,23 +534,28 @@ void PicTransferService::execute()
         isInit = true;
     }
     
-	int readBytes = picFile.read(writeBuff.data(), writeBuff.size());
-	if (readBytes < 0) {
+	if (isWriting || waitMsgWrite()) return;
+	if (readAhead(picFile) < 0) {
 		qDebug() << "send file read failed! filename: " << fileName << " errorCode: " << picFile.errorString();
 		picFile.close();
 		conn->stop();
 		return;
 	}
-	else if (readBytes == 0) {
-		conn->sock.async_send(boost::asio::buffer(writeBuff.data(), readBytes), [this](const boost::system::error_code& ec, std::size_t writeBytes) {
-			qDebug() << "send file read finished! filename: " << fileName;
-			picFile.close();
-		});
+	else if (sendQueue.empty()) {
+		if (!isReadEnd) return;
+		qDebug() << "send file read finished! filename: " << fileName;
+		picFile.close();
+		releaseRelay();
 		return;
 	}
-	
-	//qDebug() << "send file read executing! filename: " << fileName << " readBytes: " << readBytes;
-	conn->sock.async_send(boost::asio::buffer(writeBuff.data(), readBytes), [this](const boost::system::error_code& ec, std::size_t writeBytes) {
+
+	if (!isChunkReady(sendQueue.front())) return;
+
+	auto chunk = sendQueue.front();
+	auto sendStart = TransferTuner::Clock::now();
+	isWriting = true;
+	boost::asio::async_write(conn->sock, boost::asio::buffer(chunk->data(), chunk->size()), [this, chunk, sendStart](const boost::system::error_code& ec, std::size_t writeBytes) {
+		isWriting = false;
 		if (ec != 0) {
 			qDebug() << "send file send failed! filename: " << fileName << " errorCode: " << ec;
 			picFile.close();
@@ -316,21 +563,23 @@ void PicTransferService::execute()
 			return;
 		}
 
-		//qDebug() << "send file send executing! filename: " << fileName << " sendBytes: " << writeBytes;
+		tuner.chunkSent(writeBytes, std::chrono::duration_cast<TransferTuner::Duration>(TransferTuner::Clock::now() - sendStart));
+		sendQueue.pop_front();
 		execute();
 	});
+	readAhead(picFile);
 }
 
 
 FileDownloadService::FileDownloadService(const QString & fileName, JsonObjType & taskData)
-	:isInit(false), filePath(fileName), fileSize(0), handleFileLen(0), isProvider(false), taskData(taskData)
+	:isInit(false), filePath(fileName), fileSize(0), handleFileLen(0), isProvider(false), taskData(taskData), isExe(true)
 {
-    readBuff.resize(1024*512);
 }
 
 FileDownloadService::FileDownloadService(JsonObjType & taskData)
-    : isInit(false), isProvider(true), fileSize(0), handleFileLen(0), writeBuff(1024*512, '\0'), taskData(taskData), isExe(true)
+    : isInit(false), isProvider(true), fileSize(0), handleFileLen(0), taskData(taskData), isExe(true)
 {
+	compressor.setEnable(taskData["compress"].toBool());
 }
 
 FileDownloadService::~FileDownloadService()
@@ -342,6 +591,9 @@ void FileDownloadService::start()
 	qDebug() << taskData;
 	if (!isProvider) {
 		taskId = taskData["taskId"].toString();
+		taskData["compress"] = true;
+		compressor.setEnable(true);
+
 		JsonObjType serviceInfor;
 		serviceInfor["serviceName"] = fileDownloadServiceStr;
 		serviceInfor["serviceParam"] = taskData;
@@ -353,7 +605,13 @@ void FileDownloadService::start()
             TaskType::FileTransferTask, TransferMode::Single, JsonDocType(taskData).toJson(JsonDocType::Compact));
         taskId = task.tid;
 		if (TaskManager::getInstance()->createTask(task, conn) == 0) {
-			execute();
+			auto self = conn;
+			TaskManager::getInstance()->scheduleTask(taskId, task.tsource, 0, [this, self]() {
+				boost::asio::post(self->sock.get_executor(), [this, self]() {
+					execute();
+				});
+			}, conn);
+			//排队期间也保持读取, 以便及时发现对端断开
 			taskControlMsgHandle();
 		}
 		else {
@@ -366,6 +624,7 @@ void FileDownloadService::dataHandle()
 {
 	if (!isExe) return;
 
+	readBuff.resize(tuner.getRecvBuffSize());
 	conn->sock.async_receive(boost::asio::buffer(readBuff.data(), readBuff.size()), [this](const boost::system::error_code& ec, std::size_t readBytes) {
 		if (ec != 0) {
 			qDebug() << "FileDownloadService recv data error: " << ec;
@@ -375,12 +634,22 @@ void FileDownloadService::dataHandle()
 			return;
 		}
 
+		tuner.chunkRecv(readBytes);
+
 		auto rawMsg = readBuff.length() == readBytes ? readBuff : readBuff.left(readBytes);
 		if (!readRemain.isEmpty()) {
 			rawMsg.push_front(readRemain);
 			readRemain.clear();
 		}
 
+		if (decodeChunk(rawMsg) != 0) {
+			qDebug() << "download recv file decode failed! filename: " << filePath;
+			if (file.isOpen()) file.close();
+			conn->stop();
+			TaskManager::getInstance()->errorTask(taskId);
+			return;
+		}
+
 		if (!isInit) {
 			fileSize = taskData["fileSize"].toInt();
 			file.setFileName(filePath);
@@ -391,6 +660,7 @@ void FileDownloadService::dataHandle()
 				return;
 			}
 			isInit = true;
+			trackProgress(taskId, fileSize);
 		}
 
 		//qDebug() << "download recv file recv executing! filename: " << filePath << " recvBytes: " << readBytes;
@@ -406,6 +676,7 @@ void FileDownloadService::dataHandle()
 
 		//qDebug() << "download recv file write executing! filename: " << filePath << " writeBytes: " << writeBytes;
 		handleFileLen += writeBytes;
+		updateProgress(handleFileLen);
 		if (handleFileLen >= fileSize) {
 			qDebug() << "recv picture recv finished! filename: " << filePath;
 			file.close();
@@ -433,28 +704,32 @@ void FileDownloadService::execute()
 			return;
 		}
 		isInit = true;
+		trackProgress(taskId, fileSize);
 	}
 
-	int readBytes = file.read(writeBuff.data(), writeBuff.size());
-	handleFileLen += readBytes;
-	if (readBytes < 0) {
+	if (isWriting || waitMsgWrite()) return;
+	if (readAhead(file) < 0) {
 		qDebug() << "download send file read failed! filename: " << filePath << " errorCode: " << file.errorString();
 		if (file.isOpen()) file.close();
 		conn->stop();
 		TaskManager::getInstance()->errorTask(taskId);
 		return;
 	}
-	else if (readBytes == 0) {
-		conn->sock.async_send(boost::asio::buffer(writeBuff.data(), readBytes), [this](const boost::system::error_code& ec, std::size_t writeBytes) {
-			qDebug() << "download send file read finished! filename: " << filePath;
-			file.close();
-			TaskManager::getInstance()->finishTask(taskId);
-		});
+	else if (sendQueue.empty()) {
+		if (!isReadEnd) return;
+		qDebug() << "download send file read finished! filename: " << filePath;
+		file.close();
+		TaskManager::getInstance()->finishTask(taskId);
 		return;
 	}
 
-	//qDebug() << "download send file read executing! filename: " << filePath << " readBytes: " << readBytes;
-	conn->sock.async_send(boost::asio::buffer(writeBuff.data(), readBytes), [this](const boost::system::error_code& ec, std::size_t writeBytes) {
+	if (!isChunkReady(sendQueue.front())) return;
+
+	auto chunk = sendQueue.front();
+	auto sendStart = TransferTuner::Clock::now();
+	isWriting = true;
+	boost::asio::async_write(conn->sock, boost::asio::buffer(chunk->data(), chunk->size()), [this, chunk, sendStart](const boost::system::error_code& ec, std::size_t writeBytes) {
+		isWriting = false;
 		if (ec != 0) {
 			qDebug() << "download send file send failed! filename: " << filePath << " errorCode: " << ec;
 			file.close();
@@ -463,15 +738,23 @@ void FileDownloadService::execute()
 			return;
 		}
 
-		//qDebug() << "download send file send executing! filename: " << filePath << " sendBytes: " << writeBytes;
+		tuner.chunkSent(writeBytes, std::chrono::duration_cast<TransferTuner::Duration>(TransferTuner::Clock::now() - sendStart));
+		handleFileLen += chunkRawLen(*chunk, writeBytes);
+		updateProgress(handleFileLen);
+		sendQueue.pop_front();
 		execute();
 	});
+	readAhead(file);
 }
 
 void FileDownloadService::pause()
 {
 	if (isProvider) {
-		isExe = false;
+		//与restore一样投递到socket所在线程, 保证先后顺序
+		auto self = conn;
+		boost::asio::post(conn->sock.get_executor(), [this, self]() {
+			isExe = false;
+		});
 	}
 	else {
 		JsonObjType taskAction;
@@ -483,8 +766,12 @@ void FileDownloadService::pause()
 void FileDownloadService::restore()
 {
 	if (isProvider) {
-		isExe = true;
-		execute();
+		//发送状态归socket所在线程所有, 不能在调用线程直接执行
+		auto self = conn;
+		boost::asio::post(conn->sock.get_executor(), [this, self]() {
+			isExe = true;
+			if (self->sock.is_open()) execute();
+		});
 	}
 	else {
 		JsonObjType taskAction;
@@ -493,9 +780,11 @@ void FileDownloadService::restore()
 	}
 }
 
-int FileDownloadService::getProgress()
+void FileDownloadService::stop()
 {
-	return int(float(handleFileLen) / fileSize * 100);
+	if (isProvider)
+		TaskManager::getInstance()->dropConnTasks(conn);
+	Service::stop();
 }
 
 void FileDownloadService::taskControlMsgHandle()
@@ -503,10 +792,12 @@ void FileDownloadService::taskControlMsgHandle()
 	conn->sock.async_receive(boost::asio::buffer(readBuff.data(), readBuff.size()), [this](const boost::system::error_code& ec, std::size_t readBytes){
 		if (ec != 0) {
 			qDebug() << "FileDownloadService control msg recv error: " << ec;
+			if (ec != boost::asio::error::operation_aborted)
+				conn->stop();
 			return;
 		}
 
-		msgHandleLoop(readBytes, readBuff, readRemain, conn, [this](JsonObjType& msg) {
+		int result = msgHandleLoop(readBytes, readBuff, readRemain, conn, [this](JsonObjType& msg) {
 			auto action = msg["serviceName"].toString();
 			if (action == taskPauseStr) {
 				TaskManager::getInstance()->pauseTask(taskId);
@@ -515,6 +806,10 @@ void FileDownloadService::taskControlMsgHandle()
 				TaskManager::getInstance()->restoreTask(taskId);
 			}
 		});
+		if (result != 0) {
+			conn->stop();
+			return;
+		}
 
 		taskControlMsgHandle();
 	});
@@ -522,19 +817,18 @@ void FileDownloadService::taskControlMsgHandle()
 
 
 GroupFileUploadService::GroupFileUploadService(const QString & filePath, const QString& groupId)
-	: writeBuff(1024 * 512, '\0'), isInit(false), isSender(true), isExe(true), isRoute(false), fileSize(0), handleFileLen(0), filePath(filePath), groupId(groupId)
+	: isInit(false), isSender(true), isExe(true), isRoute(false), isDelta(true), isSigRecv(false), fileSize(0), handleFileLen(0), filePath(filePath), groupId(groupId)
 {
 }
 
 GroupFileUploadService::GroupFileUploadService(JsonObjType & groupFileData, bool)
-	: writeBuff(1024 * 512, '\0'), isInit(false), isSender(true), isExe(true), isRoute(true), fileSize(0), handleFileLen(0), groupFileData(groupFileData)
+	: isInit(false), isSender(true), isExe(true), isRoute(true), isDelta(true), isSigRecv(false), fileSize(0), handleFileLen(0), groupFileData(groupFileData)
 {
 }
 
 GroupFileUploadService::GroupFileUploadService(JsonObjType & groupFileData)
-	: isInit(false), isSender(false), isRoute(true), fileSize(0), handleFileLen(0), groupFileData(groupFileData)
+	: isInit(false), isSender(false), isExe(true), isRoute(true), isDelta(false), isSigRecv(false), fileSize(0), handleFileLen(0), groupFileData(groupFileData)
 {
-	readBuff.resize(1024 * 512);
 }
 
 GroupFileUploadService::~GroupFileUploadService()
@@ -546,7 +840,7 @@ void GroupFileUploadService::start()
 	if (isSender)
 	{
 		if (isRoute){
-			filePath = groupDir.c_str() + groupFileData["fileName"].toString();
+			filePath = relayFeed.get() != nullptr ? relayFeed->getFilePath() : groupDir.c_str() + groupFileData["fileName"].toString();
 			fileSize = groupFileData["fileSize"].toInt();
 		}
 		else {
@@ -556,35 +850,112 @@ void GroupFileUploadService::start()
 			groupFileData["fileSize"] = fileSize;
 			groupFileData["fileGroup"] = groupId;
 			groupFileData["fileOwner"] = NetStructureManager::getInstance()->getLocalUuid().c_str();
+			groupFileData["msgId"] = ConnectionManager::getInstance()->newMessageId();
 
 			TaskInfo task(groupId, TaskType::FileTransferTask, TransferMode::Group, JsonDocType(groupFileData).toJson(JsonDocType::Compact));
 			TaskManager::getInstance()->createTask(task, conn);
 			taskId = task.tid;
+			trackProgress(taskId, fileSize);
 		}
 
+		groupFileData["delta"] = isDelta;
 		JsonObjType serviceInfor;
 		serviceInfor["serviceName"] = groupFileUploadServiceStr;
 		serviceInfor["serviceParam"] = groupFileData;
 		Service::sendData(serviceInfor);
-		execute();
+		subscribeRelay();
+		recvSignature();
 	}
 	else {
 		filePath = groupDir.c_str() + groupFileData["fileName"].toString();
 		fileSize = groupFileData["fileSize"].toInt();
-		dataHandle(); 
+		isDelta = groupFileData["delta"].toBool();
+		if (isDelta)
+			sendSignature();
+		else
+			dataHandle(); 
+	}
+}
+
+void GroupFileUploadService::recvSignature()
+{
+	//接收方先回复已有文件的分块签名: 4字节长度 + 签名, 长度为0表示没有旧文件
+	sigBuff.resize(4);
+	boost::asio::async_read(conn->sock, boost::asio::buffer(sigBuff.data(), sigBuff.size()), [this](const boost::system::error_code& ec, std::size_t) {
+		if (ec != 0) {
+			qDebug() << "send group file signature recv failed! filePath: " << filePath << " errorCode: " << ec;
+			conn->stop();
+			if (!isRoute) TaskManager::getInstance()->errorTask(taskId);
+			return;
+		}
+
+		quint32 sigLen = qFromBigEndian<quint32>((const uchar*)sigBuff.constData());
+		if (sigLen > DeltaSignature::maxSerializedLen(fileSize)) {
+			qDebug() << "send group file signature too long! filePath: " << filePath << " sigLen: " << sigLen;
+			conn->stop();
+			if (!isRoute) TaskManager::getInstance()->errorTask(taskId);
+			return;
+		}
+		sigBuff.resize(sigLen);
+		boost::asio::async_read(conn->sock, boost::asio::buffer(sigBuff.data(), sigBuff.size()), [this](const boost::system::error_code& ec, std::size_t) {
+			if (ec != 0 || (!sigBuff.isEmpty() && encoder.loadSignature(sigBuff) != 0)) {
+				qDebug() << "send group file signature recv failed! filePath: " << filePath << " errorCode: " << ec;
+				conn->stop();
+				if (!isRoute) TaskManager::getInstance()->errorTask(taskId);
+				return;
+			}
+
+			sigBuff.clear();
+			isSigRecv = true;
+			execute();
+		});
+	});
+}
+
+void GroupFileUploadService::sendSignature()
+{
+	SendBufferType sig;
+	baseFile.setFileName(filePath);
+	if (baseFile.exists() && baseFile.open(QFile::ReadOnly)) {
+		if (signature.build(baseFile) == 0) {
+			sig = signature.serialize();
+		}
+		if (sig.size() > DeltaSignature::maxSerializedLen(fileSize)) {
+			//旧文件远大于新文件时增量没有意义, 按全量接收
+			sig.clear();
+		}
+		if (sig.isEmpty()) {
+			baseFile.close();
+		}
 	}
+
+	auto sigData = std::make_shared<SendBufferType>(4, '\0');
+	qToBigEndian<quint32>(sig.size(), (uchar*)sigData->data());
+	sigData->append(sig);
+	boost::asio::async_write(conn->sock, boost::asio::buffer(sigData->data(), sigData->size()), [this, sigData](const boost::system::error_code& ec, std::size_t) {
+		if (ec != 0) {
+			qDebug() << "recv group file signature send failed! filePath: " << filePath << " errorCode: " << ec;
+			if (baseFile.isOpen()) baseFile.close();
+			conn->stop();
+			return;
+		}
+
+		dataHandle();
+	});
 }
 
 void GroupFileUploadService::dataHandle()
 {
+	readBuff.resize(tuner.getRecvBuffSize());
 	conn->sock.async_receive(boost::asio::buffer(readBuff.data(), readBuff.size()), [this](const boost::system::error_code& ec, std::size_t readBytes) {
 		if (ec != 0) {
 			qDebug() << "GroupFileUploadService tcp connect error: " << ec;
-			if (file.isOpen()) file.close();
-			conn->stop();
+			failRecv();
 			return;
 		}
 
+		tuner.chunkRecv(readBytes);
+
 		auto rawMsg = readBuff.length() == readBytes ? readBuff : readBuff.left(readBytes);
 		if (!readRemain.isEmpty()) {
 			rawMsg.push_front(readRemain);
@@ -592,48 +963,98 @@ void GroupFileUploadService::dataHandle()
 		}
 
 		if (!isInit) {
-			file.setFileName(filePath);
+			//增量传输先写入临时文件, 旧文件在重建过程中仍需读取
+			file.setFileName(isDelta ? filePath + ".part" : filePath);
 			if (!file.open(QFile::WriteOnly)) {
-				qDebug() << "write group file open failed! filenme:" << filePath;
-				conn->stop();
+				qDebug() << "write group file open failed! filenme:" << file.fileName();
+				failRecv();
 				return;
 			}
+			decoder.setFiles(&baseFile, &file, signature.getBlockSize());
 			isInit = true;
-		}
 
-		int writeBytes = file.write(rawMsg);
-		if (writeBytes == -1) {
-			qDebug() << "recv group file write failed! filePath: " << filePath << " errorCode: " << ec;
-			file.close();
-			conn->stop();
-			return;
+			//校验并写入的数据立即转发给下一跳, 所有转发方读完后再用临时文件替换旧文件
+			if (isDelta) {
+				QString partPath = file.fileName(), sharedFilePath = filePath;
+				forwardFeed = std::make_shared<RelayFeed>(partPath);
+				forwardFeed->setReleaseHandler([partPath, sharedFilePath](bool isOk) {
+					if (!isOk) {
+						QFile::remove(partPath);
+						return;
+					}
+
+					QFile::remove(sharedFilePath);
+					if (!QFile::rename(partPath, sharedFilePath))
+						qDebug() << "recv group file rename failed! filePath: " << sharedFilePath;
+				});
+				ConnectionManager::getInstance()->uploadFileToGroupSpace(groupFileData, true, forwardFeed);
+			}
 		}
 
-		handleFileLen += writeBytes;
-		if (handleFileLen >= fileSize) {
-			qDebug() << "recv group file recv finished! filePath: " << filePath;
-			file.close();
-			conn->stop();
+		if (isDelta) {
+			if (decoder.decode(rawMsg) != 0) {
+				qDebug() << "recv group file delta decode failed! filePath: " << filePath;
+				failRecv();
+				return;
+			}
 
-			QString sharedFilePath = groupDir.c_str() + groupFileData["fileName"].toString();
-			SharedFileInfo sharedFile(sharedFilePath, groupFileData["fileOwner"].toString(), groupFileData["fileGroup"].toString());
-			SharedFileManager::getInstance()->addSharedFile(sharedFile);
+			handleFileLen = decoder.getOutputLen();
+			file.flush();
+			forwardFeed->setAvailLen(handleFileLen);
+			if (decoder.isFinished()) {
+				finishRecv();
+				return;
+			}
+		}
+		else {
+			int writeBytes = file.write(rawMsg);
+			if (writeBytes == -1) {
+				qDebug() << "recv group file write failed! filePath: " << filePath << " errorCode: " << ec;
+				failRecv();
+				return;
+			}
 
-			ConnectionManager::getInstance()->uploadFileToGroupSpace(groupFileData, true);
-			return;
+			handleFileLen += writeBytes;
+			if (handleFileLen >= fileSize) {
+				finishRecv();
+				return;
+			}
 		}
 
 		dataHandle();
 	});
 }
 
+void GroupFileUploadService::finishRecv()
+{
+	qDebug() << "recv group file recv finished! filePath: " << filePath;
+	file.close();
+	if (baseFile.isOpen()) baseFile.close();
+	if (forwardFeed.get() != nullptr) forwardFeed->finish();
+	conn->stop();
+
+	QString sharedFilePath = groupDir.c_str() + groupFileData["fileName"].toString();
+	SharedFileInfo sharedFile(sharedFilePath, groupFileData["fileOwner"].toString(), groupFileData["fileGroup"].toString());
+	SharedFileManager::getInstance()->addSharedFile(sharedFile);
+
+	if (!isDelta) ConnectionManager::getInstance()->uploadFileToGroupSpace(groupFileData, true);
+}
+
+void GroupFileUploadService::failRecv()
+{
+	if (file.isOpen()) file.close();
+	if (baseFile.isOpen()) baseFile.close();
+	if (forwardFeed.get() != nullptr) forwardFeed->fail();
+	conn->stop();
+}
+
 void GroupFileUploadService::execute()
 {
-	if (!isExe) return;
+	if (!isExe || !isSigRecv) return;
 
 	if (!isInit) {
 		file.setFileName(filePath);
-		if (!file.open(QFile::ReadOnly)) {
+		if (!file.open(relayFeed.get() != nullptr ? QFile::ReadOnly | QFile::Unbuffered : QFile::ReadOnly)) {
 			qDebug() << "send group file open failed! filePath:" << filePath;
 			conn->stop();
 			if (!isRoute) TaskManager::getInstance()->errorTask(taskId);
@@ -643,25 +1064,30 @@ void GroupFileUploadService::execute()
 		isInit = true;
 	}
 
-	int readBytes = file.read(writeBuff.data(), writeBuff.size());
-	handleFileLen += readBytes;
-	if (readBytes < 0) {
+	if (isWriting || waitMsgWrite()) return;
+	if (readAhead(file) < 0) {
 		qDebug() << "send group file read failed! filePath: " << filePath << " errorCode: " << file.errorString();
 		file.close();
 		conn->stop();
 		if (!isRoute) TaskManager::getInstance()->errorTask(taskId);
 		return;
 	}
-	else if (readBytes == 0) {
-		conn->sock.async_send(boost::asio::buffer(writeBuff.data(), readBytes), [this](const boost::system::error_code& ec, std::size_t writeBytes) {
-			qDebug() << "send group file read finished! filePath: " << filePath;
-			file.close();
-			if (!isRoute) TaskManager::getInstance()->finishTask(taskId);
-		});
+	else if (sendQueue.empty()) {
+		if (!isReadEnd) return;
+		qDebug() << "send group file read finished! filePath: " << filePath;
+		file.close();
+		releaseRelay();
+		if (!isRoute) TaskManager::getInstance()->finishTask(taskId);
 		return;
 	}
 
-	conn->sock.async_send(boost::asio::buffer(writeBuff.data(), readBytes), [this](const boost::system::error_code& ec, std::size_t writeBytes) {
+	if (!isChunkReady(sendQueue.front())) return;
+
+	auto chunk = sendQueue.front();
+	auto sendStart = TransferTuner::Clock::now();
+	isWriting = true;
+	boost::asio::async_write(conn->sock, boost::asio::buffer(chunk->data(), chunk->size()), [this, chunk, sendStart](const boost::system::error_code& ec, std::size_t writeBytes) {
+		isWriting = false;
 		if (ec != 0) {
 			qDebug() << "send group file send failed! filename: " << filePath << " errorCode: " << ec;
 			file.close();
@@ -670,33 +1096,55 @@ void GroupFileUploadService::execute()
 			return;
 		}
 
+		tuner.chunkSent(writeBytes, std::chrono::duration_cast<TransferTuner::Duration>(TransferTuner::Clock::now() - sendStart));
+		if (!isDelta) {
+			handleFileLen += writeBytes;
+		}
+		else if (!deltaCovered.empty()) {
+			handleFileLen += deltaCovered.front();
+			deltaCovered.pop_front();
+		}
+		updateProgress(handleFileLen);
+		sendQueue.pop_front();
 		execute();
 	});
+	readAhead(file);
 }
 
 void GroupFileUploadService::pause()
 {
 	if (isSender) {
-		isExe = false;
+		auto self = conn;
+		boost::asio::post(conn->sock.get_executor(), [this, self]() {
+			isExe = false;
+		});
 	}
 }
 
 void GroupFileUploadService::restore()
 {
 	if (isSender) {
-		isExe = true;
-		execute();
+		auto self = conn;
+		boost::asio::post(conn->sock.get_executor(), [this, self]() {
+			isExe = true;
+			if (self->sock.is_open()) execute();
+		});
 	}
 }
 
-int GroupFileUploadService::getProgress()
+void GroupFileUploadService::encodeChunk(SendBufferPtr chunk, bool isEnd)
 {
-	return int(float(handleFileLen) / fileSize * 100);
+	if (!isDelta) return;
+
+	//进度按发出的指令所代表的新文件长度计算: 复制的块长加上新数据长度
+	qint64 coveredLen = encoder.getCoveredLen();
+	encoder.encode(*chunk, isEnd);
+	if (!chunk->isEmpty()) deltaCovered.push_back(encoder.getCoveredLen() - coveredLen);
 }
 
 
 FileSendService::FileSendService(const QString & fileName, const QString & storePath)
-	: isSender(true), isInit(false), fileName(fileName), storePath(storePath), writeBuff(1024 * 512, '\0'), handleFileLen(0)
+	: isSender(true), isInit(false), isStreamed(false), fileName(fileName), storePath(storePath), handleFileLen(0)
 {
 
 }
@@ -706,7 +1154,8 @@ FileSendService::FileSendService(JsonObjType & serviceParam)
 {
 	fileName = serviceParam["fileName"].toString();
 	fileSize = serviceParam["fileSize"].toInt();
-	readBuff.resize(1024 * 512);
+	isStreamed = serviceParam["streamed"].toBool();
+	compressor.setEnable(serviceParam["compress"].toBool());
 }
 
 FileSendService::~FileSendService()
@@ -724,7 +1173,9 @@ void FileSendService::start()
 		QFileInfo fileInfo(fileName);
 		serviceParam["fileSize"] = fileInfo.size();
 		serviceParam["fileName"] = storePath + "/" + fileInfo.fileName();
+		serviceParam["compress"] = true;
 		serviceInfor["serviceParam"] = serviceParam;
+		compressor.setEnable(true);
 		Service::sendData(serviceInfor);
 		execute();
 	}
@@ -742,17 +1193,16 @@ void FileSendService::dataHandle()
 		}
 
 		if (!readRemain.isEmpty()) {
-			int writeBytes = file.write(readRemain);
+			int writeBytes = writeChunk(readRemain);
 			readRemain.clear();
 			if (writeBytes == -1) {
 				qDebug() << "recv file write failed! filename: " << fileName;
-				file.close();
-				conn->stop();
+				failRecv();
 				return;
 			}
 
 			handleFileLen += writeBytes;
-			if (handleFileLen >= fileSize) {
+			if (!isStreamed && handleFileLen >= fileSize) {
 				qDebug() << "recv file recv finished! filename: " << fileName;
 				file.close();
 				conn->stop();
@@ -763,26 +1213,41 @@ void FileSendService::dataHandle()
 		isInit = true;
 	}
 
+	readBuff.resize(tuner.getRecvBuffSize());
 	conn->sock.async_receive(boost::asio::buffer(readBuff.data(), readBuff.size()), [this](const boost::system::error_code& ec, std::size_t readBytes) {
+		//流式发送的文件大小未知, 以发送方关闭连接作为结束, 流尾校验通过才算收完
+		if (isStreamed && ec == boost::asio::error::eof) {
+			if (!trailerCheck.verify()) {
+				qDebug() << "recv file stream trailer check failed! filename: " << fileName;
+				failRecv();
+				return;
+			}
+
+			qDebug() << "recv file recv finished! filename: " << fileName;
+			file.close();
+			conn->stop();
+			return;
+		}
+
 		if (ec != 0) {
 			qDebug() << "FileSendService tcp connect error: " << ec;
-			if (file.isOpen()) file.close();
-			conn->stop();
+			failRecv();
 			return;
 		}
 
+		tuner.chunkRecv(readBytes);
+
 		auto rawMsg = readBuff.length() == readBytes ? readBuff : readBuff.left(readBytes);
 
-		int writeBytes = file.write(rawMsg);
+		int writeBytes = writeChunk(rawMsg);
 		if (writeBytes == -1) {
 			qDebug() << "recv file write failed! filename: " << fileName << " errorCode: " << ec;
-			file.close();
-			conn->stop();
+			failRecv();
 			return;
 		}
 
 		handleFileLen += writeBytes;
-		if (handleFileLen >= fileSize) {
+		if (!isStreamed && handleFileLen >= fileSize) {
 			qDebug() << "recv file recv finished! filename: " << fileName;
 			file.close();
 			conn->stop();
@@ -793,6 +1258,21 @@ void FileSendService::dataHandle()
 	});
 }
 
+int FileSendService::writeChunk(RecvBufferType & data)
+{
+	if (decodeChunk(data) != 0) return -1;
+	if (isStreamed) trailerCheck.feed(data);
+	return data.isEmpty() ? 0 : file.write(data);
+}
+
+void FileSendService::failRecv()
+{
+	//不完整的文件直接删除, 避免被当作已收到的文件
+	if (file.isOpen()) file.close();
+	if (isStreamed) file.remove();
+	conn->stop();
+}
+
 void FileSendService::execute()
 {
 	if (!isInit) {
@@ -806,22 +1286,27 @@ void FileSendService::execute()
 		isInit = true;
 	}
 
-	int readBytes = file.read(writeBuff.data(), writeBuff.size());
-	if (readBytes < 0) {
+	if (isWriting || waitMsgWrite()) return;
+	if (readAhead(file) < 0) {
 		qDebug() << "send file read failed! filename: " << fileName << " errorCode: " << file.errorString();
 		file.close();
 		conn->stop();
 		return;
 	}
-	else if (readBytes == 0) {
-		conn->sock.async_send(boost::asio::buffer(writeBuff.data(), readBytes), [this](const boost::system::error_code& ec, std::size_t writeBytes) {
-			qDebug() << "send file read finished! filename: " << fileName;
-			file.close();
-		});
+	else if (sendQueue.empty()) {
+		if (!isReadEnd) return;
+		qDebug() << "send file read finished! filename: " << fileName;
+		file.close();
 		return;
 	}
 
-	conn->sock.async_send(boost::asio::buffer(writeBuff.data(), readBytes), [this](const boost::system::error_code& ec, std::size_t writeBytes) {
+	if (!isChunkReady(sendQueue.front())) return;
+
+	auto chunk = sendQueue.front();
+	auto sendStart = TransferTuner::Clock::now();
+	isWriting = true;
+	boost::asio::async_write(conn->sock, boost::asio::buffer(chunk->data(), chunk->size()), [this, chunk, sendStart](const boost::system::error_code& ec, std::size_t writeBytes) {
+		isWriting = false;
 		if (ec != 0) {
 			qDebug() << "send file send failed! filename: " << fileName << " errorCode: " << ec;
 			file.close();
@@ -829,6 +1314,74 @@ void FileSendService::execute()
 			return;
 		}
 
+		tuner.chunkSent(writeBytes, std::chrono::duration_cast<TransferTuner::Duration>(TransferTuner::Clock::now() - sendStart));
+		handleFileLen += chunkRawLen(*chunk, writeBytes);
+		sendQueue.pop_front();
+		execute();
+	});
+	readAhead(file);
+}
+
+ZipSendService::ZipSendService(const QString & dirPath, const QString & zipName, const QString & storePath)
+	: handleFileLen(0), zipName(zipName), storePath(storePath), zipStream(std::make_shared<ZipStream>(dirPath))
+{
+}
+
+ZipSendService::~ZipSendService()
+{
+}
+
+void ZipSendService::start()
+{
+	JsonObjType serviceInfor;
+	serviceInfor["serviceName"] = fileSendServiceStr;
+
+	JsonObjType serviceParam;
+	serviceParam["fileSize"] = -1;
+	serviceParam["fileName"] = storePath + "/" + zipName;
+	serviceParam["streamed"] = true;
+	serviceInfor["serviceParam"] = serviceParam;
+	Service::sendData(serviceInfor);
+
+	auto self = conn;
+	zipStream->start(conn->sock.get_executor(), [this, self]() {
+		if (self->sock.is_open()) execute();
+	});
+}
+
+void ZipSendService::execute()
+{
+	if (isWriting || waitMsgWrite()) return;
+
+	if (zipStream->isError()) {
+		qDebug() << "send zip stream failed! filename: " << zipName;
+		conn->stop();
+		return;
+	}
+
+	auto chunk = zipStream->takeChunk();
+	if (chunk.get() == nullptr) {
+		if (zipStream->isFinished()) {
+			qDebug() << "send zip stream finished! filename: " << zipName << " sendBytes: " << handleFileLen;
+			boost::system::error_code ec;
+			conn->sock.shutdown(tcp::socket::shutdown_send, ec);
+			conn->stop();
+		}
+		return;
+	}
+
+	auto sendStart = TransferTuner::Clock::now();
+	isWriting = true;
+	boost::asio::async_write(conn->sock, boost::asio::buffer(chunk->data(), chunk->size()), [this, chunk, sendStart](const boost::system::error_code& ec, std::size_t writeBytes) {
+		isWriting = false;
+		if (ec != 0) {
+			qDebug() << "send zip stream send failed! filename: " << zipName << " errorCode: " << ec;
+			conn->stop();
+			return;
+		}
+
+		tuner.chunkSent(writeBytes, std::chrono::duration_cast<TransferTuner::Duration>(TransferTuner::Clock::now() - sendStart));
+		handleFileLen += writeBytes;
 		execute();
 	});
 }
\ No newline at end of file
@@ -2,8 +2,18 @@
 #define SERVICES_H
 
 #include "Common.h"
+#include "TransferTuner.h"
+#include "DeltaSync.h"
+#include "StreamCompressor.h"
+#include "ZipStream.h"
+#include "RelayFeed.h"
+#include "TaskProgress.h"
 
 #include "QtCore\qfile.h"
+#include "QtCore\qvariant.h"
+
+#include <deque>
+#include <unordered_set>
 
 class Service;
 typedef std::shared_ptr<Service> ServicePtr;
@@ -21,18 +31,39 @@ public:
 	virtual void pause();
 	virtual void restore();
 	virtual void stop();
-	virtual int getProgress();
+	virtual QVariantHash getTransferInfo();
 
 	ConnPtr getConn() { return conn; }
 	void setConn(ConnPtr newConn) { this->conn = newConn; }
 	void setRemain(const RecvBufferType& newRemain) { readRemain = newRemain; }
+	void setRelay(RelayFeedPtr feed);
 
-	static void msgHandleLoop(size_t readBytes, RecvBufferType& readBuff, RecvBufferType& readRemain, 
+	static int msgHandleLoop(size_t readBytes, RecvBufferType& readBuff, RecvBufferType& readRemain, 
 		ConnPtr conn, std::function<void(JsonObjType&)>&& handler);
 
 protected:
+	int readAhead(QFile& file);
+	int decodeChunk(RecvBufferType& data);
+	bool isChunkReady(const SendBufferPtr& chunk)const { return encodingChunks.count(chunk.get()) == 0; }
+	int chunkRawLen(const SendBufferType& chunk, int writeBytes)const;
+	virtual void encodeChunk(SendBufferPtr chunk, bool isEnd);
+	void subscribeRelay();
+	void releaseRelay();
+	void trackProgress(const QString& tid, qint64 totalLen);
+	void updateProgress(qint64 doneLen);
+	void writeNextMsg();
+	bool waitMsgWrite();
+
 	ConnPtr conn;
 	RecvBufferType readBuff, readRemain;
+	TransferTuner tuner;
+	StreamCompressor compressor;
+	std::deque<SendBufferPtr> sendQueue, msgQueue;
+	std::unordered_set<SendBufferType*> encodingChunks;
+	RelayFeedPtr relayFeed;
+	TaskProgressPtr progress;
+	int relayId;
+	bool isReadEnd, isWriting, isMsgWriting, isExecuteWaiting;
 };
 
 class NetStructureService : public Service {
@@ -61,12 +92,14 @@ public:
 	virtual void execute();
 
 private:
-	bool isSender, isInit, isGroup;
+	void showThumb();
+
+	bool isSender, isInit, isGroup, hasThumb;
 	int fileSize, recvFileLen;
 	QString fileName;
-	SendBufferType writeBuff;
 	JsonObjType taskParam;
 	QFile picFile;
+	RelayFeedPtr forwardFeed;
 };
 
 class FileDownloadService : public Service {
@@ -80,14 +113,13 @@ public:
 	virtual void execute();
 	virtual void pause();
 	virtual void restore();
-	virtual int getProgress();
+	virtual void stop();
 
 private:
 	bool isExe, isInit, isProvider;
 	int fileSize, handleFileLen;
 	QString filePath, taskId;
 	QFile file;
-	SendBufferType writeBuff;
 	JsonObjType taskData;
 
 	void taskControlMsgHandle();
@@ -105,15 +137,27 @@ public:
 	virtual void execute();
 	virtual void pause();
 	virtual void restore();
-	virtual int getProgress();
+
+protected:
+	virtual void encodeChunk(SendBufferPtr chunk, bool isEnd);
 
 private:
-	bool isRoute, isExe, isInit, isSender;
+	bool isRoute, isExe, isInit, isSender, isDelta, isSigRecv;
 	int fileSize, handleFileLen;
 	QString filePath, groupId, taskId;
-	QFile file;
-	SendBufferType writeBuff;
+	QFile file, baseFile;
 	JsonObjType groupFileData;
+	RecvBufferType sigBuff;
+	DeltaSignature signature;
+	DeltaEncoder encoder;
+	std::deque<qint64> deltaCovered;
+	DeltaDecoder decoder;
+	RelayFeedPtr forwardFeed;
+
+	void recvSignature();
+	void sendSignature();
+	void finishRecv();
+	void failRecv();
 };
 
 class FileSendService : public Service {
@@ -127,12 +171,29 @@ public:
 	virtual void execute();
 
 private:
-	bool isSender, isInit;
+	bool isSender, isInit, isStreamed;
 	int fileSize, handleFileLen;
 	QString fileName;
 	QString storePath;
-	SendBufferType writeBuff;
 	QFile file;
+	ZipTrailerCheck trailerCheck;
+
+	int writeChunk(RecvBufferType& data);
+	void failRecv();
+};
+
+class ZipSendService : public Service {
+public:
+	ZipSendService(const QString& dirPath, const QString& zipName, const QString& storePath);
+	~ZipSendService();
+
+	virtual void start();
+	virtual void execute();
+
+private:
+	int handleFileLen;
+	QString zipName, storePath;
+	ZipStreamPtr zipStream;
 };
 
 #endif
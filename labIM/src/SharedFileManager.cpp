@@ -3,8 +3,10 @@
 #include "TaskManager.h"
 #include "NetStructureManager.h"
 #include "ConnectionManager.h"
+#include "MulticastManager.h"
 
 #include "QtCore\qfileinfo.h"
+#include "QtCore\qfile.h"
 
 SharedFileManager::SharedFileManager()
 {
@@ -37,6 +39,19 @@ int SharedFileManager::removeSharedFile(const QString & filePath)
 
 void SharedFileManager::uploadGroupSharedFile(const QString & groupId, const QString & filePath)
 {
+	//局域网内优先组播, 一次发给组内成员和所有路由节点; 组播不可用时退回逐跳TCP上传.
+	//组内已有同名文件时是重新上传, 走TCP增量传输只发送变化的块
+	QString sharedFilePath = groupDir.c_str() + QFileInfo(filePath).fileName();
+	bool isReupload = !DBOP::getInstance()->getSharedFile(sharedFilePath).isEmpty();
+	if (!isReupload && MulticastManager::getInstance()->sendFile(groupId, filePath) == 0) {
+		if (NetStructureManager::getInstance()->getLocalRole() == ROLE_ROUTER) {
+			QFile::remove(sharedFilePath);
+			if (QFile::copy(filePath, sharedFilePath))
+				addSharedFile(SharedFileInfo(sharedFilePath, NetStructureManager::getInstance()->getLocalUuid().c_str(), groupId));
+		}
+		return;
+	}
+
 	JsonObjType sharedFileInfo;
 	sharedFileInfo["fileName"] = filePath;
 	sharedFileInfo["fileGroup"] = groupId;
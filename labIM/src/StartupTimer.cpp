@@ -0,0 +1,31 @@
+﻿#include "StartupTimer.h"
+
+#include "QtCore\qsavefile.h"
+
+const StringType startupFile = "startup.json";
+
+StartupTimer::StartupTimer()
+{
+	clock.start();
+}
+
+StartupTimer * StartupTimer::getInstance()
+{
+	static StartupTimer instance;
+	return &instance;
+}
+
+void StartupTimer::mark(const QString & stage)
+{
+	QMutexLocker lock(&mutex);
+	if (stages.contains(stage)) return;
+
+	auto elapsed = clock.elapsed();
+	stages[stage] = (double)elapsed;
+	qDebug() << "startup stage: " << stage << " elapsed(ms): " << elapsed;
+
+	QSaveFile file(startupFile.c_str());
+	if (!file.open(QFile::WriteOnly)) return;
+	file.write(JsonDocType(stages).toJson(JsonDocType::Indented));
+	file.commit();
+}
@@ -0,0 +1,25 @@
+﻿#ifndef STARTUPTIMER_H
+#define STARTUPTIMER_H
+
+#include "Common.h"
+
+#include "QtCore\qmutex.h"
+#include "QtCore\qelapsedtimer.h"
+
+//启动耗时: 记录各阶段完成时距进程启动的毫秒数, 每次更新都写入startup.json
+class StartupTimer : public boost::noncopyable
+{
+public:
+	static StartupTimer* getInstance();
+
+	void mark(const QString& stage);
+
+private:
+	StartupTimer();
+
+	QMutex mutex;
+	QElapsedTimer clock;
+	JsonObjType stages;
+};
+
+#endif // !STARTUPTIMER_H
@@ -0,0 +1,113 @@
+﻿#include "StreamCompressor.h"
+
+#include "QtCore\qendian.h"
+
+const int frameHeadLen = 9;
+const char rawFrameFlag = 0;
+const char zipFrameFlag = 1;
+const int compressLevel = 3;
+const int probeChunkNum = 2;
+const int reprobeInterval = 32;
+const double worthRatio = 0.9;
+const double ratioWeight = 0.25;
+
+StreamCompressor::StreamCompressor()
+	: isEnable(false), isWorth(true), probeNum(0), skipNum(0), sampleRatio(-1), rawLen(0), frameLen(0), cpuUs(0)
+{
+}
+
+bool StreamCompressor::shouldCompress()
+{
+	if (!isEnable) return false;
+
+	if (probeNum < probeChunkNum) {
+		++probeNum;
+		return true;
+	}
+
+	if (isWorth) return true;
+
+	//不划算时隔一段再压缩一块试探, 文件后段的内容可能不同
+	if (++skipNum >= reprobeInterval) {
+		skipNum = 0;
+		return true;
+	}
+	return false;
+}
+
+void StreamCompressor::packRaw(SendBufferType & chunk)
+{
+	int rawBytes = chunk.size();
+	chunk = makeFrame(rawFrameFlag, rawBytes, chunk);
+	rawLen += rawBytes;
+	frameLen += chunk.size();
+}
+
+void StreamCompressor::chunkPacked(int rawBytes, int frameBytes, TransferTuner::Duration cost)
+{
+	rawLen += rawBytes;
+	frameLen += frameBytes;
+	cpuUs += cost.count();
+
+	double ratio = rawBytes > 0 ? double(frameBytes) / rawBytes : 1;
+	sampleRatio = sampleRatio < 0 ? ratio : sampleRatio * (1 - ratioWeight) + ratio * ratioWeight;
+	isWorth = sampleRatio < worthRatio;
+}
+
+int StreamCompressor::unpack(RecvBufferType & data)
+{
+	pending.append(data);
+	data.clear();
+
+	int pos = 0;
+	while (pending.size() - pos >= frameHeadLen) {
+		const uchar* head = (const uchar*)pending.constData() + pos;
+		char flag = (char)head[0];
+		int rawBytes = qFromBigEndian<qint32>(head + 1);
+		int payloadBytes = qFromBigEndian<qint32>(head + 5);
+		if (rawBytes < 0 || payloadBytes < 0 || (flag != rawFrameFlag && flag != zipFrameFlag)) {
+			qDebug() << "stream unpack failed! invalid frame flag: " << (int)flag;
+			return -1;
+		}
+		if (pending.size() - pos - frameHeadLen < payloadBytes) break;
+
+		auto payload = pending.mid(pos + frameHeadLen, payloadBytes);
+		if (flag == zipFrameFlag) {
+			payload = qUncompress(payload);
+			if (payload.size() != rawBytes) {
+				qDebug() << "stream unpack failed! raw length: " << rawBytes << " unpack length: " << payload.size();
+				return -1;
+			}
+		}
+
+		data.append(payload);
+		pos += frameHeadLen + payloadBytes;
+	}
+
+	pending.remove(0, pos);
+	return 0;
+}
+
+SendBufferType StreamCompressor::pack(const SendBufferType & chunk)
+{
+	auto packed = qCompress(chunk, compressLevel);
+	if (packed.size() >= chunk.size())
+		return makeFrame(rawFrameFlag, chunk.size(), chunk);
+	return makeFrame(zipFrameFlag, chunk.size(), packed);
+}
+
+int StreamCompressor::frameRawLen(const SendBufferType & frame)
+{
+	if (frame.size() < frameHeadLen) return 0;
+	return qFromBigEndian<qint32>((const uchar*)frame.constData() + 1);
+}
+
+SendBufferType StreamCompressor::makeFrame(char flag, int rawBytes, const QByteArray & payload)
+{
+	SendBufferType frame(frameHeadLen, '\0');
+	frame[0] = flag;
+	qToBigEndian<qint32>(rawBytes, (uchar*)frame.data() + 1);
+	qToBigEndian<qint32>(payload.size(), (uchar*)frame.data() + 5);
+	frame.append(payload);
+	return frame;
+}
@@ -0,0 +1,38 @@
+﻿#ifndef STREAMCOMPRESSOR_H
+#define STREAMCOMPRESSOR_H
+
+#include "Common.h"
+#include "TransferTuner.h"
+
+//传输流压缩: 每块封装为 [1字节标志][4字节原始长度][4字节负载长度][负载]
+//开头几块用于试探压缩率, 压缩不划算时改为原样发送并定期重新试探
+class StreamCompressor
+{
+public:
+	StreamCompressor();
+
+	void setEnable(bool enable) { isEnable = enable; }
+	bool getEnable()const { return isEnable; }
+
+	bool shouldCompress();
+	void packRaw(SendBufferType& chunk);
+	void chunkPacked(int rawBytes, int frameBytes, TransferTuner::Duration cost);
+	int unpack(RecvBufferType& data);
+
+	double getRatio()const { return rawLen > 0 ? double(frameLen) / rawLen : 1; }
+	double getCpuMs()const { return cpuUs / 1000.0; }
+
+	static SendBufferType pack(const SendBufferType& chunk);
+	static int frameRawLen(const SendBufferType& frame);
+
+private:
+	static SendBufferType makeFrame(char flag, int rawBytes, const QByteArray& payload);
+
+	bool isEnable, isWorth;
+	int probeNum, skipNum;
+	double sampleRatio;
+	qint64 rawLen, frameLen, cpuUs;
+	QByteArray pending;
+};
+
+#endif // !STREAMCOMPRESSOR_H
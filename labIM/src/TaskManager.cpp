@@ -2,16 +2,92 @@
 #include "DBop.h"
 #include "ConnectionManager.h"
 
+#include "QtCore\qmutex.h"
+#include "QtCore\qtimer.h"
+#include "QtCore\qelapsedtimer.h"
+
+#include <algorithm>
+
 const StringType taskManagFamilyStr("TaskManage");
+const int defaultMaxRunningNum = 5;
+const int defaultMaxPeerRunningNum = 2;
+const int progressPublishInterval = 250;
+const double progressSpeedWeight = 0.3;
+
+struct TaskSchedEntry {
+	QString tid;
+	QString peer;
+	int priority;
+	bool isPaused;
+	qint64 order;
+	std::function<void()> startFunc;
+	ConnPtr conn;
+};
+
+struct TaskProgressEntry {
+	TaskProgressPtr progress;
+	qint64 lastDoneLen;
+	qint64 lastPublishTime;
+	double speed;
+};
 
 struct TaskManagerData {
 	QHash<QString, ConnPtr> taskConnMap;
+
+	QMutex schedMutex;
+	std::vector<TaskSchedEntry> waitingTasks;
+	QHash<QString, QString> runningTaskPeerMap;
+	QHash<QString, int> peerRunningNum;
+	QHash<QString, qint64> peerServedOrder;
+	qint64 orderCounter = 0;
+	int maxRunningNum = defaultMaxRunningNum;
+	int maxPeerRunningNum = defaultMaxPeerRunningNum;
+
+	QMutex progressMutex;
+	QHash<QString, TaskProgressEntry> progressMap;
+	QElapsedTimer progressClock;
+	QTimer* progressTimer = nullptr;
 };
 
+//高优先级优先, 同优先级下最久未被服务的对端优先, 最后按入队顺序
+static bool taskSchedBefore(const TaskSchedEntry& l, const TaskSchedEntry& r, const QHash<QString, qint64>& peerServedOrder)
+{
+	if (l.priority != r.priority)
+		return l.priority > r.priority;
+
+	auto lServed = peerServedOrder.value(l.peer, -1), rServed = peerServedOrder.value(r.peer, -1);
+	if (lServed != rServed)
+		return lServed < rServed;
+
+	return l.order < r.order;
+}
+
+static std::vector<QString> sortedWaitingTasks(const TaskManagerDataPtr& data)
+{
+	std::vector<const TaskSchedEntry*> entries;
+	for (auto& entry : data->waitingTasks)
+		entries.push_back(&entry);
+
+	std::sort(entries.begin(), entries.end(), [&data](const TaskSchedEntry* l, const TaskSchedEntry* r) {
+		return taskSchedBefore(*l, *r, data->peerServedOrder);
+	});
+
+	std::vector<QString> result;
+	for (auto entry : entries)
+		result.push_back(entry->tid);
+	return result;
+}
+
 TaskManager::TaskManager(QObject *parent)
     :QObject(parent), memberDataPtr(std::make_shared<TaskManagerData>())
 {
     ConnectionManager::getInstance()->registerFamilyHandler(taskManagFamilyStr, std::bind(&TaskManager::actionParse, this, _1, _2));
+
+	//进度由界面线程定时批量发布, 任务数量增加时界面的开销不随之增加
+	memberDataPtr->progressClock.start();
+	memberDataPtr->progressTimer = new QTimer(this);
+	connect(memberDataPtr->progressTimer, &QTimer::timeout, this, &TaskManager::publishProgress);
+	memberDataPtr->progressTimer->start(progressPublishInterval);
 }
 
 TaskManager::~TaskManager()
@@ -72,22 +148,134 @@ int TaskManager::createFileDownloadTask(QString duuid, QVariantHash data, QStrin
     auto servicePtr = std::make_shared<FileDownloadService>(filePath, JsonDocType::fromVariant(data).object());
 	int result = DBOP::getInstance()->createTask(task);
 	if (result == 0) {
-		ConnPtr taskConn = ConnectionManager::getInstance()->connnectHost(ConnType::CONN_TEMP, INVALID_ID, addr, servicePtr, [this,task](const boost::system::error_code& err) {
-			if (err != 0) {
-				errorTask(task.tid);
-				qDebug() << "file download connnection connect failed!";
-				return;
-			}
+		scheduleTask(task.tid, duuid, data["priority"].toInt(), [this, task, addr, servicePtr]() mutable {
+			ConnPtr taskConn = ConnectionManager::getInstance()->connnectHost(ConnType::CONN_TEMP, INVALID_ID, addr, servicePtr, [this, task](const boost::system::error_code& err) {
+				if (err != 0) {
+					errorTask(task.tid);
+					qDebug() << "file download connnection connect failed!";
+					return;
+				}
 
-			qDebug() << "file download connnection connect success!";
+				qDebug() << "file download connnection connect success!";
+			});
+			registerTask(task.tid, taskConn);
 		});
-		registerTask(task.tid, taskConn);
 	}
 	return result;
 }
 
+void TaskManager::scheduleTask(const QString & tid, const QString & peer, int priority, std::function<void()>&& startFunc, ConnPtr taskConn)
+{
+	{
+		QMutexLocker lock(&memberDataPtr->schedMutex);
+		TaskSchedEntry entry{ tid, peer, priority, false, ++memberDataPtr->orderCounter, std::move(startFunc), taskConn };
+		memberDataPtr->waitingTasks.push_back(std::move(entry));
+	}
+
+	dispatchTasks();
+}
+
+void TaskManager::releaseTaskSlot(const QString & tid)
+{
+	{
+		QMutexLocker lock(&memberDataPtr->schedMutex);
+		if (memberDataPtr->runningTaskPeerMap.contains(tid)) {
+			auto peer = memberDataPtr->runningTaskPeerMap.take(tid);
+			if (--memberDataPtr->peerRunningNum[peer] <= 0)
+				memberDataPtr->peerRunningNum.remove(peer);
+		}
+		else {
+			auto& waiting = memberDataPtr->waitingTasks;
+			waiting.erase(std::remove_if(waiting.begin(), waiting.end(), [&tid](const TaskSchedEntry& entry) {
+				return entry.tid == tid;
+			}), waiting.end());
+		}
+	}
+
+	dispatchTasks();
+}
+
+void TaskManager::dropConnTasks(ConnPtr taskConn)
+{
+	if (taskConn.get() == nullptr) return;
+
+	std::vector<QString> droppedTasks;
+	{
+		QMutexLocker lock(&memberDataPtr->schedMutex);
+		auto& waiting = memberDataPtr->waitingTasks;
+		auto dropBegin = std::remove_if(waiting.begin(), waiting.end(), [&taskConn](const TaskSchedEntry& entry) {
+			return entry.conn == taskConn;
+		});
+		for (auto it = dropBegin; it != waiting.end(); ++it)
+			droppedTasks.push_back(it->tid);
+		waiting.erase(dropBegin, waiting.end());
+	}
+
+	//连接已断开, 排队中的任务直接置错并释放
+	for (auto& tid : droppedTasks)
+		errorTask(tid);
+}
+
+void TaskManager::dispatchTasks()
+{
+	std::vector<std::function<void()>> startFuncs;
+	std::vector<QString> startedTasks, droppedTasks, queueOrder;
+
+	{
+		QMutexLocker lock(&memberDataPtr->schedMutex);
+		auto& waiting = memberDataPtr->waitingTasks;
+		//出队前剔除连接已关闭的任务, 避免在失效的socket上执行并占用名额
+		auto dropBegin = std::remove_if(waiting.begin(), waiting.end(), [](const TaskSchedEntry& entry) {
+			return entry.conn.get() != nullptr && !entry.conn->sock.is_open();
+		});
+		for (auto it = dropBegin; it != waiting.end(); ++it)
+			droppedTasks.push_back(it->tid);
+		waiting.erase(dropBegin, waiting.end());
+
+		while (memberDataPtr->runningTaskPeerMap.size() < memberDataPtr->maxRunningNum) {
+			auto best = waiting.end();
+			for (auto it = waiting.begin(); it != waiting.end(); ++it) {
+				if (it->isPaused || memberDataPtr->peerRunningNum.value(it->peer) >= memberDataPtr->maxPeerRunningNum)
+					continue;
+				if (best == waiting.end() || taskSchedBefore(*it, *best, memberDataPtr->peerServedOrder))
+					best = it;
+			}
+
+			if (best == waiting.end())
+				break;
+
+			memberDataPtr->runningTaskPeerMap[best->tid] = best->peer;
+			++memberDataPtr->peerRunningNum[best->peer];
+			memberDataPtr->peerServedOrder[best->peer] = ++memberDataPtr->orderCounter;
+			startedTasks.push_back(best->tid);
+			startFuncs.push_back(std::move(best->startFunc));
+			waiting.erase(best);
+		}
+
+		queueOrder = sortedWaitingTasks(memberDataPtr);
+	}
+
+	for (auto& tid : droppedTasks)
+		errorTask(tid);
+	for (auto& tid : startedTasks)
+		taskQueuePosChanged(tid, -1);
+	for (int pos = 0; pos < (int)queueOrder.size(); ++pos)
+		taskQueuePosChanged(queueOrder[pos], pos);
+
+	for (auto& startFunc : startFuncs)
+		startFunc();
+}
+
 void TaskManager::restoreTask(const QString& tid)
 {
+	{
+		QMutexLocker lock(&memberDataPtr->schedMutex);
+		for (auto& entry : memberDataPtr->waitingTasks) {
+			if (entry.tid == tid) entry.isPaused = false;
+		}
+	}
+	dispatchTasks();
+
 	ConnPtr taskConn = getTaskConn(tid);
 	if (taskConn.get() != nullptr) 
 		getTaskConn(tid)->restore();
@@ -96,6 +284,13 @@ void TaskManager::restoreTask(const QString& tid)
 
 void TaskManager::pauseTask(const QString& tid)
 {
+	{
+		QMutexLocker lock(&memberDataPtr->schedMutex);
+		for (auto& entry : memberDataPtr->waitingTasks) {
+			if (entry.tid == tid) entry.isPaused = true;
+		}
+	}
+
 	ConnPtr taskConn = getTaskConn(tid);
 	if (taskConn.get() != nullptr) 
 		getTaskConn(tid)->pause();
@@ -109,6 +304,8 @@ void TaskManager::stopTask(const QString& tid)
 		getTaskConn(tid)->stop();
 		unregisterTask(tid);
 	}
+	releaseTaskSlot(tid);
+	untrackTaskProgress(tid);
 	DBOP::getInstance()->setTaskState(tid, TaskState::TaskCancel);
 }
 
@@ -118,6 +315,8 @@ void TaskManager::finishTask(const QString & tid)
 	if (taskConn.get() != nullptr) {
 		unregisterTask(tid);
 	}
+	releaseTaskSlot(tid);
+	untrackTaskProgress(tid);
 	DBOP::getInstance()->setTaskState(tid, TaskState::TaskFinished);
 }
 
@@ -127,15 +326,104 @@ void TaskManager::errorTask(const QString & tid)
 	if (taskConn.get() != nullptr) {
 		unregisterTask(tid);
 	}
+	releaseTaskSlot(tid);
+	untrackTaskProgress(tid);
 	DBOP::getInstance()->setTaskState(tid, TaskState::TaskError);
 }
 
 int TaskManager::getTaskProgress(const QString& tid)
+{
+	QMutexLocker lock(&memberDataPtr->progressMutex);
+	auto it = memberDataPtr->progressMap.find(tid);
+	if (it == memberDataPtr->progressMap.end()) return 0;
+
+	qint64 totalLen = it->progress->totalLen.load(std::memory_order_relaxed);
+	return totalLen > 0 ? int(it->progress->doneLen.load(std::memory_order_relaxed) * 100 / totalLen) : 0;
+}
+
+TaskProgressPtr TaskManager::trackTaskProgress(const QString & tid, qint64 totalLen)
+{
+	QMutexLocker lock(&memberDataPtr->progressMutex);
+	auto& entry = memberDataPtr->progressMap[tid];
+	if (entry.progress.get() == nullptr) {
+		entry.progress = std::make_shared<TaskProgress>(totalLen);
+		entry.lastDoneLen = 0;
+		entry.lastPublishTime = memberDataPtr->progressClock.elapsed();
+		entry.speed = 0;
+	}
+	else {
+		entry.progress->totalLen.store(totalLen, std::memory_order_relaxed);
+	}
+	return entry.progress;
+}
+
+void TaskManager::untrackTaskProgress(const QString & tid)
+{
+	QMutexLocker lock(&memberDataPtr->progressMutex);
+	memberDataPtr->progressMap.remove(tid);
+}
+
+void TaskManager::publishProgress()
+{
+	QVariantList updates;
+	{
+		QMutexLocker lock(&memberDataPtr->progressMutex);
+		qint64 now = memberDataPtr->progressClock.elapsed();
+		for (auto it = memberDataPtr->progressMap.begin(); it != memberDataPtr->progressMap.end(); ++it) {
+			auto& entry = it.value();
+			qint64 doneLen = entry.progress->doneLen.load(std::memory_order_relaxed);
+			qint64 totalLen = entry.progress->totalLen.load(std::memory_order_relaxed);
+			qint64 elapsed = now - entry.lastPublishTime;
+
+			//进度没有变化时只在速度归零时发布一次
+			if (doneLen == entry.lastDoneLen) {
+				if (entry.speed == 0) continue;
+				entry.speed = 0;
+			}
+			else if (elapsed > 0) {
+				double curSpeed = double(doneLen - entry.lastDoneLen) * 1000 / elapsed;
+				entry.speed = entry.speed == 0 ? curSpeed : entry.speed * (1 - progressSpeedWeight) + curSpeed * progressSpeedWeight;
+			}
+			entry.lastDoneLen = doneLen;
+			entry.lastPublishTime = now;
+
+			QVariantList update;
+			update.append(it.key());
+			update.append(totalLen > 0 ? int(doneLen * 100 / totalLen) : 0);
+			update.append(qint64(entry.speed));
+			update.append(entry.speed > 0 ? int((totalLen - doneLen) / entry.speed) : -1);
+			updates.append(QVariant(update));
+		}
+	}
+
+	if (!updates.isEmpty()) taskProgressUpdated(updates);
+}
+
+QVariantHash TaskManager::getTaskTransferInfo(const QString & tid)
 {
 	ConnPtr taskConn = getTaskConn(tid);
 	if (taskConn.get() != nullptr)
-		return getTaskConn(tid)->getProgress();
-	return 0;
+		return taskConn->getTransferInfo();
+	return QVariantHash();
+}
+
+int TaskManager::getTaskQueuePos(const QString & tid)
+{
+	QMutexLocker lock(&memberDataPtr->schedMutex);
+	auto queueOrder = sortedWaitingTasks(memberDataPtr);
+	auto it = std::find(queueOrder.begin(), queueOrder.end(), tid);
+	return it == queueOrder.end() ? -1 : int(it - queueOrder.begin());
+}
+
+void TaskManager::setTaskPriority(const QString & tid, int priority)
+{
+	{
+		QMutexLocker lock(&memberDataPtr->schedMutex);
+		for (auto& entry : memberDataPtr->waitingTasks) {
+			if (entry.tid == tid) entry.priority = priority;
+		}
+	}
+	dispatchTasks();
 }
 
 QVariantList TaskManager::listRunningTask()
@@ -165,9 +453,21 @@ ConnPtr TaskManager::getTaskConn(const QString& tid)
 
 QVariantList TaskManager::getSettings()
 {
-	return QVariantList();
+	QMutexLocker lock(&memberDataPtr->schedMutex);
+	QVariantList settings;
+	settings.append(memberDataPtr->maxRunningNum);
+	settings.append(memberDataPtr->maxPeerRunningNum);
+	return settings;
 }
 
 void TaskManager::setSettingOption(const QVariantList & options)
 {
+	{
+		QMutexLocker lock(&memberDataPtr->schedMutex);
+		if (options.size() > 0 && options[0].toInt() > 0)
+			memberDataPtr->maxRunningNum = options[0].toInt();
+		if (options.size() > 1 && options[1].toInt() > 0)
+			memberDataPtr->maxPeerRunningNum = options[1].toInt();
+	}
+	dispatchTasks();
 }
@@ -4,6 +4,7 @@
 #include "boost\noncopyable.hpp"
 
 #include "MsgParser.h"
+#include "TaskProgress.h"
 
 #include "QtCore\qobject.h"
 
@@ -22,6 +23,10 @@ public:
 	int createSendPicSingleTask(const QString& duuid, QVariantHash& data);
     Q_INVOKABLE int createFileDownloadTask(QString duuid, QVariantHash data, QString storePath);
 
+	void scheduleTask(const QString& tid, const QString& peer, int priority, std::function<void()>&& startFunc, ConnPtr taskConn = ConnPtr());
+	void dropConnTasks(ConnPtr taskConn);
+	TaskProgressPtr trackTaskProgress(const QString& tid, qint64 totalLen);
+
     Q_INVOKABLE void restoreTask(const QString& tid);
     Q_INVOKABLE void pauseTask(const QString& tid);
     Q_INVOKABLE void stopTask(const QString& tid);
@@ -29,11 +34,20 @@ public:
 	void errorTask(const QString& tid);
 
 	Q_INVOKABLE int getTaskProgress(const QString& tid);
+    Q_INVOKABLE QVariantHash getTaskTransferInfo(const QString& tid);
+    Q_INVOKABLE int getTaskQueuePos(const QString& tid);
+    Q_INVOKABLE void setTaskPriority(const QString& tid, int priority);
     Q_INVOKABLE QVariantList listRunningTask();
     Q_INVOKABLE QVariantList listFinishedTask();
 
     Q_INVOKABLE QVariantList getSettings();
     Q_INVOKABLE void setSettingOption(const QVariantList& options);
+
+signals:
+	void taskQueuePosChanged(const QString& tid, int pos);
+	//每项为 [tid, 百分比, 速度(字节/秒), 剩余秒数(-1未知)]
+	void taskProgressUpdated(QVariantList updates);
+
 private:
     TaskManager(QObject *parent = 0);
 
@@ -41,6 +55,11 @@ private:
 	inline void unregisterTask(const QString& tid);
 	ConnPtr getTaskConn(const QString& tid);
 
+	void releaseTaskSlot(const QString& tid);
+	void dispatchTasks();
+	void untrackTaskProgress(const QString& tid);
+	void publishProgress();
+
 	TaskManagerDataPtr memberDataPtr;
 };
 
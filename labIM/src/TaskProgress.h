@@ -0,0 +1,19 @@
+﻿#ifndef TASKPROGRESS_H
+#define TASKPROGRESS_H
+
+#include "QtCore\qglobal.h"
+
+#include <atomic>
+#include <memory>
+
+//传输循环只更新原子计数, 由TaskManager按界面刷新频率统一读取并计算速度与剩余时间
+struct TaskProgress {
+	TaskProgress(qint64 totalLen) : doneLen(0), totalLen(totalLen) {}
+
+	std::atomic<qint64> doneLen;
+	std::atomic<qint64> totalLen;
+};
+
+typedef std::shared_ptr<TaskProgress> TaskProgressPtr;
+
+#endif // !TASKPROGRESS_H
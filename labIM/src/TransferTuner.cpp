@@ -0,0 +1,103 @@
+﻿#include "TransferTuner.h"
+
+#include <algorithm>
+#include <cmath>
+
+const int minChunkSize = 16 * 1024;
+const int maxChunkSize = 4 * 1024 * 1024;
+const int initChunkSize = 64 * 1024;
+const int maxInflightNum = 4;
+const int sampleWindowChunks = 4;
+const int probeHoldWindows = 8;
+const double growGain = 1.05;
+const double shrinkLoss = 0.95;
+const double ewmaWeight = 0.25;
+
+TransferTuner::TransferTuner()
+	: chunkSize(initChunkSize), inflightNum(1), recvBuffSize(initChunkSize), direction(1), holdWindows(0), windowChunks(0), smallRecvNum(0),
+	windowBytes(0), throughput(0), lastThroughput(0), rttUs(-1), diskUs(0), sendUs(0)
+{
+}
+
+void TransferTuner::diskRead(int bytes, Duration cost)
+{
+	if (bytes <= 0) return;
+	diskUs = diskUs == 0 ? cost.count() : diskUs * (1 - ewmaWeight) + cost.count() * ewmaWeight;
+}
+
+void TransferTuner::chunkSent(int bytes, Duration cost)
+{
+	if (bytes <= 0) return;
+
+	auto now = Clock::now();
+	if (windowChunks == 0)
+		windowStart = now - cost;
+
+	sendUs = sendUs == 0 ? cost.count() : sendUs * (1 - ewmaWeight) + cost.count() * ewmaWeight;
+
+	//单块耗时中扣除按当前吞吐推算的传输时间, 剩余部分的最小值作为往返时延估计
+	if (throughput > 0) {
+		double overhead = std::max(0.0, cost.count() - bytes / throughput * 1e6);
+		rttUs = rttUs < 0 ? overhead : std::min(rttUs, overhead);
+	}
+
+	windowBytes += bytes;
+	if (++windowChunks < sampleWindowChunks) return;
+
+	auto windowUs = std::chrono::duration_cast<Duration>(now - windowStart).count();
+	if (windowUs > 0) {
+		double windowThroughput = windowBytes * 1e6 / windowUs;
+		throughput = throughput == 0 ? windowThroughput : throughput * (1 - ewmaWeight) + windowThroughput * ewmaWeight;
+		retune(windowThroughput);
+		lastThroughput = windowThroughput;
+	}
+
+	windowChunks = 0;
+	windowBytes = 0;
+}
+
+void TransferTuner::chunkRecv(int bytes)
+{
+	if (bytes >= recvBuffSize) {
+		recvBuffSize = std::min(recvBuffSize * 2, maxChunkSize);
+		smallRecvNum = 0;
+	}
+	else if (bytes < recvBuffSize / 4 && ++smallRecvNum >= sampleWindowChunks * 2) {
+		recvBuffSize = std::max(recvBuffSize / 2, minChunkSize);
+		smallRecvNum = 0;
+	}
+}
+
+void TransferTuner::retune(double windowThroughput)
+{
+	//爬山法: 吞吐提升则沿当前方向继续, 明显下降则回退, 持平时保持并定期反向试探
+	bool isResize = true;
+	if (lastThroughput > 0) {
+		if (windowThroughput < lastThroughput * shrinkLoss) {
+			direction = -direction;
+			holdWindows = 0;
+		}
+		else if (windowThroughput <= lastThroughput * growGain) {
+			if (++holdWindows < probeHoldWindows) {
+				isResize = false;
+			}
+			else {
+				direction = -direction;
+				holdWindows = 0;
+			}
+		}
+		else {
+			holdWindows = 0;
+		}
+	}
+
+	if (isResize)
+		chunkSize = direction > 0 ? std::min(chunkSize * 2, maxChunkSize) : std::max(chunkSize / 2, minChunkSize);
+
+	//预读块数覆盖带宽时延积, 磁盘读慢于发送时再多预读一块
+	double bdp = throughput * std::max(rttUs, 0.0) / 1e6;
+	int num = (int)std::ceil(bdp / chunkSize);
+	if (diskUs > sendUs * 0.5)
+		++num;
+	inflightNum = std::max(1, std::min(num, maxInflightNum));
+}
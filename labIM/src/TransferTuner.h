@@ -0,0 +1,36 @@
+﻿#ifndef TRANSFERTUNER_H
+#define TRANSFERTUNER_H
+
+#include <chrono>
+
+//根据实测吞吐, 往返时延和磁盘读耗时动态调整分块大小与预读块数
+class TransferTuner
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+	typedef std::chrono::microseconds Duration;
+
+	TransferTuner();
+
+	int getChunkSize()const { return chunkSize; }
+	int getInflightNum()const { return inflightNum; }
+	int getRecvBuffSize()const { return recvBuffSize; }
+	double getThroughput()const { return throughput; }
+	double getRttMs()const { return rttUs / 1000.0; }
+	double getDiskMs()const { return diskUs / 1000.0; }
+
+	void diskRead(int bytes, Duration cost);
+	void chunkSent(int bytes, Duration cost);
+	void chunkRecv(int bytes);
+
+private:
+	void retune(double windowThroughput);
+
+	int chunkSize, inflightNum, recvBuffSize;
+	int direction, holdWindows, windowChunks, smallRecvNum;
+	long long windowBytes;
+	Clock::time_point windowStart;
+	double throughput, lastThroughput, rttUs, diskUs, sendUs;
+};
+
+#endif // !TRANSFERTUNER_H
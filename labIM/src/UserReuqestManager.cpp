@@ -3,6 +3,7 @@
 #include "ConnectionManager.h"
 #include "NetStructureManager.h"
 #include "TaskManager.h"
+#include "IOContextManager.h"
 
 #include <QtCore/qset.h>
 
@@ -64,8 +65,10 @@ int UserReuqestManager::sendRequest(const QString & duuid, int type, QVariantHas
 
     QString reqDataStr = JsonDocType::fromVariant(QVariant(data)).toJson(JSON_FORMAT).toStdString().c_str();
 	RequestInfo req(duuid, type, reqDataStr);
-	int result = DBOP::getInstance()->createRequest(req, true);
-	if (result == 0) {
+	//请求落盘之后再发出, 避免对方的回复先于本地记录到达; 完成回调在写线程上, 发送交给IO线程
+	int result = DBOP::getInstance()->createRequest(req, true, [req, type](int writeResult) {
+		if (writeResult != 0) return;
+
 		JsonObjType datas;
 		datas["rid"] = req.rid;
 		datas["rtype"] = req.rtype;
@@ -74,8 +77,11 @@ int UserReuqestManager::sendRequest(const QString & duuid, int type, QVariantHas
 		datas["rsource"] = req.rsource;
 		datas["rdest"] = req.rdest;
 		datas["dest"] = req.rdest;
-        ConnectionManager::getInstance()->sendActionMsg(reqTransferModeMap[ReqType(type)], requestFamilyStr, sendRequestActionStr, datas);
-	}
+		auto mode = reqTransferModeMap[ReqType(type)];
+		boost::asio::post(IOContextManager::getInstance()->getIOLoop(), [mode, datas]() mutable {
+			ConnectionManager::getInstance()->sendActionMsg(mode, requestFamilyStr, sendRequestActionStr, datas);
+		});
+	});
 
 	return result;
 }
@@ -0,0 +1,470 @@
+﻿#include "ZipStream.h"
+#include "IOContextManager.h"
+
+#include "QtCore\qdir.h"
+#include "QtCore\qdiriterator.h"
+#include "QtCore\qfile.h"
+#include "QtCore\qfileinfo.h"
+#include "QtCore\qdatetime.h"
+#include "QtCore\qendian.h"
+
+const quint32 localHeaderSig = 0x04034b50;
+const quint32 centralHeaderSig = 0x02014b50;
+const quint32 endRecordSig = 0x06054b50;
+const quint16 zipVersion = 20;
+const quint16 utf8NameFlag = 0x0800;
+const quint16 storeMethod = 0;
+const quint16 deflateMethod = 8;
+const quint32 streamTrailerSig = 0x444e455a;
+const int trailerLen = 12;
+const int zipBlockSize = 256 * 1024;
+const int maxBufferedLen = 8 * 1024 * 1024;
+const qint64 maxReadyBytes = 16 * 1024 * 1024;
+const qint64 maxZipLen = 0xffffffffLL;
+const int maxZipEntries = 0xffff;
+
+static void appendU16(SendBufferType& buff, quint16 value)
+{
+	char bytes[2];
+	qToLittleEndian<quint16>(value, (uchar*)bytes);
+	buff.append(bytes, 2);
+}
+
+static void appendU32(SendBufferType& buff, quint32 value)
+{
+	char bytes[4];
+	qToLittleEndian<quint32>(value, (uchar*)bytes);
+	buff.append(bytes, 4);
+}
+
+ZipStream::ZipStream(const QString & dirPath)
+	: dirPath(dirPath), nextFile(0), runningNum(0), finishedNum(0), writeOffset(0), readyBytes(0), heldBytes(0), streamCrc(crc32(0L, Z_NULL, 0)),
+	isEnd(false), hasError(false), isReading(false)
+{
+	QDir dir(dirPath);
+	QDirIterator it(dirPath, QDir::Files | QDir::Hidden | QDir::Readable, QDirIterator::Subdirectories);
+	while (it.hasNext()) {
+		files.append(dir.relativeFilePath(it.next()));
+	}
+}
+
+void ZipStream::start(tcp::socket::executor_type notifyExecutor, std::function<void()>&& notifyHandler)
+{
+	executor = std::make_shared<tcp::socket::executor_type>(notifyExecutor);
+	notify = notifyHandler;
+
+	//条目数写在中央目录结尾的16位字段中
+	if (files.size() >= maxZipEntries) {
+		qDebug() << "zip stream too many files! num: " << files.size();
+		hasError = true;
+	}
+	else if (files.isEmpty()) {
+		writeCentralDir();
+	}
+	else {
+		scheduleCompress();
+	}
+
+	auto self = shared_from_this();
+	boost::asio::post(*executor, [this, self]() { notify(); });
+}
+
+SendBufferPtr ZipStream::takeChunk()
+{
+	if (readyChunks.empty()) return SendBufferPtr();
+
+	auto chunk = readyChunks.front();
+	readyChunks.pop_front();
+	readyBytes -= chunk->size();
+
+	//发送腾出空间后继续压缩
+	readNextBlock();
+	scheduleCompress();
+	return chunk;
+}
+
+void ZipStream::scheduleCompress()
+{
+	//同时压缩的文件数不超过工作线程数, 待发送和等待输出的数据超过上限时先不压缩
+	int workerNum = IOContextManager::getInstance()->getWorkerNum();
+	while (!hasError && runningNum < workerNum && nextFile < files.size() && readyBytes + heldBytes < maxReadyBytes) {
+		compressNext();
+	}
+}
+
+void ZipStream::compressNext()
+{
+	QString name = files[nextFile++];
+	QString filePath = dirPath + "/" + name;
+	++runningNum;
+
+	auto self = shared_from_this();
+	boost::asio::post(IOContextManager::getInstance()->getWorkLoop(), [this, self, name, filePath]() {
+		ZipEntry entry;
+		entry.name = name;
+		entry.isStreamed = QFileInfo(filePath).size() > maxBufferedLen;
+
+		SendBufferPtr data;
+		if (!entry.isStreamed)
+			data = compressFile(filePath, entry);
+		else if (!scanFile(filePath, entry))
+			entry.isStreamed = false;
+
+		boost::asio::post(*executor, [this, self, entry, data]() mutable {
+			entryFinished(entry, data);
+		});
+	});
+}
+
+void ZipStream::entryFinished(ZipEntry & entry, SendBufferPtr data)
+{
+	--runningNum;
+	++finishedNum;
+	if (hasError) return;
+
+	if (!entry.isStreamed && data.get() == nullptr) {
+		qDebug() << "zip stream compress file failed! filename: " << entry.name;
+		fail();
+		return;
+	}
+
+	heldEntries.push_back(std::make_pair(entry, data));
+	if (data.get() != nullptr) heldBytes += data->size();
+	flushEntries();
+	scheduleCompress();
+	notify();
+}
+
+void ZipStream::flushEntries()
+{
+	//条目按完成顺序输出, 大文件条目输出期间其余完成的条目先保留, 避免数据交错
+	while (!hasError && reader.get() == nullptr && !heldEntries.empty()) {
+		auto entry = heldEntries.front().first;
+		auto data = heldEntries.front().second;
+		heldEntries.pop_front();
+		if (data.get() != nullptr) heldBytes -= data->size();
+
+		//本地文件头中直接写入已知的校验和与长度
+		auto name = entry.name.toUtf8();
+		auto header = std::make_shared<SendBufferType>();
+		appendU32(*header, localHeaderSig);
+		appendU16(*header, zipVersion);
+		appendU16(*header, utf8NameFlag);
+		appendU16(*header, entry.method);
+		appendU16(*header, entry.dosTime);
+		appendU16(*header, entry.dosDate);
+		appendU32(*header, entry.crc);
+		appendU32(*header, entry.packedSize);
+		appendU32(*header, entry.rawSize);
+		appendU16(*header, name.size());
+		appendU16(*header, 0);
+		header->append(name);
+
+		if (writeOffset + header->size() + entry.packedSize >= maxZipLen) {
+			qDebug() << "zip stream archive too large! filename: " << entry.name;
+			fail();
+			return;
+		}
+
+		entry.offset = (quint32)writeOffset;
+		writeOffset += header->size() + entry.packedSize;
+		entries.push_back(entry);
+		pushChunk(header);
+
+		if (entry.isStreamed) {
+			reader = std::make_shared<EntryReader>(dirPath + "/" + entry.name, entry);
+			readNextBlock();
+		}
+		else {
+			pushChunk(data);
+		}
+	}
+
+	if (!hasError && !isEnd && reader.get() == nullptr && heldEntries.empty() && nextFile == files.size() && runningNum == 0)
+		writeCentralDir();
+}
+
+void ZipStream::readNextBlock()
+{
+	if (hasError || isReading || reader.get() == nullptr || readyBytes >= maxReadyBytes) return;
+
+	isReading = true;
+	auto self = shared_from_this();
+	auto curReader = reader;
+	boost::asio::post(IOContextManager::getInstance()->getWorkLoop(), [this, self, curReader]() {
+		auto block = curReader->next();
+		boost::asio::post(*executor, [this, self, curReader, block]() {
+			isReading = false;
+			if (hasError) return;
+
+			//扫描之后文件被修改时输出的数据与文件头不符, 按失败处理
+			if (block.get() == nullptr || (curReader->isEnd() && !curReader->isMatched())) {
+				qDebug() << "zip stream read file failed!";
+				fail();
+				return;
+			}
+
+			if (!block->isEmpty()) pushChunk(block);
+			if (curReader->isEnd()) {
+				reader.reset();
+				flushEntries();
+				scheduleCompress();
+			}
+			else {
+				readNextBlock();
+			}
+			notify();
+		});
+	});
+}
+
+void ZipStream::fail()
+{
+	//出错后不再写中央目录, 发送方据isError断开, 接收方收不到流尾即判定失败
+	hasError = true;
+	heldEntries.clear();
+	heldBytes = 0;
+	reader.reset();
+	notify();
+}
+
+void ZipStream::writeCentralDir()
+{
+	auto centralDir = std::make_shared<SendBufferType>();
+	for (auto& entry : entries) {
+		auto name = entry.name.toUtf8();
+		appendU32(*centralDir, centralHeaderSig);
+		appendU16(*centralDir, zipVersion);
+		appendU16(*centralDir, zipVersion);
+		appendU16(*centralDir, utf8NameFlag);
+		appendU16(*centralDir, entry.method);
+		appendU16(*centralDir, entry.dosTime);
+		appendU16(*centralDir, entry.dosDate);
+		appendU32(*centralDir, entry.crc);
+		appendU32(*centralDir, entry.packedSize);
+		appendU32(*centralDir, entry.rawSize);
+		appendU16(*centralDir, name.size());
+		appendU16(*centralDir, 0);
+		appendU16(*centralDir, 0);
+		appendU16(*centralDir, 0);
+		appendU16(*centralDir, 0);
+		appendU32(*centralDir, 0);
+		appendU32(*centralDir, entry.offset);
+		centralDir->append(name);
+	}
+
+	quint32 centralDirSize = centralDir->size();
+	appendU32(*centralDir, endRecordSig);
+	appendU16(*centralDir, 0);
+	appendU16(*centralDir, 0);
+	appendU16(*centralDir, entries.size());
+	appendU16(*centralDir, entries.size());
+	appendU32(*centralDir, centralDirSize);
+	appendU32(*centralDir, (quint32)writeOffset);
+	appendU16(*centralDir, 0);
+
+	if (writeOffset + centralDir->size() >= maxZipLen) {
+		qDebug() << "zip stream archive too large! len: " << writeOffset + centralDir->size();
+		fail();
+		return;
+	}
+	pushChunk(centralDir);
+
+	auto trailer = std::make_shared<SendBufferType>();
+	appendU32(*trailer, streamTrailerSig);
+	appendU32(*trailer, (quint32)(writeOffset + centralDir->size()));
+	appendU32(*trailer, streamCrc);
+	readyChunks.push_back(trailer);
+	readyBytes += trailer->size();
+	isEnd = true;
+}
+
+void ZipStream::pushChunk(SendBufferPtr chunk)
+{
+	streamCrc = crc32(streamCrc, (const Bytef*)chunk->constData(), chunk->size());
+	readyChunks.push_back(chunk);
+	readyBytes += chunk->size();
+}
+
+void ZipStream::setModifyTime(const QString & filePath, ZipEntry & entry)
+{
+	auto modifyTime = QFileInfo(filePath).lastModified();
+	entry.dosTime = (modifyTime.time().hour() << 11) | (modifyTime.time().minute() << 5) | (modifyTime.time().second() / 2);
+	entry.dosDate = ((modifyTime.date().year() - 1980) << 9) | (modifyTime.date().month() << 5) | modifyTime.date().day();
+}
+
+SendBufferPtr ZipStream::compressFile(const QString & filePath, ZipEntry & entry)
+{
+	//只处理不超过maxBufferedLen的文件, 多读一个字节判断文件是否在此期间变大
+	QFile file(filePath);
+	if (!file.open(QFile::ReadOnly)) return SendBufferPtr();
+
+	auto raw = file.read(maxBufferedLen + 1);
+	file.close();
+	if (raw.size() > maxBufferedLen) return SendBufferPtr();
+
+	setModifyTime(filePath, entry);
+	entry.rawSize = raw.size();
+	entry.crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef*)raw.constData(), raw.size());
+
+	//zip中的deflate数据不带zlib头, 需要使用负的窗口位数
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return SendBufferPtr();
+
+	auto packed = std::make_shared<SendBufferType>((int)deflateBound(&zs, raw.size()), '\0');
+	zs.next_in = (Bytef*)raw.data();
+	zs.avail_in = raw.size();
+	zs.next_out = (Bytef*)packed->data();
+	zs.avail_out = packed->size();
+	int ret = deflate(&zs, Z_FINISH);
+	packed->resize(zs.total_out);
+	deflateEnd(&zs);
+	if (ret != Z_STREAM_END) return SendBufferPtr();
+
+	if (packed->size() >= raw.size()) {
+		entry.method = storeMethod;
+		entry.packedSize = raw.size();
+		return std::make_shared<SendBufferType>(raw);
+	}
+
+	entry.method = deflateMethod;
+	entry.packedSize = packed->size();
+	return packed;
+}
+
+bool ZipStream::scanFile(const QString & filePath, ZipEntry & entry)
+{
+	//大文件按块读一遍, 得到校验和与压缩后长度, 压缩输出丢弃, 输出条目时再压缩一遍
+	QFile file(filePath);
+	if (!file.open(QFile::ReadOnly)) return false;
+
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+
+	setModifyTime(filePath, entry);
+	quint32 crc = crc32(0L, Z_NULL, 0);
+	qint64 rawLen = 0;
+	QByteArray block, scratch(zipBlockSize, '\0');
+	int ret = Z_OK;
+	do {
+		block = file.read(zipBlockSize);
+		bool isLast = block.size() < zipBlockSize;
+		crc = crc32(crc, (const Bytef*)block.constData(), block.size());
+		rawLen += block.size();
+
+		zs.next_in = (Bytef*)block.data();
+		zs.avail_in = block.size();
+		do {
+			zs.next_out = (Bytef*)scratch.data();
+			zs.avail_out = scratch.size();
+			ret = deflate(&zs, isLast ? Z_FINISH : Z_NO_FLUSH);
+		} while (zs.avail_out == 0 && ret != Z_STREAM_ERROR);
+		if (isLast) break;
+	} while (ret != Z_STREAM_ERROR && rawLen < maxZipLen);
+
+	qint64 packedLen = zs.total_out;
+	deflateEnd(&zs);
+	bool isReadFailed = file.error() != QFile::NoError;
+	file.close();
+
+	//不支持Zip64, 4GB以上的条目无法写入32位的长度字段
+	if (rawLen >= maxZipLen) {
+		qDebug() << "zip stream file too large! filename: " << filePath;
+		return false;
+	}
+	if (ret != Z_STREAM_END || isReadFailed) return false;
+
+	entry.crc = crc;
+	entry.rawSize = (quint32)rawLen;
+	entry.method = packedLen < rawLen ? deflateMethod : storeMethod;
+	entry.packedSize = (quint32)(packedLen < rawLen ? packedLen : rawLen);
+	return true;
+}
+
+ZipStream::EntryReader::EntryReader(const QString & filePath, const ZipEntry & entry)
+	: file(filePath), entry(entry), crc(crc32(0L, Z_NULL, 0)), rawLen(0), packedLen(0), isInit(false), isReadEnd(false)
+{
+	memset(&zs, 0, sizeof(zs));
+}
+
+ZipStream::EntryReader::~EntryReader()
+{
+	if (isInit && entry.method == deflateMethod) deflateEnd(&zs);
+}
+
+SendBufferPtr ZipStream::EntryReader::next()
+{
+	if (!isInit) {
+		if (!file.open(QFile::ReadOnly)) return SendBufferPtr();
+		if (entry.method == deflateMethod && deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return SendBufferPtr();
+		isInit = true;
+	}
+
+	auto block = file.read(zipBlockSize);
+	if (file.error() != QFile::NoError) return SendBufferPtr();
+	isReadEnd = block.size() < zipBlockSize;
+	crc = crc32(crc, (const Bytef*)block.constData(), block.size());
+	rawLen += block.size();
+
+	if (entry.method != deflateMethod) {
+		packedLen += block.size();
+		return std::make_shared<SendBufferType>(block);
+	}
+
+	//与扫描时相同的参数压缩同样的数据, 输出与扫描得到的长度一致
+	auto packed = std::make_shared<SendBufferType>();
+	QByteArray scratch(zipBlockSize, '\0');
+	zs.next_in = (Bytef*)block.data();
+	zs.avail_in = block.size();
+	int ret = Z_OK;
+	do {
+		zs.next_out = (Bytef*)scratch.data();
+		zs.avail_out = scratch.size();
+		ret = deflate(&zs, isReadEnd ? Z_FINISH : Z_NO_FLUSH);
+		if (ret == Z_STREAM_ERROR) return SendBufferPtr();
+		packed->append(scratch.constData(), scratch.size() - zs.avail_out);
+	} while (zs.avail_out == 0);
+	if (isReadEnd && ret != Z_STREAM_END) return SendBufferPtr();
+
+	packedLen += packed->size();
+	return packed;
+}
+
+bool ZipStream::EntryReader::isMatched() const
+{
+	return crc == entry.crc && rawLen == entry.rawSize && packedLen == entry.packedSize;
+}
+
+ZipTrailerCheck::ZipTrailerCheck()
+	: crc(crc32(0L, Z_NULL, 0)), len(0)
+{
+}
+
+void ZipTrailerCheck::feed(RecvBufferType & data)
+{
+	tail.append(data);
+	if (tail.size() <= trailerLen) {
+		data.clear();
+		return;
+	}
+
+	data = tail.left(tail.size() - trailerLen);
+	tail = tail.right(trailerLen);
+	crc = crc32(crc, (const Bytef*)data.constData(), data.size());
+	len += data.size();
+}
+
+bool ZipTrailerCheck::verify() const
+{
+	if (tail.size() != trailerLen) return false;
+
+	auto bytes = (const uchar*)tail.constData();
+	return qFromLittleEndian<quint32>(bytes) == streamTrailerSig
+		&& qFromLittleEndian<quint32>(bytes + 4) == len
+		&& qFromLittleEndian<quint32>(bytes + 8) == crc;
+}
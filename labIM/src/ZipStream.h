@@ -0,0 +1,101 @@
+﻿#ifndef ZIPSTREAM_H
+#define ZIPSTREAM_H
+
+#include "Common.h"
+
+#include "QtCore\qfile.h"
+#include "QtCore\qstringlist.h"
+
+#include "zlib.h"
+
+#include <deque>
+#include <vector>
+
+//边压缩边输出的zip流: 目录下的小文件在工作线程池中并行压缩, 哪个先完成就先输出哪个条目,
+//大文件先扫描一遍得到校验和与长度, 输出时再按块压缩; 全部完成后追加中央目录.
+//待发送的数据超过上限时暂停压缩, 由接收方的速度控制内存占用. 不支持Zip64, 4GB以上的条目或整个包直接报错.
+//状态只在调用start时传入的线程上修改
+class ZipStream : public std::enable_shared_from_this<ZipStream>, public boost::noncopyable
+{
+public:
+	ZipStream(const QString& dirPath);
+
+	void start(tcp::socket::executor_type notifyExecutor, std::function<void()>&& notifyHandler);
+	SendBufferPtr takeChunk();
+
+	bool isFinished()const { return isEnd && readyChunks.empty(); }
+	bool isError()const { return hasError; }
+	int getFileNum()const { return (int)files.size(); }
+
+private:
+	struct ZipEntry {
+		QString name;
+		quint32 crc, packedSize, rawSize, offset;
+		quint16 method, dosTime, dosDate;
+		bool isStreamed;
+	};
+
+	//大文件条目的按块读取与压缩, 同一时刻只在一个工作线程上执行
+	class EntryReader {
+	public:
+		EntryReader(const QString& filePath, const ZipEntry& entry);
+		~EntryReader();
+
+		SendBufferPtr next();
+		bool isEnd()const { return isReadEnd; }
+		bool isMatched()const;
+
+	private:
+		QFile file;
+		z_stream zs;
+		ZipEntry entry;
+		quint32 crc;
+		qint64 rawLen, packedLen;
+		bool isInit, isReadEnd;
+	};
+
+	void compressNext();
+	void scheduleCompress();
+	void entryFinished(ZipEntry& entry, SendBufferPtr data);
+	void flushEntries();
+	void readNextBlock();
+	void writeCentralDir();
+	void pushChunk(SendBufferPtr chunk);
+	void fail();
+
+	static SendBufferPtr compressFile(const QString& filePath, ZipEntry& entry);
+	static bool scanFile(const QString& filePath, ZipEntry& entry);
+	static void setModifyTime(const QString& filePath, ZipEntry& entry);
+
+	QString dirPath;
+	QStringList files;
+	int nextFile, runningNum, finishedNum;
+	qint64 writeOffset, readyBytes, heldBytes;
+	quint32 streamCrc;
+	bool isEnd, hasError, isReading;
+	std::vector<ZipEntry> entries;
+	std::deque<std::pair<ZipEntry, SendBufferPtr>> heldEntries;
+	std::shared_ptr<EntryReader> reader;
+	std::deque<SendBufferPtr> readyChunks;
+	std::shared_ptr<tcp::socket::executor_type> executor;
+	std::function<void()> notify;
+};
+
+typedef std::shared_ptr<ZipStream> ZipStreamPtr;
+
+//流尾校验: 接收方始终扣留最后trailerLen字节, 连接关闭时校验魔数, 长度和CRC32,
+//发送方压缩失败或中途断开时同样表现为EOF, 只有校验通过才算收完
+class ZipTrailerCheck
+{
+public:
+	ZipTrailerCheck();
+
+	void feed(RecvBufferType& data);
+	bool verify()const;
+
+private:
+	RecvBufferType tail;
+	quint32 crc, len;
+};
+
+#endif // !ZIPSTREAM_H
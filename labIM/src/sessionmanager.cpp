@@ -6,9 +6,12 @@
 #include "TaskManager.h"
 #include "HomeworkManager.h"
 #include "SharedFileManager.h"
+#include "IOContextManager.h"
 
 #include "QtCore\qfileinfo.h"
 #include "QtCore\quuid.h"
+#include "QtCore\qbuffer.h"
+#include "QtGui\qimagereader.h"
 
 const StringType sessionFamilyStr("SeesionManage");
 const StringType transferStrActionStr("TransferStr");
@@ -17,6 +20,11 @@ const StringType transferFileActionStr("TransferFile");
 const StringType listSharedFileInfoActionStr("ListSharedFileInfo");
 const StringType sendSharedFileInfoActionStr("SendSharedFileInfo");
 
+const int picThumbMinSize = 64 * 1024;
+const int picThumbMaxEdge = 160;
+const int picThumbQuality = 50;
+const int picThumbMaxLen = 64 * 1024;
+
 SessionManager::SessionManager(QObject *parent)
     :QObject(parent)
 {
@@ -101,6 +109,24 @@ void SessionManager::sendPic(int stype, const QString & duuid, const QUrl & picP
     taskData["picSize"] = picInfo.size();
 	taskData["picStoreName"] = QUuid::createUuid().toString().remove(QRegExp("[{}]{1}")) + "." + picInfo.completeSuffix();
 
+	//小图和动图直接发送, 大图先在工作线程生成缩略图随服务参数一起发出, 对方可以先显示缩略图
+	if (isAnimation || picInfo.size() < picThumbMinSize) {
+		startSendPic(stype, duuid, taskData);
+		return;
+	}
+
+	boost::asio::post(IOContextManager::getInstance()->getWorkLoop(), [this, stype, duuid, taskData]() mutable {
+		auto thumb = makePicThumb(taskData["picRealName"].toString());
+		if (!thumb.isEmpty()) taskData["picThumb"] = thumb;
+
+		QMetaObject::invokeMethod(this, [this, stype, duuid, taskData]() mutable {
+			startSendPic(stype, duuid, taskData);
+		}, Qt::QueuedConnection);
+	});
+}
+
+void SessionManager::startSendPic(int stype, const QString & duuid, QVariantHash & taskData)
+{
 	if (SessionType::UserSession == SessionType(stype)) {
 		TaskManager::getInstance()->createSendPicSingleTask(duuid, taskData);
 	}
@@ -109,6 +135,34 @@ void SessionManager::sendPic(int stype, const QString & duuid, const QUrl & picP
 	}
 }
 
+QString SessionManager::makePicThumb(const QString & picPath)
+{
+	//按缩小后的尺寸解码, jpeg可以直接在解码时降采样, 不必先解出整张原图
+	QImageReader reader(picPath);
+	QSize picSize = reader.size();
+	if (picSize.isValid()) {
+		reader.setScaledSize(picSize.scaled(picThumbMaxEdge, picThumbMaxEdge, Qt::KeepAspectRatio));
+	}
+
+	QImage thumb = reader.read();
+	if (thumb.isNull()) {
+		qDebug() << "picture thumbnail create failed! path: " << picPath << " reason: " << reader.errorString();
+		return QString();
+	}
+	if (!picSize.isValid()) {
+		thumb = thumb.scaled(picThumbMaxEdge, picThumbMaxEdge, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+	}
+
+	QByteArray thumbData;
+	QBuffer buffer(&thumbData);
+	buffer.open(QIODevice::WriteOnly);
+	thumb.save(&buffer, "JPG", picThumbQuality);
+
+	//缩略图放在服务参数中随连接头发送, 接收方收完整个头才开始显示, 过大的缩略图不如直接等原图
+	auto result = thumbData.toBase64();
+	return result.size() > picThumbMaxLen ? QString() : QString(result);
+}
+
 void SessionManager::sendFile(int stype, const QString & duuid, const QUrl & filePath)
 {
 	if (SessionType::UserSession == SessionType(stype)) {
@@ -175,6 +229,11 @@ int SessionManager::createMessage(const MessageInfo & msg, bool isSend)
 	return DBOP::getInstance()->createMessage(msg, isSend);
 }
 
+int SessionManager::updateMessageData(const QString & mid, const QString & data)
+{
+	return DBOP::getInstance()->updateMessageData(mid, data);
+}
+
 void SessionManager::handleRecvChatMsg(JsonObjType & msg, ConnPtr conn)
 {
 	qDebug() << "RECV CHAT MSG: " << msg;
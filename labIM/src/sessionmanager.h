@@ -38,9 +38,13 @@ public:
 	Q_INVOKABLE QString getLocalAdmin();
 
 	int createMessage(const MessageInfo& msg, bool isSend);
+	int updateMessageData(const QString& mid, const QString& data);
 private:
     SessionManager(QObject *parent = 0);
 
+	void startSendPic(int stype, const QString& duuid, QVariantHash& taskData);
+	static QString makePicThumb(const QString& picPath);
+
 	void handleRecvChatMsg(JsonObjType& msg, ConnPtr conn);
 	void handleListSharedFileInfo(JsonObjType& msg, ConnPtr conn);
 	void handleSendSharedFileInfo(JsonObjType& msg, ConnPtr conn);